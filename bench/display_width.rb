@@ -0,0 +1,29 @@
+# Measures the throughput of the display width engine used to lay out the
+# prompt and the edited line.
+#
+#   bundle exec rake bench
+#   FORMAT=json ruby -Ilib bench/display_width.rb
+require 'benchmark'
+require 'linenoise'
+require_relative 'support/report'
+
+SIZE = 1 << 20
+ITERATIONS = 200
+
+samples = {
+  'ascii' => 'SELECT * FROM users WHERE id = 42; ',
+  'latin' => 'Ça coûte très cher, señor. ',
+  'cjk' => '日本語のテキストを編集する。',
+  'emoji' => "\u{1F44D}\u{1F3FD} \u{1F468}‍\u{1F469}‍\u{1F467} \u{1F1FA}\u{1F1E6} "
+}
+
+report = BenchReport.new('display_width', %i[mb_per_s columns])
+samples.each do |name, sample|
+  str = (sample * (SIZE / sample.bytesize + 1)).byteslice(0, SIZE).scrub('')
+  width = 0
+  time = Benchmark.realtime do
+    ITERATIONS.times { width = Linenoise.display_width(str) }
+  end
+  report.add(name, mb_per_s: str.bytesize * ITERATIONS / time / (1 << 20),
+                   columns: width)
+end
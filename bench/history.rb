@@ -0,0 +1,63 @@
+# Measures the history of an editor from 10k to 10M entries: adding lines,
+# adding to a full history (which evicts the oldest entry) with a lookup
+# after every line so that the index is kept up to date, saving, loading,
+# and looking up suggestions, the first of which sorts the index again after
+# a load.
+#
+#   bundle exec rake bench
+#   SIZES=10000,100000 FORMAT=json ruby -Ilib bench/history.rb
+require 'benchmark'
+require 'tempfile'
+require 'linenoise'
+require_relative 'support/report'
+
+SIZES = ENV.fetch('SIZES', '10000,100000,1000000,10000000')
+           .split(',').map(&:to_i)
+EVICTIONS = 1000
+LOOKUPS = 10_000
+
+WORDS = %w[git ls cd make grep ssh docker bundle rake cat].freeze
+# Building millions of strings would take longer than adding them: lines are
+# taken from a pool instead.
+LINES = Array.new(1 << 16) { |i| "#{WORDS[i % WORDS.size]} --entry=#{i}" }
+
+def new_history(size)
+  history = Linenoise::Editor.new.history
+  history.max_size = size
+  history
+end
+
+report = BenchReport.new('history', %i[add_per_s evict_us save_ms load_ms
+                                       file_mb index_ms suggest_us])
+SIZES.each do |size|
+  history = new_history(size)
+  add = Benchmark.realtime do
+    size.times { |i| history << LINES[i & (LINES.size - 1)] }
+  end
+  history.suggest('git') # Sorts the index after the lines added in bulk.
+  evict = Benchmark.realtime do
+    EVICTIONS.times do |i|
+      history << "evicting #{i}"
+      history.suggest('evicting')
+    end
+  end
+
+  file = Tempfile.new('linenoise-history')
+  save = Benchmark.realtime { history.save(file.path) }
+  loaded = new_history(size)
+  load = Benchmark.realtime { loaded.load(file.path) }
+  index = Benchmark.realtime { loaded.suggest('git') }
+  suggest = Benchmark.realtime do
+    LOOKUPS.times { |i| loaded.suggest(LINES[i][0, 8]) }
+  end
+
+  report.add(size.to_s,
+             add_per_s: size / add,
+             evict_us: evict / EVICTIONS * 1e6,
+             save_ms: save * 1e3,
+             load_ms: load * 1e3,
+             file_mb: File.size(file.path).fdiv(1 << 20),
+             index_ms: index * 1e3,
+             suggest_us: suggest / LOOKUPS * 1e6)
+  file.close!
+end
@@ -0,0 +1,141 @@
+# Drives the editor through a pseudo-terminal, like a user would: keys are
+# sent one at a time and the next one waits for the terminal to show the
+# previous one. Pastes are sent in a single write.
+#
+# Reports, for every scenario, the keys sent and the time until the first
+# byte of output is seen for each of them, as measured on the terminal side.
+# It also reports the key latency measured by the editor itself (see
+# Linenoise.stats) with the median bytes it wrote per key, the bytes it
+# emitted, and the keys handled per second.
+#
+#   bundle exec rake bench
+#   FORMAT=json ruby -Ilib bench/pty.rb
+require 'pty'
+require 'io/console'
+require 'json'
+require 'rbconfig'
+require 'tempfile'
+require_relative 'support/report'
+
+# Marks the end of a line read by the child. Raw mode drops the input sent
+# before it is entered, so the next prompt is waited for as well.
+DONE = "\x1e> ".freeze
+
+CHILD = <<~'RUBY'.freeze
+  require 'linenoise'
+  require 'json'
+
+  $stdout.sync = true
+  eval(ENV.fetch('BENCH_SETUP'))
+  Linenoise.stats_enabled = true
+  print "\x1e" while Linenoise.linenoise('> ')
+  File.write(ENV.fetch('BENCH_STATS'), JSON.generate(Linenoise.stats))
+RUBY
+
+Scenario = Struct.new(:name, :setup, :keys, :paste)
+
+WORDS = %w[select from where group order limit insert update delete].freeze
+TEXT = Array.new(400) { |i| WORDS[i % WORDS.size] }.join(' ')
+
+SCENARIOS = [
+  Scenario.new('typing', 'Linenoise.multiline = false', TEXT[0, 60].chars),
+  Scenario.new('scrolling', 'Linenoise.multiline = false',
+               TEXT[0, 300].chars),
+  Scenario.new('wrapping', 'Linenoise.multiline = true', TEXT[0, 300].chars),
+  Scenario.new('paste', 'Linenoise.multiline = true', [], TEXT[0, 2000]),
+  Scenario.new('history',
+               'Linenoise::HISTORY.max_size = 1000
+                1000.times { |i| Linenoise::HISTORY << "entry #{i} " * 4 }',
+               ["\e[A"] * 500 + ["\e[B"] * 500),
+  Scenario.new('completion',
+               'LIST = Array.new(50) { |i| "candidate#{i}" }
+                Linenoise.completion_proc = proc { LIST }',
+               ["\t"] * 200),
+  Scenario.new('hints',
+               'Linenoise.hint_proc = proc { |s| " <#{s.size}>" }',
+               TEXT[0, 60].chars),
+  Scenario.new('autosuggest',
+               '1000.times { |i| Linenoise::HISTORY << "entry #{i}" }
+                Linenoise::HISTORY << ' + TEXT[0, 70].inspect + '
+                Linenoise.autosuggest = true',
+               TEXT[0, 60].chars)
+].freeze
+
+# Reads what the terminal has to show without waiting.
+def drain(io)
+  bytes = 0
+  loop { bytes += io.read_nonblock(1 << 16).bytesize }
+rescue IO::WaitReadable, EOFError, Errno::EIO
+  bytes
+end
+
+# Reads until 'marker' shows up, or the end of the output when nil. Returns
+# the bytes read.
+def read_until(io, marker)
+  buf = +''
+  buf << io.readpartial(1 << 16) until marker && buf.include?(marker)
+  buf.bytesize
+rescue EOFError, Errno::EIO
+  buf.bytesize
+end
+
+def percentile(sorted, p)
+  return if sorted.empty?
+
+  sorted[[(p * sorted.size).ceil - 1, 0].max] * 1e6
+end
+
+def run(scenario)
+  stats_file = Tempfile.new('linenoise-bench')
+  master, slave = PTY.open
+  slave.winsize = [24, 80]
+  env = { 'BENCH_SETUP' => scenario.setup, 'BENCH_STATS' => stats_file.path }
+  lib = File.expand_path('../lib', __dir__)
+  pid = spawn(env, RbConfig.ruby, '-I', lib, '-e', CHILD,
+              in: slave, out: slave, err: slave)
+  slave.close
+
+  read_until(master, '> ')
+  latencies = []
+  emitted = 0
+  start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  scenario.keys.each do |key|
+    sent = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    master.write(key)
+    next unless IO.select([master], nil, nil, 1)
+
+    latencies << Process.clock_gettime(Process::CLOCK_MONOTONIC) - sent
+    emitted += drain(master)
+  end
+  master.write(scenario.paste) if scenario.paste
+  master.write("\r")
+  emitted += read_until(master, DONE)
+  elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+
+  master.write("\x04")
+  read_until(master, nil)
+  Process.wait(pid)
+  stats = JSON.parse(File.read(stats_file.path), symbolize_names: true)
+  keys = scenario.keys.size + (scenario.paste ? scenario.paste.size : 0) + 1
+  latencies.sort!
+
+  {
+    keys: keys,
+    term_p50_us: percentile(latencies, 0.5),
+    term_p99_us: percentile(latencies, 0.99),
+    edit_p50_us: stats[:key_latency][:p50] * 1e6,
+    edit_p99_us: stats[:key_latency][:p99] * 1e6,
+    edit_bytes_p50: stats[:key_bytes][:p50],
+    bytes: emitted,
+    bytes_per_key: emitted.fdiv(keys),
+    keys_per_s: keys / elapsed
+  }
+ensure
+  master&.close
+  stats_file&.close!
+end
+
+report = BenchReport.new('pty', %i[keys term_p50_us term_p99_us edit_p50_us
+                                   edit_p99_us edit_bytes_p50 bytes
+                                   bytes_per_key keys_per_s])
+SCENARIOS.each { |scenario| report.add(scenario.name, run(scenario)) }
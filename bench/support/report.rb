@@ -0,0 +1,37 @@
+require 'json'
+
+# Prints the results of a benchmark as a table, or as JSON lines when FORMAT
+# is json, one object per result, so that runs can be tracked by tools.
+class BenchReport
+  def initialize(suite, columns)
+    @suite = suite
+    @columns = columns
+    @json = ENV['FORMAT'] == 'json'
+    @header = false
+  end
+
+  def add(name, values)
+    if @json
+      puts JSON.generate({ suite: @suite, name: name }.merge(values))
+    else
+      header unless @header
+      cells = @columns.map { |column| format_value(values[column]) }
+      puts format("%-14s #{'%14s ' * cells.size}", name, *cells).rstrip
+    end
+    $stdout.flush
+  end
+
+  private
+
+  def header
+    puts "== #{@suite}"
+    puts format("%-14s #{'%14s ' * @columns.size}", 'name', *@columns).rstrip
+    @header = true
+  end
+
+  def format_value(value)
+    return '-' if value.nil?
+
+    value.is_a?(Float) ? format('%.1f', value) : value.to_s
+  end
+end
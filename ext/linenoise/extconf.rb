@@ -1,4 +1,5 @@
 require 'mkmf'
 dir_config('linenoise')
 have_header('linenoise.h')
+have_func('rb_ext_ractor_safe', 'ruby.h')
 create_makefile('linenoise/linenoise')
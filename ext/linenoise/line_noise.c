@@ -115,39 +115,198 @@
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "line_noise.h"
+#include "utf8.h"
 
 #define LINENOISE_DEFAULT_HISTORY_MAX_LEN 100
 #define LINENOISE_MAX_LINE 4096
+#define LINENOISE_DEFAULT_ESC_TIMEOUT 50
+#define LINENOISE_HISTORY_INDEX_BATCH 64
+#define LINENOISE_COMPLETION_ARENA_MIN 4096
+#define LINENOISE_COMPLETION_ARENA_KEEP 65536
+#define LINENOISE_OUTPUT_BATCH 65536
+#define LINENOISE_INPUT_BATCH 4096
+#define LINENOISE_HISTORY_HEADER "#linenoise-history v2"
 static char *unsupported_term[] = {"dumb","cons25","emacs",NULL};
+static pthread_once_t atexit_once = PTHREAD_ONCE_INIT; /* Register atexit just 1 time. */
+
+/* We define a very simple "append buffer" structure, that is an heap
+ * allocated string where we can append to. */
+struct abuf {
+    char *b;
+    int len;
+    int cap;
+};
+
+/* The linenoiseEditor structure holds everything that outlives a single
+ * call to linenoiseEditorReadLine(): settings, callbacks, terminal state
+ * and history. Every editor is independent, so a program can run many
+ * editing sessions at once, one per terminal. The linenoise*() functions
+ * without an editor argument use a default editor attached to stdin and
+ * stdout. */
+struct linenoiseEditor {
+    int ifd;            /* Terminal stdin file descriptor. */
+    int ofd;            /* Terminal stdout file descriptor. */
+    char *buf;          /* Edited line buffer, allocated on first use. */
+    size_t buflen;      /* Size of buf, grown for long lines. */
+    char *flat;         /* The edited line joined for the callbacks. */
+    size_t flatlen;     /* Size of flat. */
+    size_t *lines;      /* Line index of the edited line. */
+    size_t linescap;    /* Entries allocated in lines. */
+    char *scratch;      /* The typed line, saved while browsing history. */
+    int wakefd[2];      /* Pipe waking up a read blocked by the editor. */
+    int cancelled;      /* Set by linenoiseEditorCancel(). */
+    void *data;         /* Opaque user data. */
+    linenoiseEditorCompletionCallback *completionCallback;
+    linenoiseEditorHintsCallback *hintsCallback;
+    linenoiseEditorFreeHintsCallback *freeHintsCallback;
+    linenoiseEditorWriteCallback *writeCallback; /* Replaces write(ofd). */
+    struct abuf out;    /* Output not written yet, see writeOut(). */
+    int buffering;      /* Output is written when waiting for input. */
+    linenoiseEditorHighlightCallback *highlightCallback;
+    linenoiseHighlights highlights; /* Spans of the edited line. */
+    linenoiseHighlights hlspans;    /* New spans of the region changed. */
+    linenoiseCompletions completions; /* Reused on every <tab>. */
+    size_t *completions_set; /* Hash set used to drop duplicates. */
+    size_t completions_set_size;
+
+    struct termios orig_termios; /* In order to restore at exit.*/
+    int rawmode;    /* For atexit() function to check if restore is needed*/
+    int session;    /* Nesting of linenoiseEditorBeginSession() calls. */
+    int sessiontty; /* The session switched the mode of the terminal. */
+    int readahead;  /* Nesting of linenoiseEditorBeginReadAhead() calls. */
+    char *inbuf;    /* Input read ahead, see readLineByte(). */
+    size_t inpos;
+    size_t inlen;
+    int rawinput;   /* Input is not a tty but sends raw keys anyway. */
+    int crpending;  /* Raw input: the last line was accepted with a CR. */
+    int mlmode;     /* Multi line mode. Default is single line. */
+    int menumode;   /* Completion menu. Default is cycling on <tab>. */
+    int autosuggest; /* Show history suggestions as hints. */
+    int highlight;  /* Highlight the line with the built-in lexer. */
+    int cols;       /* Forced terminal width, 0 to ask the terminal. */
+    int rows;       /* Forced terminal height, 0 to ask the terminal. */
+    int esctimeout; /* Milliseconds to wait for the rest of a sequence. */
+    struct keyBinding *bindings; /* Sorted by key, NULL for the defaults. */
+    size_t nbindings;
+    char *killbuf;  /* The text last killed, for yank. */
+    size_t killlen;
+    /* The history may be used by other threads while a line is edited, so
+     * all the fields below are protected by history_lock. Functions of the
+     * "History" and "History index" sections expect the caller to hold it,
+     * the public ones take it themselves. */
+    pthread_rwlock_t history_lock;
+    int history_max_len;
+    int history_len;
+    /* The history is a ring buffer of history_max_len slots, the oldest
+     * entry in slot history_head: when it is full, adding an entry replaces
+     * the oldest one in place. See historySlot(). The entry numbered j,
+     * from the oldest, has the sequence number history_base+j+1, so
+     * evicting the oldest entry just increments history_base. */
+    char **history;
+    int history_head;
+
+    /* History prefix index used by autosuggestions. It is a treap of the
+     * entries sorted by their text, then by age, every node holding the
+     * max sequence number of its subtree. All the entries sharing a prefix
+     * are contiguous in the tree, so the most recent one is found walking
+     * down two paths, O(log n), and adding, evicting or replacing an entry
+     * is O(log n) too. The node of an entry is history_nodes[slot], so the
+     * nodes are allocated along with the slots.
+     *
+     * When many updates happen without lookups in between (loading a file,
+     * pushing lines in bulk) the index is marked dirty and built again
+     * from the sorted entries on the next lookup instead. */
+    struct historyNode *history_nodes;
+    int history_nodes_len;      /* Nodes allocated. */
+    int history_root;           /* Slot of the root node, or -1. */
+    int history_index_dirty;    /* Rebuild the index on next lookup. */
+    int history_index_updates;  /* Updates since the last lookup. */
+    unsigned long history_base; /* Sequence number of the last evicted. */
+    unsigned long history_gen;  /* Changes when an entry is replaced. */
+
+    /* Instrumentation, see the "Stats" section. The counters are updated
+     * under stats_lock, and only when stats_enabled is set. */
+    int stats_enabled;
+    int stats_editing;          /* Reading keys, not lines of text. */
+    uint64_t stats_key_start;   /* When the pending input arrived, or 0. */
+    uint64_t stats_key_bytes;   /* Bytes written since then. */
+    pthread_mutex_t stats_lock;
+    linenoiseStats stats;
+
+    /* Session recording, see the "Recording" section. */
+    int rec_fd;                 /* Log file descriptor, or -1. */
+    int rec_active;             /* The current line is being recorded. */
+    uint64_t rec_last;          /* Time of the last record. */
+    uint64_t rec_input_time;    /* When the pending input arrived. */
+    size_t rec_input_len;       /* Input not recorded yet. */
+    char rec_input[64];
+
+    struct linenoiseEditor *next; /* List of the editors, see atexit. */
+};
+
+static linenoiseEditor default_editor = {
+    .ifd = STDIN_FILENO,
+    .ofd = STDOUT_FILENO,
+    .wakefd = {-1,-1},
+    .rec_fd = -1,
+    .history_lock = PTHREAD_RWLOCK_INITIALIZER,
+    .stats_lock = PTHREAD_MUTEX_INITIALIZER,
+    .history_max_len = LINENOISE_DEFAULT_HISTORY_MAX_LEN,
+    .history_root = -1,
+    .esctimeout = LINENOISE_DEFAULT_ESC_TIMEOUT
+};
+static linenoiseEditor *editors = &default_editor;
+static pthread_mutex_t editors_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Callbacks of the default editor, registered with the functions not
+ * taking an editor. */
 static linenoiseCompletionCallback *completionCallback = NULL;
 static linenoiseHintsCallback *hintsCallback = NULL;
 static linenoiseFreeHintsCallback *freeHintsCallback = NULL;
 
-static struct termios orig_termios; /* In order to restore at exit.*/
-static int rawmode = 0; /* For atexit() function to check if restore is needed*/
-static int mlmode = 0;  /* Multi line mode. Default is single line. */
-static int atexit_registered = 0; /* Register atexit just 1 time. */
-static int history_max_len = LINENOISE_DEFAULT_HISTORY_MAX_LEN;
-static int history_len = 0;
-static char **history = NULL;
-
 /* The linenoiseState structure represents the state during line editing.
  * We pass this state to functions implementing specific editing
  * functionalities. */
 struct linenoiseState {
+    linenoiseEditor *e; /* Editor this line belongs to. */
     int ifd;            /* Terminal stdin file descriptor. */
     int ofd;            /* Terminal stdout file descriptor. */
-    char *buf;          /* Edited line buffer. */
+    char *buf;          /* Edited line, a gap buffer (see lineTail()). */
     size_t buflen;      /* Edited line buffer size. */
     const char *prompt; /* Prompt to display. */
     size_t plen;        /* Prompt length. */
+    size_t pcols;       /* Prompt width in columns. */
     size_t pos;         /* Current cursor position. */
-    size_t oldpos;      /* Previous refresh cursor position. */
     size_t len;         /* Current edited line length. */
     size_t cols;        /* Number of columns in terminal. */
-    size_t maxrows;     /* Maximum num of rows used so far (multiline mode) */
-    int history_index;  /* The history index we are currently editing. */
+    size_t *lines;      /* Start of every line but the first (lineStart()). */
+    size_t lbefore;     /* Lines starting before the cursor. */
+    size_t lafter;      /* Lines starting after the cursor. */
+    size_t lcap;        /* Entries allocated in lines. */
+    size_t topline;     /* Line at the top of the view (multiline mode). */
+    int toprow;         /* Rows of topline above the view. */
+    int oldrows;        /* Rows drawn by the last refresh (multiline mode). */
+    int oldcrow;        /* Cursor row among them. */
+    size_t hllo;        /* First byte changed since the line was highlighted. */
+    size_t hlsuffix;    /* Bytes left unchanged at the end since then. */
+    size_t hllen;       /* Length of the line when it was highlighted. */
+    size_t hlspan;      /* Span of the next byte rendered. */
+    int hlattr;         /* Attributes of the last byte rendered. */
+    unsigned long history_seq; /* History entry shown, 0 for the typed line. */
+    int suggested;      /* A history suggestion is currently displayed. */
+    int promptshown;    /* The row of the prompt is as refreshed last. */
+    size_t hoff;        /* First byte shown, SIZE_MAX when to be computed
+                           again (single line mode). */
 };
 
 enum KEY_ACTION{
@@ -158,8 +317,10 @@ enum KEY_ACTION{
 	CTRL_D = 4,         /* Ctrl-d */
 	CTRL_E = 5,         /* Ctrl-e */
 	CTRL_F = 6,         /* Ctrl-f */
+	CTRL_G = 7,         /* Ctrl-g */
 	CTRL_H = 8,         /* Ctrl-h */
 	TAB = 9,            /* Tab */
+	CTRL_J = 10,        /* Ctrl+j */
 	CTRL_K = 11,        /* Ctrl+k */
 	CTRL_L = 12,        /* Ctrl+l */
 	ENTER = 13,         /* Enter */
@@ -168,13 +329,22 @@ enum KEY_ACTION{
 	CTRL_T = 20,        /* Ctrl-t */
 	CTRL_U = 21,        /* Ctrl+u */
 	CTRL_W = 23,        /* Ctrl+w */
+	CTRL_Y = 25,        /* Ctrl+y */
 	ESC = 27,           /* Escape */
 	BACKSPACE =  127    /* Backspace */
 };
 
 static void linenoiseAtExit(void);
-int linenoiseHistoryAdd(const char *line);
 static void refreshLine(struct linenoiseState *l);
+static void abAppend(struct abuf *ab, const char *s, int len);
+static char *historySuggestDup(linenoiseEditor *e, const char *prefix, size_t len);
+static const char *historySuggest(linenoiseEditor *e, const char *prefix,
+                                  size_t len);
+static int historySlot(linenoiseEditor *e, int j);
+static char *historyLine(linenoiseEditor *e, int j);
+static char *historyLineBySeq(linenoiseEditor *e, unsigned long seq);
+static void historyIndexInsert(linenoiseEditor *e, int j);
+static void historyIndexRemove(linenoiseEditor *e, int j);
 
 /* Debugging macro. */
 #if 0
@@ -184,9 +354,9 @@ FILE *lndebug_fp = NULL;
         if (lndebug_fp == NULL) { \
             lndebug_fp = fopen("/tmp/lndebug.txt","a"); \
             fprintf(lndebug_fp, \
-            "[%d %d %d] p: %d, rows: %d, rpos: %d, max: %d, oldmax: %d\n", \
-            (int)l->len,(int)l->pos,(int)l->oldpos,plen,rows,rpos, \
-            (int)l->maxrows,old_rows); \
+            "[%d %d] top: %d/%d, rows: %d, crow: %d\n", \
+            (int)l->len,(int)l->pos,(int)l->topline,l->toprow, \
+            l->oldrows,l->oldcrow); \
         } \
         fprintf(lndebug_fp, ", " __VA_ARGS__); \
         fflush(lndebug_fp); \
@@ -195,11 +365,311 @@ FILE *lndebug_fp = NULL;
 #define lndebug(fmt, ...)
 #endif
 
+/* ================================ Stats =================================== */
+
+/* Monotonic time in nanoseconds. Only called when stats are enabled, so
+ * that disabled stats cost a single test. */
+static uint64_t statsNow(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+static int statsEnabled(linenoiseEditor *e) {
+    return __atomic_load_n(&e->stats_enabled,__ATOMIC_RELAXED);
+}
+
+/* Return the time to pass to statsRecordTime() later, or 0 when stats
+ * are disabled. */
+static uint64_t statsStart(linenoiseEditor *e) {
+    return statsEnabled(e) ? statsNow() : 0;
+}
+
+/* Values are counted in power of two buckets: bucket 'b' holds the values
+ * in [2^b, 2^(b+1)), the first one holds 0 as well. */
+static void histogramAdd(linenoiseHistogram *h, uint64_t value) {
+    int b = value ? 63-__builtin_clzll(value) : 0;
+
+    if (b >= LINENOISE_HISTOGRAM_BUCKETS) b = LINENOISE_HISTOGRAM_BUCKETS-1;
+    h->count++;
+    h->sum += value;
+    if (value > h->max) h->max = value;
+    h->buckets[b]++;
+}
+
+static void statsRecord(linenoiseEditor *e, linenoiseHistogram *h,
+                        uint64_t value)
+{
+    if (!statsEnabled(e)) return;
+    pthread_mutex_lock(&e->stats_lock);
+    histogramAdd(h,value);
+    pthread_mutex_unlock(&e->stats_lock);
+}
+
+/* Record the time elapsed since 'start', returned by statsStart(). */
+static void statsRecordTime(linenoiseEditor *e, linenoiseHistogram *h,
+                            uint64_t start)
+{
+    if (start) statsRecord(e,h,statsNow()-start);
+}
+
+static void statsAdd(linenoiseEditor *e, unsigned long long *counter,
+                     unsigned long long n)
+{
+    if (!statsEnabled(e)) return;
+    pthread_mutex_lock(&e->stats_lock);
+    *counter += n;
+    pthread_mutex_unlock(&e->stats_lock);
+}
+
+/* Key latency is the time from reading a key to waiting for the next one,
+ * so it covers handling the key and rendering the line. Bytes that were
+ * already available when the editor would wait, like the rest of an escape
+ * sequence or of a paste, belong to the same key. */
+static void statsKeyRead(linenoiseEditor *e) {
+    if (e->stats_editing && !e->stats_key_start && statsEnabled(e))
+        e->stats_key_start = statsNow();
+}
+
+static void statsKeyDone(linenoiseEditor *e) {
+    if (e->stats_key_start) {
+        statsRecordTime(e,&e->stats.key_latency,e->stats_key_start);
+        statsRecord(e,&e->stats.key_bytes,e->stats_key_bytes);
+        e->stats_key_start = 0;
+        e->stats_key_bytes = 0;
+    }
+}
+
+/* Enable or disable the stats of the editor. They are kept when disabled,
+ * see linenoiseEditorResetStats(). */
+void linenoiseEditorSetStats(linenoiseEditor *e, int enable) {
+    __atomic_store_n(&e->stats_enabled,enable,__ATOMIC_RELAXED);
+}
+
+int linenoiseEditorStatsEnabled(linenoiseEditor *e) {
+    return statsEnabled(e);
+}
+
+/* Copy the stats of the editor to 'stats'. May be called from any thread. */
+void linenoiseEditorGetStats(linenoiseEditor *e, linenoiseStats *stats) {
+    pthread_mutex_lock(&e->stats_lock);
+    *stats = e->stats;
+    pthread_mutex_unlock(&e->stats_lock);
+}
+
+void linenoiseEditorResetStats(linenoiseEditor *e) {
+    pthread_mutex_lock(&e->stats_lock);
+    memset(&e->stats,0,sizeof(e->stats));
+    pthread_mutex_unlock(&e->stats_lock);
+}
+
+/* Return an estimate of the 'p' percentile (0 to 1) of the values of the
+ * histogram: the upper bound of the bucket it falls in, capped to the max
+ * value. Returns 0 for an empty histogram. */
+unsigned long long linenoiseHistogramPercentile(const linenoiseHistogram *h,
+                                                double p)
+{
+    unsigned long long rank, seen = 0;
+    int b;
+
+    if (h->count == 0) return 0;
+    rank = (unsigned long long)(p*h->count);
+    if (rank < p*h->count) rank++;
+    if (rank == 0) rank = 1;
+    for (b = 0; b < LINENOISE_HISTOGRAM_BUCKETS-1; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) break;
+    }
+    if (b == LINENOISE_HISTOGRAM_BUCKETS-1) return h->max;
+    return ((2ULL<<b)-1) < h->max ? (2ULL<<b)-1 : h->max;
+}
+
+/* ============================== Recording ================================= */
+
+/* An editor may record the bytes it reads and writes while a line is
+ * edited, so that the session can be replayed later to reproduce a bug or
+ * to profile the editor away from the terminal. The log starts with
+ * LINENOISE_RECORD_MAGIC, followed by records of the form:
+ *
+ *   type (1 byte) | time (varint) | length (varint) | payload
+ *
+ * where the time is in microseconds since the previous record and varints
+ * are unsigned LEB128. The record types are:
+ *
+ *   'S' A line starts. The payload is the width of the terminal (varint),
+ *       the modes (varint: 1 multi line, 2 completion menu, 4 autosuggest)
+ *       and the prompt.
+ *   'I' Input, as many bytes as were read without waiting for more.
+ *   'O' Output, one record per write.
+ *   'E' The line ends. The payload is 0 followed by the line returned, or
+ *       1 when no line was returned (end of file, ctrl-c, errors).
+ *
+ * Recording again to the same file appends a new magic, which readers must
+ * skip. Nothing is recorded while finding the width of the terminal, or
+ * when the input isn't a terminal. */
+
+static size_t recordVarint(unsigned char *p, uint64_t v) {
+    size_t len = 0;
+
+    do {
+        p[len++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+        v >>= 7;
+    } while (v);
+    return len;
+}
+
+static int writeAll(int fd, const char *p, size_t len) {
+    while (len) {
+        ssize_t nwritten = write(fd,p,len);
+
+        if (nwritten == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += nwritten;
+        len -= nwritten;
+    }
+    return 0;
+}
+
+/* Write a record happened at 'when', its payload being 'prefix' (at most
+ * 16 bytes) followed by 'payload'. Recording stops on write errors. */
+static void recordWrite(linenoiseEditor *e, char type, uint64_t when,
+                        const void *prefix, size_t prefixlen,
+                        const void *payload, size_t len)
+{
+    unsigned char hdr[40];
+    size_t hdrlen = 0;
+    int saved_errno = errno;
+
+    hdr[hdrlen++] = type;
+    hdrlen += recordVarint(hdr+hdrlen,
+                           when > e->rec_last ? (when-e->rec_last)/1000 : 0);
+    hdrlen += recordVarint(hdr+hdrlen,prefixlen+len);
+    if (prefixlen) memcpy(hdr+hdrlen,prefix,prefixlen);
+    hdrlen += prefixlen;
+    if (when > e->rec_last) e->rec_last = when;
+
+    if (writeAll(e->rec_fd,(char*)hdr,hdrlen) == -1 ||
+        writeAll(e->rec_fd,payload,len) == -1)
+    {
+        e->rec_fd = -1;
+        e->rec_active = 0;
+    }
+    errno = saved_errno;
+}
+
+static void recordFlushInput(linenoiseEditor *e) {
+    if (e->rec_input_len == 0) return;
+    if (e->rec_active)
+        recordWrite(e,'I',e->rec_input_time,NULL,0,e->rec_input,
+                    e->rec_input_len);
+    e->rec_input_len = 0;
+}
+
+static void recordInput(linenoiseEditor *e, char c) {
+    if (!e->rec_active) return;
+    if (e->rec_input_len == sizeof(e->rec_input)) recordFlushInput(e);
+    if (e->rec_input_len == 0) e->rec_input_time = statsNow();
+    e->rec_input[e->rec_input_len++] = c;
+}
+
+static void recordOutput(linenoiseEditor *e, const void *buf, size_t len) {
+    if (!e->rec_active) return;
+    recordFlushInput(e);
+    recordWrite(e,'O',statsNow(),NULL,0,buf,len);
+}
+
+static void recordStart(linenoiseEditor *e, int cols, const char *prompt) {
+    unsigned char prefix[16];
+    size_t prefixlen;
+    int modes = (e->mlmode ? 1 : 0) | (e->menumode ? 2 : 0) |
+                (e->autosuggest ? 4 : 0);
+
+    if (e->rec_fd == -1) return;
+    e->rec_active = 1;
+    e->rec_input_len = 0;
+    prefixlen = recordVarint(prefix,cols);
+    prefixlen += recordVarint(prefix+prefixlen,modes);
+    recordWrite(e,'S',statsNow(),prefix,prefixlen,prompt,strlen(prompt));
+}
+
+/* 'line' is NULL when no line was returned. */
+static void recordEnd(linenoiseEditor *e, const char *line, size_t len) {
+    unsigned char status = line == NULL;
+
+    if (!e->rec_active) return;
+    recordFlushInput(e);
+    recordWrite(e,'E',statsNow(),&status,1,line,line ? len : 0);
+    e->rec_active = 0;
+}
+
+/* Record the lines edited from now on to 'fd', or stop recording when 'fd'
+ * is -1. The file descriptor is never closed by the editor. Must not be
+ * called while a line is edited. Returns -1 if the log can't be written. */
+int linenoiseEditorRecord(linenoiseEditor *e, int fd) {
+    e->rec_fd = -1;
+    e->rec_active = 0;
+    e->rec_last = 0;
+    if (fd == -1) return 0;
+    if (writeAll(fd,LINENOISE_RECORD_MAGIC,
+                 sizeof(LINENOISE_RECORD_MAGIC)-1) == -1) return -1;
+    e->rec_fd = fd;
+    e->rec_last = statsNow();
+    return 0;
+}
+
+/* Write to the output of the editor, counting and recording the bytes. */
+static ssize_t writeRaw(linenoiseEditor *e, const void *buf, size_t len) {
+    ssize_t nwritten = e->writeCallback ? e->writeCallback(e,buf,len) :
+                                          write(e->ofd,buf,len);
+
+    if (statsEnabled(e)) {
+        pthread_mutex_lock(&e->stats_lock);
+        e->stats.writes++;
+        if (nwritten > 0) e->stats.bytes_written += nwritten;
+        pthread_mutex_unlock(&e->stats_lock);
+    }
+    if (nwritten > 0 && e->stats_key_start) e->stats_key_bytes += nwritten;
+    if (nwritten > 0) recordOutput(e,buf,nwritten);
+    return nwritten;
+}
+
 /* ======================= Low level terminal handling ====================== */
 
 /* Set if to use or not the multi line mode. */
-void linenoiseSetMultiLine(int ml) {
-    mlmode = ml;
+void linenoiseEditorSetMultiLine(linenoiseEditor *e, int ml) {
+    e->mlmode = ml;
+}
+
+/* Set if to show the candidates of completion in a menu instead of cycling
+ * through them. */
+void linenoiseEditorSetCompletionMenu(linenoiseEditor *e, int enable) {
+    e->menumode = enable;
+}
+
+/* Set if to show the most recent history entry starting with the current
+ * buffer as a hint. */
+void linenoiseEditorSetAutoSuggest(linenoiseEditor *e, int enable) {
+    e->autosuggest = enable;
+}
+
+/* Set if to highlight the line with the built-in lexer, see the
+ * "Highlighting" section. */
+void linenoiseEditorSetHighlight(linenoiseEditor *e, int enable) {
+    e->highlight = enable;
+}
+
+/* Use 'cols' as the width of the terminal instead of asking it, or ask it
+ * again when 'cols' is 0. Useful when the output is not a terminal. */
+void linenoiseEditorSetColumns(linenoiseEditor *e, int cols) {
+    e->cols = cols > 0 ? cols : 0;
+}
+
+/* Same as linenoiseEditorSetColumns() for the height of the terminal. */
+void linenoiseEditorSetRows(linenoiseEditor *e, int rows) {
+    e->rows = rows > 0 ? rows : 0;
 }
 
 /* Return true if the terminal name is in the list of terminals we know are
@@ -214,18 +684,15 @@ static int isUnsupportedTerm(void) {
     return 0;
 }
 
+static void registerAtExit(void) {
+    atexit(linenoiseAtExit);
+}
+
 /* Raw mode: 1960 magic shit. */
-static int enableRawMode(int fd) {
+static void rawTermios(linenoiseEditor *e, struct termios *t) {
     struct termios raw;
 
-    if (!isatty(STDIN_FILENO)) goto fatal;
-    if (!atexit_registered) {
-        atexit(linenoiseAtExit);
-        atexit_registered = 1;
-    }
-    if (tcgetattr(fd,&orig_termios) == -1) goto fatal;
-
-    raw = orig_termios;  /* modify the original mode */
+    raw = e->orig_termios;  /* modify the original mode */
     /* input modes: no break, no CR to NL, no parity check, no strip char,
      * no start/stop output control. */
     raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
@@ -239,10 +706,38 @@ static int enableRawMode(int fd) {
     /* control chars - set return condition: min number of bytes and timer.
      * We want read to return every single byte, without timeout. */
     raw.c_cc[VMIN] = 1; raw.c_cc[VTIME] = 0; /* 1 byte, no timer */
+    *t = raw;
+}
+
+/* Mode of the terminal between the lines of a session: the input stays
+ * raw, so that the keys typed ahead are kept as they are for the next
+ * line, but the output is processed and the signal keys work as usual.
+ * The program can print, or be interrupted, without a switch of mode. */
+static void sessionTermios(linenoiseEditor *e, struct termios *t) {
+    rawTermios(e,t);
+    t->c_oflag |= e->orig_termios.c_oflag & OPOST;
+    t->c_lflag |= e->orig_termios.c_lflag & ISIG;
+}
+
+static int enableRawMode(linenoiseEditor *e) {
+    struct termios raw;
+    int fd = e->ifd;
+
+    pthread_once(&atexit_once,registerAtExit);
+    /* A socket from a client that already sends every key press as it is
+     * typed (a telnet client in character mode, for instance) has no mode
+     * to switch. */
+    if (e->rawinput && !isatty(fd)) return 0;
+    if (!isatty(fd)) goto fatal;
+    /* A session saved the original mode already. Its input is raw, so
+     * nothing typed ahead needs to be thrown away. */
+    if (!e->sessiontty && tcgetattr(fd,&e->orig_termios) == -1) goto fatal;
+    rawTermios(e,&raw);
 
     /* put terminal in raw mode after flushing */
-    if (tcsetattr(fd,TCSAFLUSH,&raw) < 0) goto fatal;
-    rawmode = 1;
+    if (tcsetattr(fd,e->sessiontty ? TCSADRAIN : TCSAFLUSH,&raw) < 0)
+        goto fatal;
+    e->rawmode = 1;
     return 0;
 
 fatal:
@@ -250,26 +745,244 @@ fatal:
     return -1;
 }
 
-static void disableRawMode(int fd) {
+static void disableRawMode(linenoiseEditor *e) {
+    struct termios t = e->orig_termios;
+    int when = TCSAFLUSH;
+
+    if (!e->rawmode) return;
+    if (e->sessiontty) {
+        sessionTermios(e,&t);
+        when = TCSADRAIN;
+    }
     /* Don't even check the return value as it's too late. */
-    if (rawmode && tcsetattr(fd,TCSAFLUSH,&orig_termios) != -1)
-        rawmode = 0;
+    if (tcsetattr(e->ifd,when,&t) != -1)
+        e->rawmode = 0;
+}
+
+/* Keep the terminal in raw mode until linenoiseEditorEndSession(), instead
+ * of switching it for every line: the keys typed or pasted ahead of the
+ * next prompt are kept for it. Between the lines the output and the signal
+ * keys work as usual, see sessionTermios(). The modes are switched with
+ * TCSADRAIN, that never discards input. Sessions may be nested. Returns -1
+ * if the mode of the terminal can't be set. */
+int linenoiseEditorBeginSession(linenoiseEditor *e) {
+    struct termios t;
+
+    if (e->session++) return 0;
+    pthread_once(&atexit_once,registerAtExit);
+    /* Pipes and raw input sockets have no mode, and unsupported terminals
+     * are read as plain text. */
+    if (!isatty(e->ifd) || (e->ifd == STDIN_FILENO && isUnsupportedTerm()))
+        return 0;
+    if (tcgetattr(e->ifd,&e->orig_termios) == -1) goto fatal;
+    sessionTermios(e,&t);
+    if (tcsetattr(e->ifd,TCSADRAIN,&t) == -1) goto fatal;
+    e->sessiontty = 1;
+    return 0;
+
+fatal:
+    e->session--;
+    return -1;
+}
+
+/* End the session started by the matching linenoiseEditorBeginSession(),
+ * restoring the mode of the terminal if it's the outermost one. */
+void linenoiseEditorEndSession(linenoiseEditor *e) {
+    if (e->session == 0 || --e->session) return;
+    if (e->sessiontty) tcsetattr(e->ifd,TCSADRAIN,&e->orig_termios);
+    e->sessiontty = 0;
+}
+
+/* Read input that is not a terminal in chunks until
+ * linenoiseEditorEndReadAhead(), rather than a byte at a time: for a
+ * caller that reads many lines in a row, and nothing else from the input.
+ * Calls may be nested. */
+void linenoiseEditorBeginReadAhead(linenoiseEditor *e) {
+    e->readahead++;
+}
+
+/* Stop reading ahead. The input read past the last line is handed back to
+ * the file it comes from when it can be seeked, and kept for the next lines
+ * of the editor otherwise (pipes, sockets). */
+void linenoiseEditorEndReadAhead(linenoiseEditor *e) {
+    off_t left = e->inlen-e->inpos;
+
+    if (e->readahead == 0 || --e->readahead) return;
+    if (left && lseek(e->ifd,-left,SEEK_CUR) != -1) e->inpos = e->inlen = 0;
+}
+
+/* Return true if linenoiseEditorCancel() was called. */
+static int isCancelled(linenoiseEditor *e) {
+    return __atomic_load_n(&e->cancelled,__ATOMIC_SEQ_CST);
+}
+
+/* Wait for a non blocking output to accept more bytes. Returns -1 with
+ * errno set to ECANCELED if the editor is cancelled meanwhile. */
+static int writeWait(linenoiseEditor *e) {
+    while(1) {
+        struct pollfd fds[2];
+        int nfds = 1;
+
+        if (isCancelled(e)) {
+            errno = ECANCELED;
+            return -1;
+        }
+        fds[0].fd = e->ofd;
+        fds[0].events = POLLOUT;
+        if (e->wakefd[0] != -1) {
+            fds[1].fd = e->wakefd[0];
+            fds[1].events = POLLIN;
+            fds[1].revents = 0;
+            nfds = 2;
+        }
+        if (poll(fds,nfds,-1) == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (nfds == 2 && fds[1].revents) {
+            char drain[16];
+            while (read(e->wakefd[0],drain,sizeof(drain)) > 0);
+            continue;
+        }
+        return 0;
+    }
+}
+
+/* Write the output collected by writeOut(), going on after short writes
+ * and interrupted ones, and waiting for a non blocking descriptor to accept
+ * more. What is left is dropped on error. Returns -1 with errno set on
+ * error, otherwise 0. */
+static int outFlush(linenoiseEditor *e) {
+    struct abuf *ab = &e->out;
+    int off = 0, ret = 0;
+
+    while (off < ab->len) {
+        ssize_t nwritten = writeRaw(e,ab->b+off,ab->len-off);
+
+        if (nwritten > 0) {
+            off += nwritten;
+            continue;
+        }
+        if (nwritten == -1 && errno == EINTR) continue;
+        if (nwritten == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+            writeWait(e) == 0) continue;
+        if (nwritten == 0) errno = EIO;
+        ret = -1;
+        break;
+    }
+    ab->len = 0;
+    return ret;
+}
+
+/* Write to the output of the editor. While a line is edited the bytes are
+ * only appended to e->out, and written in one go when the editor waits for
+ * input, so that all the output caused by a key (the prompt, the line, the
+ * hints and the escape sequences, a beep) is a single write. Returns 'len',
+ * or -1 on error. */
+static ssize_t writeOut(linenoiseEditor *e, const void *buf, size_t len) {
+    int oldlen = e->out.len;
+
+    abAppend(&e->out,buf,len);
+    if (e->out.len != oldlen+(int)len) return -1;
+    if (!e->buffering && outFlush(e) == -1) return -1;
+    return len;
+}
+
+/* Return true if some input can be read without waiting. */
+static int inputPending(linenoiseEditor *e) {
+    struct pollfd fd;
+
+    fd.fd = e->ifd;
+    fd.events = POLLIN;
+    return poll(&fd,1,0) == 1;
+}
+
+/* Called before waiting for input: the bytes read so far make a whole key
+ * for the stats and a whole chunk of input for the recording, and the
+ * output is written. While more input is already there, like when text is
+ * pasted, the output keeps being collected up to LINENOISE_OUTPUT_BATCH
+ * bytes. */
+static void inputWait(linenoiseEditor *e) {
+    if (!e->stats_key_start && !e->rec_input_len && !e->out.len) return;
+    if (inputPending(e)) {
+        if (e->out.len >= LINENOISE_OUTPUT_BATCH) outFlush(e);
+        return;
+    }
+    outFlush(e); /* Can't recover from write error. */
+    statsKeyDone(e);
+    recordFlushInput(e);
+}
+
+/* Read a byte of input, like read(). Every read of the editor goes through
+ * here, so that linenoiseEditorCancel() can stop it from another thread: it
+ * waits on both the input and the wake up pipe. Non blocking descriptors
+ * are waited on as well. Returns -1 with errno set to ECANCELED once the
+ * editor is cancelled, or to ETIMEDOUT if nothing came in 'timeout'
+ * milliseconds. A negative timeout waits forever, and is used for the
+ * first byte of a key. */
+static int readByteTimeout(linenoiseEditor *e, char *c, int timeout) {
+    while(1) {
+        struct pollfd fds[2];
+        int nfds = 1, nread, ready;
+
+        if (isCancelled(e)) {
+            errno = ECANCELED;
+            return -1;
+        }
+        if (timeout < 0) inputWait(e);
+        else if (e->out.len && !inputPending(e)) outFlush(e);
+        fds[0].fd = e->ifd;
+        fds[0].events = POLLIN;
+        if (e->wakefd[0] != -1) {
+            fds[1].fd = e->wakefd[0];
+            fds[1].events = POLLIN;
+            fds[1].revents = 0;
+            nfds = 2;
+        }
+        ready = poll(fds,nfds,timeout);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (ready == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (nfds == 2 && fds[1].revents) {
+            char drain[16];
+            while (read(e->wakefd[0],drain,sizeof(drain)) > 0);
+            continue;
+        }
+        nread = read(e->ifd,c,1);
+        statsAdd(e,&e->stats.reads,1);
+        if (nread == -1 && (errno == EINTR || errno == EAGAIN)) continue;
+        if (nread == 1) {
+            statsAdd(e,&e->stats.bytes_read,1);
+            statsKeyRead(e);
+            recordInput(e,*c);
+        }
+        return nread;
+    }
+}
+
+static int readByte(linenoiseEditor *e, char *c) {
+    return readByteTimeout(e,c,-1);
 }
 
 /* Use the ESC [6n escape sequence to query the horizontal cursor position
  * and return it. On error -1 is returned, on success the position of the
  * cursor. */
-static int getCursorPosition(int ifd, int ofd) {
+static int getCursorPosition(linenoiseEditor *e) {
     char buf[32];
     int cols, rows;
     unsigned int i = 0;
 
     /* Report cursor location */
-    if (write(ofd, "\x1b[6n", 4) != 4) return -1;
+    if (writeOut(e,"\x1b[6n",4) != 4) return -1;
 
     /* Read the response: ESC [ rows ; cols R */
     while (i < sizeof(buf)-1) {
-        if (read(ifd,buf+i,1) != 1) break;
+        if (readByte(e,buf+i) != 1) break;
         if (buf[i] == 'R') break;
         i++;
     }
@@ -283,27 +996,29 @@ static int getCursorPosition(int ifd, int ofd) {
 
 /* Try to get the number of columns in the current terminal, or assume 80
  * if it fails. */
-static int getColumns(int ifd, int ofd) {
+static int getColumns(linenoiseEditor *e) {
     struct winsize ws;
+    int ofd = e->ofd;
 
-    if (ioctl(1, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+    if (e->cols) return e->cols;
+    if (ioctl(ofd, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
         /* ioctl() failed. Try to query the terminal itself. */
         int start, cols;
 
         /* Get the initial position so we can restore it later. */
-        start = getCursorPosition(ifd,ofd);
+        start = getCursorPosition(e);
         if (start == -1) goto failed;
 
         /* Go to right margin and get position. */
-        if (write(ofd,"\x1b[999C",6) != 6) goto failed;
-        cols = getCursorPosition(ifd,ofd);
+        if (writeOut(e,"\x1b[999C",6) != 6) goto failed;
+        cols = getCursorPosition(e);
         if (cols == -1) goto failed;
 
         /* Restore position. */
         if (cols > start) {
             char seq[32];
             snprintf(seq,32,"\x1b[%dD",cols-start);
-            if (write(ofd,seq,strlen(seq)) == -1) {
+            if (writeOut(e,seq,strlen(seq)) == -1) {
                 /* Can't recover... */
             }
         }
@@ -316,639 +1031,2617 @@ failed:
     return 80;
 }
 
+/* Try to get the number of rows in the current terminal, or assume 24
+ * if it fails. */
+static int getRows(linenoiseEditor *e) {
+    struct winsize ws;
+
+    if (e->rows) return e->rows;
+    if (ioctl(e->ofd, TIOCGWINSZ, &ws) == -1 || ws.ws_row == 0) return 24;
+    return ws.ws_row;
+}
+
 /* Clear the screen. Used to handle ctrl+l */
-void linenoiseClearScreen(void) {
-    if (write(STDOUT_FILENO,"\x1b[H\x1b[2J",7) <= 0) {
+void linenoiseEditorClearScreen(linenoiseEditor *e) {
+    if (writeOut(e,"\x1b[H\x1b[2J",7) <= 0) {
         /* nothing to do, just to avoid warning. */
     }
 }
 
 /* Beep, used for completion when there is nothing to complete or when all
  * the choices were already shown. */
-static void linenoiseBeep(void) {
-    fprintf(stderr, "\x7");
-    fflush(stderr);
+static void linenoiseBeep(linenoiseEditor *e) {
+    if (writeOut(e,"\x7",1) == -1) {} /* Can't recover from write error. */
 }
 
-/* ============================== Completion ================================ */
-
-/* Free a list of completion option populated by linenoiseAddCompletion(). */
-static void freeCompletions(linenoiseCompletions *lc) {
-    size_t i;
-    for (i = 0; i < lc->len; i++)
-        free(lc->cvec[i]);
-    if (lc->cvec != NULL)
-        free(lc->cvec);
-}
+/* =============================== Key input ================================ */
 
-/* This is an helper function for linenoiseEdit() and is called when the
- * user types the <tab> key in order to complete the string currently in the
- * input.
+/* Keys are read as codes: the byte of a plain key (the first one of a
+ * multi byte character), or one of the KEY_CODE values below for the keys
+ * sending an escape sequence, with the KEY_SHIFT, KEY_ALT and KEY_CTRL
+ * modifiers. Alt+key is sent by terminals as ESC followed by the key.
  *
- * The state of the editing is encapsulated into the pointed linenoiseState
- * structure as described in the structure definition. */
-static int completeLine(struct linenoiseState *ls) {
-    linenoiseCompletions lc = { 0, NULL };
-    int nread, nwritten;
-    char c = 0;
+ * Sequences are decoded by a state machine fed a byte at a time. A CSI
+ * sequence (ESC [ parameters final) or an SS3 one (ESC O final) is always
+ * read to its end, then looked up by its final byte, or by its first
+ * parameter when it ends with '~', the second parameter holding the xterm
+ * modifiers. A sequence not known is dropped instead of being inserted in
+ * the line. An ESC not followed by another byte within e->esctimeout
+ * milliseconds is the Escape key itself. */
+enum KEY_CODE {
+    KEY_UP = 0x100,
+    KEY_DOWN,
+    KEY_RIGHT,
+    KEY_LEFT,
+    KEY_HOME,
+    KEY_END,
+    KEY_INSERT,
+    KEY_DELETE,
+    KEY_PAGE_UP,
+    KEY_PAGE_DOWN,
+    KEY_BACKTAB,    /* Shift+Tab */
+    KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5, KEY_F6,
+    KEY_F7, KEY_F8, KEY_F9, KEY_F10, KEY_F11, KEY_F12,
+    KEY_UNKNOWN     /* A sequence that is not a known key. */
+};
 
-    completionCallback(ls->buf,&lc);
-    if (lc.len == 0) {
-        linenoiseBeep();
-    } else {
-        size_t stop = 0, i = 0;
+#define KEY_SHIFT 0x1000
+#define KEY_ALT 0x2000
+#define KEY_CTRL 0x4000
+
+/* Keys of the sequences ending with '~', by their first parameter. */
+static const short keyTilde[] = {
+    [1] = KEY_HOME, [2] = KEY_INSERT, [3] = KEY_DELETE, [4] = KEY_END,
+    [5] = KEY_PAGE_UP, [6] = KEY_PAGE_DOWN, [7] = KEY_HOME, [8] = KEY_END,
+    [11] = KEY_F1, [12] = KEY_F2, [13] = KEY_F3, [14] = KEY_F4,
+    [15] = KEY_F5, [17] = KEY_F6, [18] = KEY_F7, [19] = KEY_F8,
+    [20] = KEY_F9, [21] = KEY_F10, [23] = KEY_F11, [24] = KEY_F12
+};
 
-        while(!stop) {
-            /* Show completion or original buffer */
-            if (i < lc.len) {
-                struct linenoiseState saved = *ls;
+/* Keys of the other CSI and SS3 sequences, by their final byte. */
+static const short keyFinal['~'-'@'+1] = {
+    ['A'-'@'] = KEY_UP, ['B'-'@'] = KEY_DOWN, ['C'-'@'] = KEY_RIGHT,
+    ['D'-'@'] = KEY_LEFT, ['F'-'@'] = KEY_END, ['H'-'@'] = KEY_HOME,
+    ['P'-'@'] = KEY_F1, ['Q'-'@'] = KEY_F2, ['R'-'@'] = KEY_F3,
+    ['S'-'@'] = KEY_F4, ['Z'-'@'] = KEY_BACKTAB
+};
 
-                ls->len = ls->pos = strlen(lc.cvec[i]);
-                ls->buf = lc.cvec[i];
-                refreshLine(ls);
-                ls->len = saved.len;
-                ls->pos = saved.pos;
-                ls->buf = saved.buf;
-            } else {
-                refreshLine(ls);
-            }
+enum KEY_STATE { KEY_GROUND, KEY_ESCAPE, KEY_CSI, KEY_SS3, KEY_UTF8 };
 
-            nread = read(ls->ifd,&c,1);
-            if (nread <= 0) {
-                freeCompletions(&lc);
-                return -1;
-            }
+#define KEY_MAX_PARAMS 4
 
-            switch(c) {
-                case 9: /* tab */
-                    i = (i+1) % (lc.len+1);
-                    if (i == lc.len) linenoiseBeep();
-                    break;
-                case 27: /* escape */
-                    /* Re-show original buffer */
-                    if (i < lc.len) refreshLine(ls);
-                    stop = 1;
-                    break;
-                default:
-                    /* Update buffer and return */
-                    if (i < lc.len) {
-                        nwritten = snprintf(ls->buf,ls->buflen,"%s",lc.cvec[i]);
-                        ls->len = ls->pos = nwritten;
-                    }
-                    stop = 1;
-                    break;
-            }
-        }
-    }
+struct keyDecoder {
+    int state;
+    int len;                        /* Bytes of the CSI sequence so far,
+                                       or left of a UTF-8 character. */
+    int nparams;
+    int params[KEY_MAX_PARAMS];
+};
 
-    freeCompletions(&lc);
-    return c; /* Return last read character */
+static void keyInit(struct keyDecoder *d) {
+    d->state = KEY_GROUND;
+    d->len = d->nparams = 0;
 }
 
-/* Register a callback function to be called for tab-completion. */
-void linenoiseSetCompletionCallback(linenoiseCompletionCallback *fn) {
-    completionCallback = fn;
+/* Return the key of the CSI sequence ending with 'final'. */
+static int keyCSI(struct keyDecoder *d, int final) {
+    int first = d->nparams ? d->params[0] : 0;
+    int mod = d->nparams > 1 && d->params[1] > 1 ? d->params[1]-1 : 0;
+    int key;
+
+    if (final == '~')
+        key = first < (int)(sizeof(keyTilde)/sizeof(keyTilde[0])) ?
+              keyTilde[first] : 0;
+    else
+        key = keyFinal[final-'@'];
+    if (key == 0) return KEY_UNKNOWN;
+    if (mod & 1) key |= KEY_SHIFT;
+    if (mod & (2|8)) key |= KEY_ALT;  /* Alt or Meta. */
+    if (mod & 4) key |= KEY_CTRL;
+    return key;
 }
 
-/* Register a hits function to be called to show hits to the user at the
- * right of the prompt. */
-void linenoiseSetHintsCallback(linenoiseHintsCallback *fn) {
-    hintsCallback = fn;
+/* Feed the byte 'c' to the decoder. Returns the key it completes, or -1
+ * if more bytes are needed. */
+static int keyFeed(struct keyDecoder *d, int c) {
+    switch(d->state) {
+    case KEY_GROUND:
+        if (c != ESC) return c;
+        d->state = KEY_ESCAPE;
+        return -1;
+    case KEY_ESCAPE:
+        if (c == '[' || c == 'O') {
+            d->state = c == '[' ? KEY_CSI : KEY_SS3;
+            d->len = d->nparams = 0;
+            return -1;
+        }
+        /* Alt with a multi byte character is not a key that can be bound:
+         * the whole character is dropped, not only its first byte. */
+        if (c >= 0xc2 && c <= 0xf4) {
+            d->state = KEY_UTF8;
+            d->len = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1;
+            return -1;
+        }
+        d->state = KEY_GROUND;
+        return KEY_ALT|c;
+    case KEY_CSI:
+        d->len++;
+        if (c == ';' || (c >= '0' && c <= '9')) {
+            if (d->nparams == 0) d->params[d->nparams++] = 0;
+            if (c == ';') {
+                if (d->nparams < KEY_MAX_PARAMS) d->params[d->nparams] = 0;
+                d->nparams++;
+            } else if (d->nparams <= KEY_MAX_PARAMS &&
+                       d->params[d->nparams-1] < 10000) {
+                d->params[d->nparams-1] = d->params[d->nparams-1]*10+c-'0';
+            }
+            return -1;
+        }
+        /* Private parameters and intermediate bytes. */
+        if (c >= 0x20 && c <= 0x3f) return -1;
+        d->state = KEY_GROUND;
+        return c >= '@' && c <= '~' ? keyCSI(d,c) : KEY_UNKNOWN;
+    case KEY_SS3:
+        d->state = KEY_GROUND;
+        return c >= '@' && c <= '~' && keyFinal[c-'@'] ? keyFinal[c-'@'] :
+                                                          KEY_UNKNOWN;
+    case KEY_UTF8:
+        /* A truncated character ends at the first byte that is not a
+         * continuation one, read as a new key. */
+        if ((c & 0xc0) != 0x80) {
+            d->state = KEY_GROUND;
+            return keyFeed(d,c);
+        }
+        if (--d->len) return -1;
+        d->state = KEY_GROUND;
+        return KEY_UNKNOWN;
+    }
+    return KEY_UNKNOWN;
 }
 
-/* Register a function to free the hints returned by the hints callback
- * registered with linenoiseSetHintsCallback(). */
-void linenoiseSetFreeHintsCallback(linenoiseFreeHintsCallback *fn) {
-    freeHintsCallback = fn;
+/* Return the key read when the rest of a sequence didn't come in time. */
+static int keyTimeout(struct keyDecoder *d) {
+    int state = d->state;
+
+    d->state = KEY_GROUND;
+    if (state == KEY_ESCAPE) return ESC;
+    if (state == KEY_SS3) return KEY_ALT|'O';
+    if (state == KEY_CSI && d->len == 0) return KEY_ALT|'[';
+    return KEY_UNKNOWN;
 }
 
-/* This function is used by the callback function registered by the user
- * in order to add completion options given the input string when the
- * user typed <tab>. See the example.c source code for a very easy to
- * understand example. */
-void linenoiseAddCompletion(linenoiseCompletions *lc, const char *str) {
-    size_t len = strlen(str);
-    char *copy, **cvec;
-
-    copy = malloc(len+1);
-    if (copy == NULL) return;
-    memcpy(copy,str,len+1);
-    cvec = realloc(lc->cvec,sizeof(char*)*(lc->len+1));
-    if (cvec == NULL) {
-        free(copy);
-        return;
+/* Read a key into 'key'. Returns like readByte(). */
+static int readKey(linenoiseEditor *e, int *key) {
+    struct keyDecoder d;
+
+    keyInit(&d);
+    while(1) {
+        char c;
+        int nread = readByteTimeout(e,&c,
+                        d.state == KEY_GROUND ? -1 : e->esctimeout);
+
+        if (d.state != KEY_GROUND &&
+            (nread == 0 || (nread == -1 && errno == ETIMEDOUT)))
+        {
+            *key = keyTimeout(&d);
+            return 1;
+        }
+        if (nread <= 0) return nread;
+        if ((*key = keyFeed(&d,(unsigned char)c)) != -1) return 1;
     }
-    lc->cvec = cvec;
-    lc->cvec[lc->len++] = copy;
 }
 
-/* =========================== Line editing ================================= */
+/* Set how long to wait, in milliseconds, for the rest of an escape
+ * sequence before taking the ESC for the Escape key. */
+void linenoiseEditorSetEscapeTimeout(linenoiseEditor *e, int ms) {
+    e->esctimeout = ms < 0 ? 0 : ms;
+}
 
-/* We define a very simple "append buffer" structure, that is an heap
- * allocated string where we can append to. This is useful in order to
- * write all the escape sequences in a buffer and flush them to the standard
- * output in a single call, to avoid flickering effects. */
-struct abuf {
-    char *b;
-    int len;
-};
+/* ============================= Append buffer ============================== */
 
-static void abInit(struct abuf *ab) {
+/* The escape sequences and the text of a frame are appended to the output
+ * buffer of the editor, see writeOut(), and written with a single call to
+ * avoid flickering effects. The buffer doubles when full and is kept from a
+ * line to the next. */
+static void abAppend(struct abuf *ab, const char *s, int len) {
+    if (ab->len+len > ab->cap) {
+        int cap = ab->cap ? ab->cap : 256;
+        char *new;
+
+        while (cap < ab->len+len) cap *= 2;
+        if ((new = realloc(ab->b,cap)) == NULL) return;
+        ab->b = new;
+        ab->cap = cap;
+    }
+    memcpy(ab->b+ab->len,s,len);
+    ab->len += len;
+}
+
+static void abFree(struct abuf *ab) {
+    free(ab->b);
     ab->b = NULL;
-    ab->len = 0;
+    ab->len = ab->cap = 0;
+}
+
+/* ============================== Gap buffer ================================ */
+
+/* The edited line is kept in a gap buffer: the bytes before the cursor are
+ * at the start of l->buf, the bytes after it at the end, and the free space
+ * in between is the gap. Typing or deleting at the cursor doesn't move the
+ * rest of the line, moving the cursor only moves the bytes it goes over,
+ * and the buffer doubles when full. The two halves are rendered as they
+ * are, and only joined when the line is returned or given to a callback.
+ *
+ * The line may hold newlines, so it is indexed by the offsets where every
+ * line but the first starts, split at the cursor like the text: the lines
+ * starting before or at the cursor are at the start of l->lines, as
+ * offsets, and the others at the end, as distances from the end of the
+ * text, which don't change when typing before them. The cursor is on line
+ * l->lbefore, and any line is found with a binary search. */
+
+/* Return the bytes after the cursor, there are l->len-l->pos of them. */
+static char *lineTail(struct linenoiseState *l) {
+    return l->buf+l->buflen-(l->len-l->pos);
+}
+
+/* Return the width of the line in columns. */
+static size_t lineWidth(struct linenoiseState *l) {
+    return linenoiseUtf8Width(l->buf,l->pos)+
+           linenoiseUtf8Width(lineTail(l),l->len-l->pos);
+}
+
+/* Make room for 'n' more bytes, keeping one free for the null term. On
+ * out of memory -1 is returned. */
+static int lineReserve(struct linenoiseState *l, size_t n) {
+    size_t size = l->buflen, taillen = l->len-l->pos;
+    char *buf;
+
+    if (l->len+n < l->buflen) return 0;
+    while (l->len+n >= size) size *= 2;
+    if ((buf = realloc(l->buf,size)) == NULL) return -1;
+    memmove(buf+size-taillen,buf+l->buflen-taillen,taillen);
+    l->buf = l->e->buf = buf;
+    l->buflen = l->e->buflen = size;
+    return 0;
+}
+
+/* Return the number of lines, one more than the newlines. */
+static size_t lineCount(struct linenoiseState *l) {
+    return 1+l->lbefore+l->lafter;
+}
+
+/* Return the offset where the line 'i' starts. */
+static size_t lineStart(struct linenoiseState *l, size_t i) {
+    if (i == 0) return 0;
+    if (i <= l->lbefore) return l->lines[i-1];
+    return l->len-l->lines[l->lcap-l->lafter+(i-1-l->lbefore)];
+}
+
+/* Return the offset where the line 'i' ends, before its newline. */
+static size_t lineEnd(struct linenoiseState *l, size_t i) {
+    return i+1 < lineCount(l) ? lineStart(l,i+1)-1 : l->len;
+}
+
+/* Make room for 'n' more lines in the index. On out of memory -1 is
+ * returned. */
+static int lineReserveIndex(struct linenoiseState *l, size_t n) {
+    size_t cap = l->lcap ? l->lcap : 16;
+    size_t *lines;
+
+    if (l->lbefore+l->lafter+n <= l->lcap) return 0;
+    while (l->lbefore+l->lafter+n > cap) cap *= 2;
+    if ((lines = realloc(l->lines,sizeof(size_t)*cap)) == NULL) return -1;
+    memmove(lines+cap-l->lafter,lines+l->lcap-l->lafter,
+            sizeof(size_t)*l->lafter);
+    l->lines = l->e->lines = lines;
+    l->lcap = l->e->linescap = cap;
+    return 0;
+}
+
+/* Record that the line changed from the offset 'lo', and that its last
+ * 'suffix' bytes didn't, for highlightUpdate(). */
+static void lineChanged(struct linenoiseState *l, size_t lo, size_t suffix) {
+    if (lo < l->hllo) l->hllo = lo;
+    if (suffix < l->hlsuffix) l->hlsuffix = suffix;
+    /* The first byte shown may no longer start a character. */
+    if (lo < l->hoff) l->hoff = SIZE_MAX;
+}
+
+/* Move the gap, so the cursor, to 'pos'. */
+static void lineMoveGap(struct linenoiseState *l, size_t pos) {
+    char *tail = lineTail(l);
+
+    if (pos < l->pos) {
+        memmove(tail-(l->pos-pos),l->buf+pos,l->pos-pos);
+        while (l->lbefore && l->lines[l->lbefore-1] > pos) {
+            l->lafter++;
+            l->lines[l->lcap-l->lafter] = l->len-l->lines[--l->lbefore];
+        }
+    } else if (pos > l->pos) {
+        memmove(l->buf+l->pos,tail,pos-l->pos);
+        while (l->lafter && l->len-l->lines[l->lcap-l->lafter] <= pos) {
+            l->lines[l->lbefore++] = l->len-l->lines[l->lcap-l->lafter];
+            l->lafter--;
+        }
+    }
+    l->pos = pos;
+}
+
+/* Insert 'n' bytes at the cursor. On out of memory -1 is returned. */
+static int lineInsert(struct linenoiseState *l, const char *s, size_t n) {
+    const char *p = s, *end = s+n;
+    size_t newlines = 0;
+
+    while ((p = memchr(p,'\n',end-p)) != NULL) {
+        newlines++;
+        p++;
+    }
+    if (lineReserve(l,n) == -1) return -1;
+    if (newlines && lineReserveIndex(l,newlines) == -1) return -1;
+    lineChanged(l,l->pos,l->len-l->pos);
+    memcpy(l->buf+l->pos,s,n);
+    for (p = s; (p = memchr(p,'\n',end-p)) != NULL; p++)
+        l->lines[l->lbefore++] = l->pos+(p-s)+1;
+    l->pos += n;
+    l->len += n;
+    return 0;
+}
+
+/* Delete the 'n' bytes before the cursor. */
+static void lineDeleteBefore(struct linenoiseState *l, size_t n) {
+    lineChanged(l,l->pos-n,l->len-l->pos);
+    l->pos -= n;
+    l->len -= n;
+    while (l->lbefore && l->lines[l->lbefore-1] > l->pos) l->lbefore--;
+}
+
+/* Delete the 'n' bytes after the cursor. */
+static void lineDeleteAfter(struct linenoiseState *l, size_t n) {
+    lineChanged(l,l->pos,l->len-l->pos-n);
+    while (l->lafter && l->len-l->lines[l->lcap-l->lafter] <= l->pos+n)
+        l->lafter--;
+    l->len -= n;
+}
+
+/* Replace the line with the 'len' bytes of 's', the cursor at the end. */
+static int lineSet(struct linenoiseState *l, const char *s, size_t len) {
+    l->pos = l->len = 0;
+    l->lbefore = l->lafter = 0;
+    lineChanged(l,0,0);
+    return lineInsert(l,s,len);
+}
+
+/* Return the line as a null terminated string for the callbacks, valid
+ * until the line is changed. With the cursor at the end the line is
+ * already in one piece, otherwise it is copied into a buffer kept by the
+ * editor. */
+static const char *lineString(struct linenoiseState *l) {
+    linenoiseEditor *e = l->e;
+    size_t taillen = l->len-l->pos;
+
+    if (taillen == 0) {
+        l->buf[l->len] = '\0';
+        return l->buf;
+    }
+    if (e->flatlen < l->len+1) {
+        char *flat = realloc(e->flat,l->len+1);
+
+        if (flat == NULL) {
+            /* Out of memory, settle for the text before the cursor. */
+            l->buf[l->pos] = '\0';
+            return l->buf;
+        }
+        e->flat = flat;
+        e->flatlen = l->len+1;
+    }
+    memcpy(e->flat,l->buf,l->pos);
+    memcpy(e->flat+l->pos,lineTail(l),taillen);
+    e->flat[l->len] = '\0';
+    return e->flat;
+}
+
+/* Join the two halves of the line in place, when it is returned. */
+static int lineFinish(struct linenoiseState *l) {
+    lineMoveGap(l,l->len);
+    l->buf[l->len] = '\0';
+    return (int)l->len;
+}
+
+/* ============================= Highlighting =============================== */
+
+/* The edited line is highlighted by a callback, or by a small built-in
+ * lexer. Both produce spans of text with a color, sorted by offset, kept
+ * in e->highlights from a refresh to the next one. Every edit in between
+ * records the first byte changed (l->hllo) and how many bytes at the end
+ * of the line were left alone (l->hlsuffix), and only the text between
+ * them is highlighted again: the lexer starts from the token before it
+ * and stops as soon as one of its tokens is found again unchanged, the
+ * callback is given the lines of that region. The spans after it are just
+ * moved by the difference in length. */
+
+/* Colors of the token classes of the built-in lexer. */
+#define LINENOISE_HL_KEYWORD 34
+#define LINENOISE_HL_NUMBER 35
+#define LINENOISE_HL_STRING 32
+#define LINENOISE_HL_COMMENT 90
+
+/* Keywords of the built-in lexer, sorted. They are matched regardless of
+ * case, and shown in bold. */
+static const char *highlightKeywords[] = {
+    "alias","all","and","as","asc","begin","between","by","case","class",
+    "create","def","delete","desc","distinct","do","drop","else","elsif",
+    "end","ensure","false","from","group","having","if","in","inner",
+    "insert","into","is","join","left","like","limit","module","nil","not",
+    "null","offset","on","or","order","outer","rescue","return","right",
+    "select","self","set","table","then","true","union","unless","until",
+    "update","values","when","where","while","with","yield"
+};
+
+static int highlightEnabled(linenoiseEditor *e) {
+    return e->highlight || e->highlightCallback != NULL;
+}
+
+/* Make room for 'n' more spans. On out of memory -1 is returned. */
+static int highlightsReserve(linenoiseHighlights *h, size_t n) {
+    size_t cap = h->cap ? h->cap : 16;
+    linenoiseHighlight *spans;
+
+    if (h->len+n <= h->cap) return 0;
+    while (h->len+n > cap) cap *= 2;
+    if ((spans = realloc(h->spans,sizeof(*spans)*cap)) == NULL) return -1;
+    h->spans = spans;
+    h->cap = cap;
+    return 0;
+}
+
+static void freeHighlights(linenoiseHighlights *h) {
+    free(h->spans);
+    h->spans = NULL;
+    h->len = h->cap = 0;
+}
+
+/* Return the index of the first span starting at or after 'off'. */
+static size_t highlightFind(linenoiseHighlights *h, size_t off) {
+    size_t lo = 0, hi = h->len;
+
+    while (lo < hi) {
+        size_t mid = lo+(hi-lo)/2;
+
+        if (h->spans[mid].start < off) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Replace the spans from 'a' to 'b' excluded with the ones of 'n', and
+ * move the spans after them by 'shift' bytes. The shift is added modulo
+ * SIZE_MAX+1, so it moves them back when the line got shorter. */
+static void highlightSplice(linenoiseHighlights *h, size_t a, size_t b,
+                            linenoiseHighlights *n, size_t shift)
+{
+    size_t i, tail = h->len-b;
+
+    if (n->len > b-a && highlightsReserve(h,n->len-(b-a)) == -1) {
+        /* Out of memory, the rest of the line is shown as it is. */
+        h->len = a;
+        return;
+    }
+    memmove(h->spans+a+n->len,h->spans+b,sizeof(*h->spans)*tail);
+    memcpy(h->spans+a,n->spans,sizeof(*n->spans)*n->len);
+    h->len = a+n->len+tail;
+    for (i = a+n->len; i < h->len; i++) h->spans[i].start += shift;
+}
+
+/* Return the byte at the offset 'i' of the line. */
+static int lineByte(struct linenoiseState *l, size_t i) {
+    return (unsigned char)(i < l->pos ? l->buf[i] : lineTail(l)[i-l->pos]);
+}
+
+/* Return the line holding the byte at the offset 'off'. */
+static size_t lineAt(struct linenoiseState *l, size_t off) {
+    size_t lo = 0, hi = lineCount(l);
+
+    while (hi-lo > 1) {
+        size_t mid = lo+(hi-lo)/2;
+
+        if (lineStart(l,mid) <= off) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int isWordByte(int c) {
+    return isalnum(c) || c == '_' || c >= 0x80;
+}
+
+static int highlightKeywordCompare(const void *key, const void *elem) {
+    return strcmp(key,*(const char **)elem);
+}
+
+/* Lex the first token at or after the offset 'i' into 't', and return its
+ * end. Words, numbers, strings and comments are tokens, other bytes are
+ * skipped, and t->len is zero when there are no more tokens. A token only
+ * depends on the bytes from its start, and every word is a token even if
+ * it is not highlighted, so the lexer can start again from any token. */
+static size_t highlightToken(struct linenoiseState *l, size_t i,
+                             linenoiseHighlight *t)
+{
+    size_t len = l->len;
+    int c = 0;
+
+    while (i < len) {
+        c = lineByte(l,i);
+        if (isWordByte(c) || c == '"' || c == '\'' || c == '#' ||
+            (c == '-' && i+1 < len && lineByte(l,i+1) == '-')) break;
+        i++;
+    }
+    t->start = i;
+    t->len = 0;
+    t->color = -1;
+    t->bold = 0;
+    if (i == len) return i;
+
+    i++;
+    if (c == '"' || c == '\'') {
+        /* Strings end with the line when not closed. */
+        int quote = c;
+
+        while (i < len && (c = lineByte(l,i)) != '\n') {
+            i++;
+            if (c == '\\' && i < len && lineByte(l,i) != '\n') i++;
+            else if (c == quote) break;
+        }
+        t->color = LINENOISE_HL_STRING;
+    } else if (c == '#' || c == '-') {
+        while (i < len && lineByte(l,i) != '\n') i++;
+        t->color = LINENOISE_HL_COMMENT;
+    } else if (isdigit(c)) {
+        while (i < len && (isWordByte(c = lineByte(l,i)) ||
+               (c == '.' && i+1 < len && isdigit(lineByte(l,i+1))))) i++;
+        t->color = LINENOISE_HL_NUMBER;
+    } else {
+        char word[16];
+        size_t n = 0;
+
+        word[n++] = tolower(c);
+        while (i < len && isWordByte(c = lineByte(l,i))) {
+            if (n < sizeof(word)-1) word[n++] = tolower(c);
+            i++;
+        }
+        word[n] = '\0';
+        if (i-t->start < sizeof(word)-1 &&
+            bsearch(word,highlightKeywords,
+                    sizeof(highlightKeywords)/sizeof(highlightKeywords[0]),
+                    sizeof(highlightKeywords[0]),
+                    highlightKeywordCompare))
+        {
+            t->color = LINENOISE_HL_KEYWORD;
+            t->bold = 1;
+        }
+    }
+    t->len = i-t->start;
+    return i;
+}
+
+/* Lex the region changed with the built-in lexer. */
+static void highlightLex(struct linenoiseState *l) {
+    linenoiseHighlights *h = &l->e->highlights, *n = &l->e->hlspans;
+    size_t keep = l->len-l->hlsuffix; /* Start of the unchanged end. */
+    size_t a, b, from;
+
+    /* Start from the token before the change, which may end differently
+     * now since it was ended by the two bytes after it, or from the end of
+     * the previous one. */
+    a = highlightFind(h,l->hllo);
+    if (a && h->spans[a-1].start+h->spans[a-1].len+1 >= l->hllo) a--;
+    if (a < h->len && h->spans[a].start < l->hllo)
+        from = h->spans[a].start;
+    else
+        from = a ? h->spans[a-1].start+h->spans[a-1].len : 0;
+
+    /* Stop at a token of the unchanged end which was already there: the
+     * following ones are the same too. */
+    n->len = 0;
+    b = a;
+    while (1) {
+        linenoiseHighlight t;
+
+        from = highlightToken(l,from,&t);
+        if (t.len == 0) {
+            b = h->len;
+            break;
+        }
+        if (t.start >= keep) {
+            size_t old = t.start+l->hllen-l->len;
+
+            while (b < h->len && h->spans[b].start < old) b++;
+            if (b < h->len && h->spans[b].start == old) break;
+        }
+        linenoiseAddHighlight(n,t.start,t.len,t.color,t.bold);
+    }
+    highlightSplice(h,a,b,n,l->len-l->hllen);
+}
+
+static int highlightCompare(const void *a, const void *b) {
+    const linenoiseHighlight *x = a, *y = b;
+
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/* Highlight the lines changed with the callback. */
+static void highlightCall(struct linenoiseState *l) {
+    linenoiseEditor *e = l->e;
+    linenoiseHighlights *h = &e->highlights, *n = &e->hlspans;
+    size_t from = lineStart(l,lineAt(l,l->hllo));
+    size_t to = lineEnd(l,lineAt(l,l->len-l->hlsuffix));
+    const char *s = lineString(l);
+    size_t a, b, i, j;
+
+    n->len = 0;
+    e->highlightCallback(e,s+from,to-from,n);
+
+    /* Make the spans sorted, apart and inside the lines. */
+    qsort(n->spans,n->len,sizeof(*n->spans),highlightCompare);
+    for (i = j = 0; i < n->len; i++) {
+        linenoiseHighlight t = n->spans[i];
+
+        if (t.start >= to-from) break;
+        if (t.len > to-from-t.start) t.len = to-from-t.start;
+        if (i+1 < n->len && t.len > n->spans[i+1].start-t.start)
+            t.len = n->spans[i+1].start-t.start;
+        if (t.len == 0) continue;
+        t.start += from;
+        n->spans[j++] = t;
+    }
+    n->len = j;
+
+    /* Replace the old spans of these lines. */
+    a = highlightFind(h,from);
+    if (a && h->spans[a-1].start+h->spans[a-1].len > from)
+        h->spans[a-1].len = from-h->spans[a-1].start;
+    b = highlightFind(h,to+l->hllen-l->len+1);
+    highlightSplice(h,a,b,n,l->len-l->hllen);
+}
+
+/* Highlight again what changed since the last refresh. */
+static void highlightUpdate(struct linenoiseState *l) {
+    linenoiseEditor *e = l->e;
+    uint64_t start;
+
+    l->hlspan = SIZE_MAX;
+    l->hlattr = 0;
+    if (!highlightEnabled(e) || l->hllo == SIZE_MAX) return;
+    start = statsStart(e);
+    if (e->highlightCallback)
+        highlightCall(l);
+    else
+        highlightLex(l);
+    statsRecordTime(e,&e->stats.highlight,start);
+    l->hllo = l->hlsuffix = SIZE_MAX;
+    l->hllen = l->len;
+}
+
+/* Forget the spans, the whole line is highlighted on the next refresh. */
+static void highlightReset(struct linenoiseState *l) {
+    l->e->highlights.len = 0;
+    l->hllo = l->hlsuffix = 0;
+    l->hllen = 0;
+}
+
+/* Switch the attributes of the text appended to 'attr': the color in the
+ * low byte, 0 for the default one, and 0x100 for bold. */
+static void abSetAttr(struct abuf *ab, struct linenoiseState *l, int attr) {
+    char seq[32];
+
+    if (attr == l->hlattr) return;
+    if (attr == 0)
+        snprintf(seq,sizeof(seq),"\033[0m");
+    else if ((attr & 0xff) == 0)
+        snprintf(seq,sizeof(seq),"\033[0;1m");
+    else
+        snprintf(seq,sizeof(seq),"\033[%d;%dm",attr >> 8,attr & 0xff);
+    abAppend(ab,seq,strlen(seq));
+    l->hlattr = attr;
+}
+
+/* Append the 'n' bytes of 's', found at the offset 'off' of the line,
+ * with the colors of their spans. Escape sequences are only emitted where
+ * the attributes change, from a call to the next one too. */
+static void abAppendText(struct abuf *ab, struct linenoiseState *l,
+                         const char *s, size_t off, size_t n)
+{
+    linenoiseHighlights *h = &l->e->highlights;
+    size_t i = l->hlspan;
+
+    if (!highlightEnabled(l->e)) {
+        abAppend(ab,s,n);
+        return;
+    }
+    if (i == SIZE_MAX) {
+        i = highlightFind(h,off);
+        if (i && h->spans[i-1].start+h->spans[i-1].len > off) i--;
+    }
+    while (n) {
+        size_t chunk = n;
+        int attr = 0;
+
+        while (i < h->len && h->spans[i].start+h->spans[i].len <= off) i++;
+        if (i < h->len && h->spans[i].start <= off) {
+            linenoiseHighlight *t = &h->spans[i];
+
+            if (t->start+t->len-off < chunk) chunk = t->start+t->len-off;
+            if (t->color > 0 || t->bold)
+                attr = (t->bold ? 0x100 : 0) | (t->color > 0 ? t->color : 0);
+        } else if (i < h->len && h->spans[i].start-off < chunk) {
+            chunk = h->spans[i].start-off;
+        }
+        abSetAttr(ab,l,attr);
+        abAppend(ab,s,chunk);
+        s += chunk;
+        off += chunk;
+        n -= chunk;
+    }
+    l->hlspan = i;
+}
+
+/* ============================== Completion ================================ */
+
+/* The text of the completion candidates is stored in an arena: a list of
+ * blocks growing geometrically, newest first. Candidates are never freed
+ * one by one, the whole arena is reset once the completion is done. */
+struct linenoiseArenaBlock {
+    struct linenoiseArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+/* Return 'len' bytes of storage from the arena, or NULL on out of memory. */
+static char *arenaAlloc(linenoiseCompletions *lc, size_t len) {
+    struct linenoiseArenaBlock *b = lc->arena;
+
+    if (b == NULL || b->size-b->used < len) {
+        size_t size = b ? b->size*2 : LINENOISE_COMPLETION_ARENA_MIN;
+
+        while (size < len) size *= 2;
+        b = malloc(sizeof(*b)+size);
+        if (b == NULL) return NULL;
+        b->next = lc->arena;
+        b->used = 0;
+        b->size = size;
+        lc->arena = b;
+    }
+    b->used += len;
+    return b->data+b->used-len;
+}
+
+/* Make room for 'n' more candidates. On error -1 is returned. */
+static int completionsReserve(linenoiseCompletions *lc, size_t n) {
+    size_t cap = lc->cap ? lc->cap : 16;
+    char **cvec;
+    size_t *clen;
+
+    if (lc->len+n <= lc->cap) return 0;
+    while (cap < lc->len+n) cap *= 2;
+    cvec = realloc(lc->cvec,sizeof(char*)*cap);
+    if (cvec == NULL) return -1;
+    lc->cvec = cvec;
+    clen = realloc(lc->clen,sizeof(size_t)*cap);
+    if (clen == NULL) return -1;
+    lc->clen = clen;
+    lc->cap = cap;
+    return 0;
+}
+
+/* Free a list of completion option populated by linenoiseAddCompletion(). */
+static void freeCompletions(linenoiseCompletions *lc) {
+    struct linenoiseArenaBlock *b = lc->arena;
+
+    while (b) {
+        struct linenoiseArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    free(lc->cvec);
+    free(lc->clen);
+    memset(lc,0,sizeof(*lc));
+}
+
+/* Forget the candidates but keep the memory around for the next <tab>,
+ * unless a huge list of candidates made it grow too much. Only the newest
+ * (and largest) arena block is retained. */
+static void resetCompletions(linenoiseCompletions *lc) {
+    struct linenoiseArenaBlock *b = lc->arena;
+
+    if (b == NULL ||
+        b->size > LINENOISE_COMPLETION_ARENA_KEEP ||
+        lc->cap*(sizeof(char*)+sizeof(size_t)) > LINENOISE_COMPLETION_ARENA_KEEP)
+    {
+        freeCompletions(lc);
+        return;
+    }
+    while (b->next) {
+        struct linenoiseArenaBlock *next = b->next->next;
+        free(b->next);
+        b->next = next;
+    }
+    b->used = 0;
+    lc->len = 0;
+}
+
+/* Return the length of the common prefix of 'a' and 'b', that must be at
+ * least 'len' bytes long, up to 'len'. With SSE2 16 bytes are compared at
+ * a time. */
+static size_t commonPrefix(const char *a, const char *b, size_t len) {
+    size_t j = 0;
+
+#ifdef __SSE2__
+    while (j+16 <= len) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a+j));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b+j));
+        unsigned int diff = _mm_movemask_epi8(_mm_cmpeq_epi8(x,y)) ^ 0xffff;
+
+        if (diff) return j+__builtin_ctz(diff);
+        j += 16;
+    }
+#endif
+    while (j < len && a[j] == b[j]) j++;
+    return j;
+}
+
+/* Return the length of the longest common prefix of all the candidates.
+ * Every candidate is only compared up to the prefix found so far, so this
+ * is linear in the total size of the candidates. */
+static size_t completionsCommonPrefix(linenoiseCompletions *lc) {
+    size_t i, lcp = lc->clen[0];
+
+    for (i = 1; i < lc->len && lcp; i++) {
+        if (lc->clen[i] < lcp) lcp = lc->clen[i];
+        lcp = commonPrefix(lc->cvec[0],lc->cvec[i],lcp);
+    }
+    return lcp;
+}
+
+/* FNV-1a hash of 'len' bytes of 's'. */
+static uint64_t completionsHash(const char *s, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+
+    while (len--) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Drop duplicated candidates, keeping the first occurrence of every one of
+ * them in the original order. Uses an open addressing hash set of indexes
+ * (plus one, zero marks an empty slot) into the already compacted cvec. */
+static void completionsUnique(linenoiseEditor *e, linenoiseCompletions *lc) {
+    size_t size = 16, mask, i, n = 0;
+
+    if (lc->len < 2) return;
+    while (size < lc->len*2) size *= 2;
+    if (size > e->completions_set_size) {
+        size_t *set = realloc(e->completions_set,sizeof(size_t)*size);
+
+        if (set == NULL) return;
+        e->completions_set = set;
+        e->completions_set_size = size;
+    }
+    memset(e->completions_set,0,sizeof(size_t)*size);
+    mask = size-1;
+
+    for (i = 0; i < lc->len; i++) {
+        size_t h = completionsHash(lc->cvec[i],lc->clen[i]) & mask, j;
+
+        while ((j = e->completions_set[h]) != 0) {
+            j--;
+            if (lc->clen[j] == lc->clen[i] &&
+                !memcmp(lc->cvec[j],lc->cvec[i],lc->clen[i])) break;
+            h = (h+1) & mask;
+        }
+        if (e->completions_set[h]) continue; /* Duplicate. */
+        lc->cvec[n] = lc->cvec[i];
+        lc->clen[n] = lc->clen[i];
+        e->completions_set[h] = ++n;
+    }
+    lc->len = n;
+
+    /* Don't keep a huge set around after a huge list of candidates. */
+    if (e->completions_set_size*sizeof(size_t) > LINENOISE_COMPLETION_ARENA_KEEP) {
+        free(e->completions_set);
+        e->completions_set = NULL;
+        e->completions_set_size = 0;
+    }
+}
+
+/* Replace the edited line with the first 'len' bytes of 'str'. */
+static void completionsSetBuffer(struct linenoiseState *ls, const char *str,
+                                 size_t len)
+{
+    lineSet(ls,str,len);
+}
+
+/* Show the candidate 'i' in place of the edited line, without modifying
+ * the line itself. */
+static void refreshCandidate(struct linenoiseState *ls,
+                             linenoiseCompletions *lc, size_t i)
+{
+    struct linenoiseState saved = *ls;
+
+    ls->len = ls->pos = ls->buflen = lc->clen[i];
+    ls->buf = lc->cvec[i];
+    ls->lbefore = ls->lafter = 0;
+    ls->hoff = SIZE_MAX;
+    highlightReset(ls);
+    refreshLine(ls);
+    ls->len = saved.len;
+    ls->pos = saved.pos;
+    ls->buf = saved.buf;
+    ls->buflen = saved.buflen;
+    ls->lbefore = saved.lbefore;
+    ls->lafter = saved.lafter;
+    ls->hoff = saved.hoff;
+    ls->topline = saved.topline;
+    ls->toprow = saved.toprow;
+    highlightReset(ls);
+}
+
+/* Layout of the completion menu. Candidates are laid out in rows of 'ncols'
+ * columns 'width' bytes wide, and 'pagerows' rows are visible at once. */
+struct completionMenu {
+    size_t width;
+    size_t ncols;
+    size_t pagerows;
+    size_t sel;         /* Selected candidate. */
+};
+
+/* Draw the page of the menu holding the selected candidate below the
+ * line, then put the cursor back at the end of the line. The candidate
+ * must be already shown with refreshCandidate(), so the cursor is on the
+ * last row of the line. Only the visible page is formatted. */
+static void refreshMenu(struct linenoiseState *ls, linenoiseCompletions *lc,
+                        struct completionMenu *m)
+{
+    char seq[64];
+    size_t perpage = m->ncols*m->pagerows;
+    size_t start = m->sel/perpage*perpage, end = start+perpage, i;
+    size_t col;
+    int lines = 0;
+    struct abuf *ab = &ls->e->out;
+    int oldlen = ab->len;
+
+    if (end > lc->len) end = lc->len;
+    for (i = start; i < end; i++) {
+        size_t len, width;
+        int lastcol = (i-start) % m->ncols == m->ncols-1 || i == end-1;
+
+        if ((i-start) % m->ncols == 0) {
+            abAppend(ab,"\r\n",2);
+            lines++;
+        }
+        len = linenoiseUtf8Fit(lc->cvec[i],lc->clen[i],ls->cols-1,&width);
+        if (i == m->sel) abAppend(ab,"\x1b[7m",4);
+        abAppend(ab,lc->cvec[i],len);
+        if (i == m->sel) abAppend(ab,"\x1b[0m",4);
+        if (lastcol) {
+            abAppend(ab,"\x1b[0K",4);
+        } else {
+            for (; width < m->width; width++) abAppend(ab," ",1);
+        }
+    }
+    /* Status line when the candidates don't fit in one page. */
+    if (lc->len > perpage) {
+        snprintf(seq,64,"\r\n\x1b[7m%zu-%zu of %zu\x1b[0m\x1b[0K",
+                 start+1,end,lc->len);
+        abAppend(ab,seq,strlen(seq));
+        lines++;
+    }
+    /* Clear whatever is left of a previous, longer page. */
+    abAppend(ab,"\x1b[0J",4);
+
+    /* Back to the line. */
+    col = linenoiseUtf8Width(lc->cvec[m->sel],lc->clen[m->sel])+ls->pcols;
+    if (ls->e->mlmode) col %= ls->cols;
+    else if (col > ls->cols-1) col = ls->cols-1;
+    snprintf(seq,64,"\x1b[%dA\r",lines);
+    abAppend(ab,seq,strlen(seq));
+    if (col) {
+        snprintf(seq,64,"\x1b[%dC",(int)col);
+        abAppend(ab,seq,strlen(seq));
+    }
+    statsRecord(ls->e,&ls->e->stats.refresh_bytes,ab->len-oldlen);
+}
+
+/* Menu flavour of completeLine(). The candidates are shown in columns
+ * below the line and can be navigated with
+ * <tab>, shift+<tab>, the arrows and page up/down. Enter accepts the
+ * selected candidate, ctrl+g or a bare escape restores the line, and any
+ * other key accepts the candidate and is then processed as usual. */
+static int completeMenu(struct linenoiseState *ls, linenoiseCompletions *lc) {
+    struct completionMenu m;
+    size_t i, maxlen = 0, perpage;
+    int rows, nread, key = 0;
+
+    if (lc->len == 1) {
+        completionsSetBuffer(ls,lc->cvec[0],lc->clen[0]);
+        refreshLine(ls);
+        return 0;
+    }
+
+    /* Column width is computed in a single pass over the candidates. */
+    for (i = 0; i < lc->len; i++) {
+        size_t width = linenoiseUtf8Width(lc->cvec[i],lc->clen[i]);
+        if (width > maxlen) maxlen = width;
+    }
+    m.width = maxlen+2;
+    m.ncols = ls->cols/m.width;
+    if (m.ncols == 0) m.ncols = 1;
+    rows = getRows(ls->e)-(int)((ls->pcols+maxlen)/ls->cols+1)-1;
+    m.pagerows = rows > 0 ? rows : 1;
+    m.sel = 0;
+    perpage = m.ncols*m.pagerows;
+
+    while(1) {
+        refreshCandidate(ls,lc,m.sel);
+        refreshMenu(ls,lc,&m);
+
+        nread = readKey(ls->e,&key);
+        if (nread <= 0) {
+            if (writeOut(ls->e,"\x1b[0J",4) == -1) {}
+            return -1;
+        }
+
+        switch(key) {
+        case TAB:
+        case KEY_RIGHT:
+            m.sel = (m.sel+1) % lc->len;
+            continue;
+        case KEY_BACKTAB:
+        case KEY_LEFT:
+            m.sel = (m.sel+lc->len-1) % lc->len;
+            continue;
+        case KEY_UP:
+            if (m.sel >= m.ncols) m.sel -= m.ncols;
+            continue;
+        case KEY_DOWN:
+            if (m.sel+m.ncols < lc->len) m.sel += m.ncols;
+            continue;
+        case KEY_PAGE_UP:
+            m.sel = m.sel >= perpage ? m.sel-perpage : 0;
+            continue;
+        case KEY_PAGE_DOWN:
+            m.sel = m.sel+perpage < lc->len ? m.sel+perpage : lc->len-1;
+            continue;
+        case KEY_UNKNOWN:
+            continue;
+        case CTRL_G:
+        case ESC:
+            break;
+        default:
+            completionsSetBuffer(ls,lc->cvec[m.sel],lc->clen[m.sel]);
+            break;
+        }
+
+        /* Close the menu and show the resulting line. */
+        if (writeOut(ls->e,"\x1b[0J",4) == -1) {}
+        refreshLine(ls);
+        if (key == ENTER || key == CTRL_G || key == ESC) return 0;
+        return key;
+    }
+}
+
+/* This is an helper function for linenoiseEdit() and is called when the
+ * user types the <tab> key in order to complete the string currently in the
+ * input.
+ *
+ * The state of the editing is encapsulated into the pointed linenoiseState
+ * structure as described in the structure definition. */
+static int completeLine(struct linenoiseState *ls) {
+    linenoiseEditor *e = ls->e;
+    linenoiseCompletions *lc = &e->completions;
+    int nread, key = 0;
+    uint64_t start;
+
+    start = statsStart(e);
+    e->completionCallback(e,lineString(ls),lc);
+    statsRecordTime(e,&e->stats.completion,start);
+    completionsUnique(e,lc);
+
+    /* Like readline, first extend the line with the longest common prefix
+     * of the candidates, when it does. */
+    if (lc->len) {
+        size_t lcp = completionsCommonPrefix(lc);
+
+        if (lcp > ls->len && !strncmp(lineString(ls),lc->cvec[0],ls->len)) {
+            completionsSetBuffer(ls,lc->cvec[0],lcp);
+            refreshLine(ls);
+            resetCompletions(lc);
+            return 0;
+        }
+    }
+    if (lc->len && e->menumode) {
+        int next = completeMenu(ls,lc);
+        resetCompletions(lc);
+        return next;
+    }
+    if (lc->len == 0) {
+        linenoiseBeep(ls->e);
+    } else {
+        size_t stop = 0, i = 0;
+
+        while(!stop) {
+            /* Show completion or original buffer */
+            if (i < lc->len) {
+                refreshCandidate(ls,lc,i);
+            } else {
+                refreshLine(ls);
+            }
+
+            nread = readKey(e,&key);
+            if (nread <= 0) {
+                resetCompletions(lc);
+                return -1;
+            }
+
+            switch(key) {
+                case 9: /* tab */
+                    i = (i+1) % (lc->len+1);
+                    if (i == lc->len) linenoiseBeep(ls->e);
+                    break;
+                case 27: /* escape */
+                    /* Re-show original buffer */
+                    if (i < lc->len) refreshLine(ls);
+                    stop = 1;
+                    break;
+                default:
+                    /* Update buffer and return */
+                    if (i < lc->len)
+                        lineSet(ls,lc->cvec[i],lc->clen[i]);
+                    stop = 1;
+                    break;
+            }
+        }
+    }
+
+    resetCompletions(lc);
+    return key; /* Return last read key */
+}
+
+/* Register a callback function to be called for tab-completion. */
+void linenoiseEditorSetCompletionCallback(linenoiseEditor *e,
+                                          linenoiseEditorCompletionCallback *fn)
+{
+    e->completionCallback = fn;
+}
+
+/* Register a hits function to be called to show hits to the user at the
+ * right of the prompt. */
+void linenoiseEditorSetHintsCallback(linenoiseEditor *e,
+                                     linenoiseEditorHintsCallback *fn)
+{
+    e->hintsCallback = fn;
+}
+
+/* Register a function to free the hints returned by the hints callback
+ * registered with linenoiseEditorSetHintsCallback(). */
+void linenoiseEditorSetFreeHintsCallback(linenoiseEditor *e,
+                                         linenoiseEditorFreeHintsCallback *fn)
+{
+    e->freeHintsCallback = fn;
+}
+
+/* Register a function highlighting the edited line, instead of the
+ * built-in lexer enabled by linenoiseEditorSetHighlight(). It is given the
+ * lines changed since the last refresh, and adds a span for every part to
+ * show with a color with linenoiseAddHighlight(). */
+void linenoiseEditorSetHighlightCallback(linenoiseEditor *e,
+                                         linenoiseEditorHighlightCallback *fn)
+{
+    e->highlightCallback = fn;
+}
+
+/* Register a function called instead of write() on the output of the
+ * editor, to render into something that is not a file descriptor, like an
+ * in-memory screen. It returns the bytes written or -1 like write(). */
+void linenoiseEditorSetWriteCallback(linenoiseEditor *e,
+                                     linenoiseEditorWriteCallback *fn)
+{
+    e->writeCallback = fn;
+}
+
+/* This function is used by the callback function registered by the user
+ * in order to add completion options given the input string when the
+ * user typed <tab>. See the example.c source code for a very easy to
+ * understand example. */
+void linenoiseAddCompletion(linenoiseCompletions *lc, const char *str) {
+    linenoiseAddCompletions(lc,&str,NULL,1);
+}
+
+/* Add 'n' completion options at once. When 'lens' is NULL the strings must
+ * be null terminated, otherwise lens[i] is the length of strs[i]. The text
+ * of all the options is copied into the arena with a single allocation. */
+void linenoiseAddCompletions(linenoiseCompletions *lc, const char **strs,
+                             const size_t *lens, size_t n)
+{
+    size_t i, total = 0;
+    char *p;
+
+    if (n == 0 || completionsReserve(lc,n) == -1) return;
+    for (i = 0; i < n; i++)
+        total += (lens ? lens[i] : strlen(strs[i]))+1;
+    p = arenaAlloc(lc,total);
+    if (p == NULL) return;
+    for (i = 0; i < n; i++) {
+        size_t len = lens ? lens[i] : strlen(strs[i]);
+
+        memcpy(p,strs[i],len);
+        p[len] = '\0';
+        lc->cvec[lc->len] = p;
+        lc->clen[lc->len++] = len;
+        p += len+1;
+    }
+}
+
+/* Used by the highlight callback to show the 'len' bytes at the offset
+ * 'start' of the text it was given with the SGR color 'color' (-1 for the
+ * default one), in bold when 'bold' is set. Spans must not overlap. */
+void linenoiseAddHighlight(linenoiseHighlights *h, size_t start, size_t len,
+                           int color, int bold)
+{
+    linenoiseHighlight *t;
+
+    if (len == 0 || highlightsReserve(h,1) == -1) return;
+    t = &h->spans[h->len++];
+    t->start = start;
+    t->len = len;
+    t->color = color;
+    t->bold = bold;
+}
+
+/* =========================== Line editing ================================= */
+
+/* Helper of refreshSingleLine() and refreshMultiLine() to show hints
+ * to the right of the prompt. */
+void refreshShowHints(struct abuf *ab, struct linenoiseState *l, int pcols) {
+    linenoiseEditor *e = l->e;
+    char seq[64];
+    size_t bufcols;
+
+    l->suggested = 0;
+    if (!e->hintsCallback && !e->autosuggest) return;
+    bufcols = lineWidth(l);
+    if (pcols+bufcols < l->cols) {
+        int color = -1, bold = 0;
+        uint64_t start = statsStart(e);
+        char *hint = e->hintsCallback ?
+                     e->hintsCallback(e,lineString(l),&color,&bold) : NULL;
+        char *suggestion = NULL;
+        int freehint = hint != NULL;
+
+        if (e->hintsCallback) statsRecordTime(e,&e->stats.hints,start);
+
+        /* Fall back to a suggestion from history when the callback has
+         * nothing to say and the cursor is at the end of the line. */
+        if (hint == NULL && e->autosuggest && l->len && l->pos == l->len) {
+            suggestion = historySuggestDup(e,lineString(l),l->len);
+            if (suggestion) {
+                hint = suggestion+l->len;
+                color = 90;
+                bold = 0;
+                l->suggested = 1;
+            }
+        }
+        if (hint) {
+            int hintmaxlen = l->cols-(pcols+bufcols);
+            int hintlen = linenoiseUtf8Fit(hint,strlen(hint),hintmaxlen,NULL);
+            if (bold == 1 && color == -1) color = 37;
+            if (color != -1 || bold != 0)
+                snprintf(seq,64,"\033[%d;%d;49m",bold,color);
+            else
+                seq[0] = '\0';
+            abAppend(ab,seq,strlen(seq));
+            abAppend(ab,hint,hintlen);
+            if (color != -1 || bold != 0)
+                abAppend(ab,"\033[0m",4);
+            /* Call the function to free the hint returned. */
+            if (freehint && e->freeHintsCallback)
+                e->freeHintsCallback(e,hint);
+        }
+        free(suggestion);
+    }
+}
+
+/* Move the cursor of the terminal 'n' columns to the right, or to the
+ * left when negative, with the shortest sequence. */
+static void abMoveCursor(struct abuf *ab, long n) {
+    char seq[32];
+
+    if (n == -1)
+        abAppend(ab,"\b",1);
+    else if (n != 0)
+        abAppend(ab,seq,snprintf(seq,sizeof(seq),"\x1b[%ld%c",
+                                 n < 0 ? -n : n, n < 0 ? 'D' : 'C'));
+}
+
+/* Scroll the line horizontally, so that the cursor is on the screen, with
+ * 'avail' columns after the prompt. The view only moves when the cursor
+ * leaves it, and then by half the screen: the text stays in place while it
+ * is edited, and only the characters around the cursor are measured. */
+static void refreshScrollColumns(struct linenoiseState *l, size_t avail) {
+    size_t cols = avail ? avail-1 : 0, used = 0;
+
+    if ((l->hoff == 0 || l->hoff < l->pos) &&
+        linenoiseUtf8Fit(l->buf+l->hoff,l->pos-l->hoff,cols,NULL) ==
+        l->pos-l->hoff) return;
+    /* From the start of the line if the cursor is on the first screen,
+     * otherwise with the cursor in the middle. */
+    if (linenoiseUtf8Fit(l->buf,l->pos,cols,NULL) == l->pos) {
+        l->hoff = 0;
+        return;
+    }
+    l->hoff = l->pos;
+    while (l->hoff > 0) {
+        size_t n = linenoiseUtf8PrevLen(l->buf,l->hoff);
+        size_t width = linenoiseUtf8Width(l->buf+l->hoff-n,n);
+
+        if (used+width > avail/2) break;
+        used += width;
+        l->hoff -= n;
+    }
+}
+
+/* Single line low level line refresh.
+ *
+ * Rewrite the currently edited line accordingly to the buffer content,
+ * cursor position, and number of columns of the terminal. */
+static void refreshSingleLine(struct linenoiseState *l) {
+    char seq[64];
+    size_t pcols = l->pcols;
+    size_t avail = pcols < l->cols ? l->cols-pcols : 0;
+    char *buf;
+    size_t pos, poscols, len, used, taillen, tailused = 0;
+    struct abuf *ab = &l->e->out;
+    int oldlen = ab->len, hintlen;
+
+    highlightUpdate(l);
+    refreshScrollColumns(l,avail);
+    buf = l->buf+l->hoff;
+    pos = l->pos-l->hoff;
+    /* Both halves of the line are shown as they are in the buffer. */
+    len = linenoiseUtf8Fit(buf,pos,avail,&used);
+    poscols = used;
+    taillen = len < pos ? 0 :
+              linenoiseUtf8Fit(lineTail(l),l->len-l->pos,avail-used,&tailused);
+
+    /* Cursor to left edge, and past the prompt. Moving over a prompt that
+     * is already there can take fewer bytes than writing it again, unless
+     * it changes the attributes of the text. */
+    snprintf(seq,64,"\r\x1b[%dC",(int)pcols);
+    if (l->promptshown && pcols && pcols < l->cols && strlen(seq) < l->plen &&
+        memchr(l->prompt,'\033',l->plen) == NULL) {
+        abAppend(ab,seq,strlen(seq));
+    } else {
+        abAppend(ab,"\r",1);
+        abAppend(ab,l->prompt,l->plen);
+    }
+    /* Write the current buffer content */
+    abAppendText(ab,l,buf,buf-l->buf,len);
+    abAppendText(ab,l,lineTail(l),l->pos,taillen);
+    abSetAttr(ab,l,0);
+    /* Show hits if any. */
+    hintlen = ab->len;
+    refreshShowHints(ab,l,pcols);
+    hintlen = ab->len-hintlen;
+    /* Erase to right */
+    snprintf(seq,64,"\x1b[0K");
+    abAppend(ab,seq,strlen(seq));
+    /* Move cursor to original position: back from the end of the line when
+     * nothing follows it and it doesn't end on the last column. */
+    if (hintlen == 0 && pcols+used+tailused < l->cols) {
+        abMoveCursor(ab,-(long)tailused);
+    } else {
+        snprintf(seq,64,"\r\x1b[%dC", (int)(poscols+pcols));
+        abAppend(ab,seq,strlen(seq));
+    }
+    l->promptshown = 1;
+    statsRecord(l->e,&l->e->stats.refresh_bytes,ab->len-oldlen);
+}
+
+/* Helpers of refreshMultiLine(). The buffer is laid out in rows, counted
+ * from the first row of a given line, and only the rows from 'top' to
+ * 'bottom' excluded are visible. The layout stops at 'bottom', and when
+ * 'ab' is not NULL the visible rows are appended to it. */
+
+/* Start a new row, with a line break if both rows are visible. */
+static void layoutBreak(struct abuf *ab, int *row, size_t *col, int top,
+                        int bottom)
+{
+    if (ab && *row >= top && *row+1 < bottom) abAppend(ab,"\r\n",2);
+    (*row)++;
+    *col = 0;
+}
+
+/* Lay out 'len' bytes of 's', found at the offset 'off' of the line, from
+ * column 'col', wrapping them like the terminal would. */
+static void layoutText(struct abuf *ab, struct linenoiseState *l,
+                       const char *s, size_t off, size_t len, int *row,
+                       size_t *col, int top, int bottom)
+{
+    size_t cols = l->cols;
+
+    while (len && *row < bottom) {
+        size_t width;
+        size_t n = linenoiseUtf8Fit(s,len,*col < cols ? cols-*col : 0,&width);
+
+        if (n == 0 && *col == 0) {
+            /* Wider than a row: shown anyway, the row is full. */
+            n = linenoiseUtf8NextLen(s,0,len);
+            width = cols;
+        }
+        if (ab && *row >= top) abAppendText(ab,l,s,off,n);
+        s += n;
+        off += n;
+        len -= n;
+        *col += width;
+        if (len) layoutBreak(ab,row,col,top,bottom);
+    }
+}
+
+/* Lay out the line 'i' of the buffer, the first one after the prompt. If
+ * the cursor is on it, its row and column are stored in 'crow' and 'ccol'.
+ * The cursor goes to the next row after a full one, like the terminal. */
+static void layoutLine(struct linenoiseState *l, size_t i, struct abuf *ab,
+                       int *row, int top, int bottom, int *crow,
+                       size_t *ccol)
+{
+    size_t start = lineStart(l,i), end = lineEnd(l,i), col = 0;
+
+    if (i == 0) {
+        if (ab && *row >= top && *row < bottom)
+            abAppend(ab,l->prompt,l->plen);
+        for (col = l->pcols; col >= l->cols; col -= l->cols) (*row)++;
+    }
+    if (i < l->lbefore) {
+        layoutText(ab,l,l->buf+start,start,end-start,row,&col,top,bottom);
+    } else if (i > l->lbefore) {
+        layoutText(ab,l,lineTail(l)+(start-l->pos),start,end-start,row,&col,
+                   top,bottom);
+    } else {
+        layoutText(ab,l,l->buf+start,start,l->pos-start,row,&col,top,
+                   bottom);
+        if (col >= l->cols) layoutBreak(ab,row,&col,top,bottom);
+        *crow = *row;
+        *ccol = col;
+        layoutText(ab,l,lineTail(l),l->pos,end-l->pos,row,&col,top,bottom);
+    }
+}
+
+/* Return the number of rows of the line 'i'. */
+static int layoutRows(struct linenoiseState *l, size_t i) {
+    int row = 0, crow;
+    size_t ccol;
+
+    layoutLine(l,i,NULL,&row,0,INT_MAX,&crow,&ccol);
+    return row+1;
+}
+
+/* Scroll the view, if needed, so that the cursor is in the 'rows' rows
+ * visible. Only the lines between the view and the cursor are laid out. */
+static void refreshScroll(struct linenoiseState *l, int rows) {
+    size_t cur = l->lbefore, i;
+    size_t ccol;
+    int row = 0, crow = 0, above;
+
+    if (cur < l->topline) {
+        l->topline = cur;
+        l->toprow = 0;
+    }
+    for (i = l->topline; i <= cur && row < l->toprow+rows; i++) {
+        if (i > l->topline) row++;
+        layoutLine(l,i,NULL,&row,0,l->toprow+rows,&crow,&ccol);
+    }
+    if (i > cur && crow < l->toprow) {
+        l->toprow = crow;
+        return;
+    }
+    if (i > cur && crow < l->toprow+rows) return;
+
+    /* The cursor is below the view: make its row the last one, going up
+     * from the cursor line. */
+    row = 0;
+    layoutLine(l,cur,NULL,&row,0,INT_MAX,&crow,&ccol);
+    above = rows-1;
+    for (i = cur; ; i--) {
+        int height = i == cur ? crow : layoutRows(l,i);
+
+        if (height >= above || i == 0) {
+            l->topline = i;
+            l->toprow = height > above ? height-above : 0;
+            return;
+        }
+        above -= height;
+    }
+}
+
+/* Multi line low level line refresh.
+ *
+ * Rewrite the currently edited line accordingly to the buffer content,
+ * cursor position, and number of columns of the terminal. Only the rows
+ * visible in the terminal are laid out and drawn, the view scrolling to
+ * follow the cursor. */
+static void refreshMultiLine(struct linenoiseState *l) {
+    char seq[64];
+    int rows = getRows(l->e);
+    size_t count = lineCount(l), i, col = 0, ccol = 0;
+    int row = 0, crow = 0, lastrow, j;
+    struct abuf *ab = &l->e->out;
+    int oldlen = ab->len;
+
+    highlightUpdate(l);
+    refreshScroll(l,rows);
+    l->promptshown = 0;
+
+    /* First step: clear all the rows drawn before. To do so start by
+     * going to the last one. */
+    if (l->oldrows-1-l->oldcrow > 0) {
+        lndebug("go down %d", l->oldrows-1-l->oldcrow);
+        snprintf(seq,64,"\x1b[%dB", l->oldrows-1-l->oldcrow);
+        abAppend(ab,seq,strlen(seq));
+    }
+
+    /* Now for every row clear it, go up. */
+    for (j = 0; j < l->oldrows-1; j++) {
+        lndebug("clear+up");
+        snprintf(seq,64,"\r\x1b[0K\x1b[1A");
+        abAppend(ab,seq,strlen(seq));
+    }
+
+    /* Clean the top row. */
+    lndebug("clear");
+    snprintf(seq,64,"\r\x1b[0K");
+    abAppend(ab,seq,strlen(seq));
+
+    /* Write the visible rows of the prompt and the buffer. */
+    for (i = l->topline; i < count && row < l->toprow+rows; i++) {
+        if (i > l->topline)
+            layoutBreak(ab,&row,&col,l->toprow,l->toprow+rows);
+        layoutLine(l,i,ab,&row,l->toprow,l->toprow+rows,&crow,&ccol);
+    }
+    abSetAttr(ab,l,0);
+    lastrow = (row < l->toprow+rows ? row : l->toprow+rows-1)-l->toprow;
+    crow -= l->toprow;
+
+    /* Show hints if any, they only fit on a line without newlines. */
+    if (count == 1)
+        refreshShowHints(ab,l,l->pcols);
+    else
+        l->suggested = 0;
+
+    /* Go up till we reach the row of the cursor. */
+    if (lastrow-crow > 0) {
+        lndebug("go-up %d", lastrow-crow);
+        snprintf(seq,64,"\x1b[%dA", lastrow-crow);
+        abAppend(ab,seq,strlen(seq));
+    }
+
+    /* Set column. */
+    lndebug("set col %d", 1+(int)ccol);
+    if (ccol)
+        snprintf(seq,64,"\r\x1b[%dC", (int)ccol);
+    else
+        snprintf(seq,64,"\r");
+    abAppend(ab,seq,strlen(seq));
+
+    lndebug("\n");
+    l->oldrows = lastrow+1;
+    l->oldcrow = crow;
+
+    statsRecord(l->e,&l->e->stats.refresh_bytes,ab->len-oldlen);
+}
+
+/* Calls the two low level functions refreshSingleLine() or
+ * refreshMultiLine() according to the selected mode. */
+static void refreshLine(struct linenoiseState *l) {
+    /* A line with newlines is always shown on several rows, until the
+     * rows are cleared. */
+    if (l->e->mlmode || lineCount(l) > 1 || l->oldrows > 1)
+        refreshMultiLine(l);
+    else
+        refreshSingleLine(l);
+}
+
+/* Edits in place. When the rest of the line, from the first character
+ * shown, is on the screen after the prompt, alone on its row, the terminal
+ * can insert and delete characters and move the cursor by itself: a few
+ * bytes instead of the whole line, that count on slow links. Return true if
+ * that's the case, and the line still fits with 'extra' more columns. */
+static int refreshInPlace(struct linenoiseState *l, size_t extra) {
+    linenoiseEditor *e = l->e;
+    size_t avail, used, pos = l->pos-l->hoff;
+
+    if (!l->promptshown || e->mlmode || e->hintsCallback || e->autosuggest ||
+        highlightEnabled(e) || lineCount(l) != 1 || l->oldrows > 1 ||
+        (l->hoff && l->hoff >= l->pos) || l->pcols+extra >= l->cols)
+        return 0;
+    /* The cursor needs a column after the line. */
+    avail = l->cols-l->pcols-extra-1;
+    if (l->len-l->hoff <= avail) return 1; /* A byte is never wider. */
+    if (linenoiseUtf8Fit(l->buf+l->hoff,pos,avail,&used) != pos) return 0;
+    return linenoiseUtf8Fit(lineTail(l),l->len-l->pos,avail-used,NULL) ==
+           l->len-l->pos;
+}
+
+/* Return true if the byte at 'pos' is a printable ASCII character, or the
+ * end of the line: the terminal shifts the rest of the line as it is, no
+ * character around it changes width. */
+static int linePlainAt(struct linenoiseState *l, size_t pos) {
+    unsigned char c = pos < l->len ? lineByte(l,pos) : ' ';
+
+    return c >= ' ' && c < 127;
+}
+
+/* Show the cursor moved from 'oldpos' to the current position. */
+static void refreshCursor(struct linenoiseState *l, size_t oldpos) {
+    struct abuf *ab = &l->e->out;
+
+    if (!refreshInPlace(l,0))
+        refreshLine(l);
+    else if (l->pos > oldpos)
+        abMoveCursor(ab,linenoiseUtf8Width(l->buf+oldpos,l->pos-oldpos));
+    else
+        abMoveCursor(ab,-(long)linenoiseUtf8Width(lineTail(l),oldpos-l->pos));
+}
+
+/* Show that 'width' columns were deleted at the cursor, the rest of the
+ * line being shifted by the terminal. */
+static void refreshDelete(struct linenoiseState *l, size_t width) {
+    char seq[32];
+
+    if (width == 1)
+        abAppend(&l->e->out,"\x1b[P",3);
+    else
+        abAppend(&l->e->out,seq,snprintf(seq,sizeof(seq),"\x1b[%dP",
+                                         (int)width));
+}
+
+/* Insert the 'clen' bytes of the character 'c' at cursor current position.
+ *
+ * On error writing to the terminal -1 is returned, otherwise 0. */
+int linenoiseEditInsert(struct linenoiseState *l, const char *c, size_t clen) {
+    int append = l->len == l->pos;
+    /* Before another character only a plain one is inserted in place. */
+    int inplace = (unsigned char)c[0] >= ' ' && c[0] != 127 &&
+                  (append || (clen == 1 && (unsigned char)c[0] < 127 &&
+                              linePlainAt(l,l->pos))) &&
+                  refreshInPlace(l,linenoiseUtf8Width(c,clen));
+
+    if (lineInsert(l,c,clen) == -1) return 0;
+    if (inplace) {
+        /* Avoid a full update of the line: the terminal makes room for the
+         * character, unless it's the last one. */
+        if (!append && writeOut(l->e,"\x1b[@",3) == -1) return -1;
+        if (writeOut(l->e,c,clen) == -1) return -1;
+    } else {
+        refreshLine(l);
+    }
+    return 0;
+}
+
+/* Move cursor on the left. */
+void linenoiseEditMoveLeft(struct linenoiseState *l) {
+    if (l->pos > 0) {
+        size_t oldpos = l->pos;
+
+        lineMoveGap(l,l->pos-linenoiseUtf8PrevLen(l->buf,l->pos));
+        refreshCursor(l,oldpos);
+    }
+}
+
+/* Append the rest of the displayed history suggestion to the buffer.
+ * Returns 1 if a suggestion was accepted, otherwise 0. */
+static int linenoiseEditAcceptSuggestion(struct linenoiseState *l) {
+    char *s;
+    int retval;
+
+    if (!l->suggested || l->pos != l->len) return 0;
+    s = historySuggestDup(l->e,lineString(l),l->len);
+    if (s == NULL) return 0;
+    retval = lineInsert(l,s+l->len,strlen(s)-l->len) == 0;
+    free(s);
+    if (retval) refreshLine(l);
+    return retval;
+}
+
+/* Move cursor on the right. At the end of the line accept the suggestion
+ * instead, if any. */
+void linenoiseEditMoveRight(struct linenoiseState *l) {
+    if (l->pos != l->len) {
+        size_t oldpos = l->pos;
+
+        lineMoveGap(l,l->pos+linenoiseUtf8NextLen(lineTail(l),0,l->len-l->pos));
+        refreshCursor(l,oldpos);
+    } else {
+        linenoiseEditAcceptSuggestion(l);
+    }
+}
+
+/* Move cursor to the start of the line. */
+void linenoiseEditMoveHome(struct linenoiseState *l) {
+    size_t start = lineStart(l,l->lbefore);
+
+    if (l->pos != start) {
+        size_t oldpos = l->pos;
+
+        lineMoveGap(l,start);
+        refreshCursor(l,oldpos);
+    }
+}
+
+/* Move cursor to the end of the line. When already there accept the
+ * suggestion, if any. */
+void linenoiseEditMoveEnd(struct linenoiseState *l) {
+    size_t end = lineEnd(l,l->lbefore);
+
+    if (l->pos != end) {
+        size_t oldpos = l->pos;
+
+        lineMoveGap(l,end);
+        refreshCursor(l,oldpos);
+    } else {
+        linenoiseEditAcceptSuggestion(l);
+    }
+}
+
+/* Move the cursor to the line 'i', as close as possible to the column
+ * 'col' of the terminal. */
+static void linenoiseEditMoveToLine(struct linenoiseState *l, size_t i,
+                                    size_t col)
+{
+    size_t start = lineStart(l,i), end = lineEnd(l,i);
+    size_t indent = i == 0 ? l->pcols : 0;
+    const char *text = i < l->lbefore ? l->buf+start :
+                                        lineTail(l)+(start-l->pos);
+
+    col = col > indent ? col-indent : 0;
+    lineMoveGap(l,start+linenoiseUtf8Fit(text,end-start,col,NULL));
+    refreshLine(l);
+}
+
+/* Return the column of the terminal the cursor is at, in its line. */
+static size_t linenoiseEditColumn(struct linenoiseState *l) {
+    size_t start = lineStart(l,l->lbefore);
+
+    return (l->lbefore == 0 ? l->pcols : 0)+
+           linenoiseUtf8Width(l->buf+start,l->pos-start);
+}
+
+/* Move the cursor to the line above. Returns 0 if it is on the first line
+ * already. */
+int linenoiseEditMoveUp(struct linenoiseState *l) {
+    if (l->lbefore == 0) return 0;
+    linenoiseEditMoveToLine(l,l->lbefore-1,linenoiseEditColumn(l));
+    return 1;
+}
+
+/* Move the cursor to the line below. Returns 0 if it is on the last line
+ * already. */
+int linenoiseEditMoveDown(struct linenoiseState *l) {
+    if (l->lafter == 0) return 0;
+    linenoiseEditMoveToLine(l,l->lbefore+1,linenoiseEditColumn(l));
+    return 1;
+}
+
+/* Keep the changes made to the line before another history entry replaces
+ * it: the typed line is kept aside, while a recalled entry is changed in
+ * the history if another thread didn't remove it meanwhile. Called with
+ * history_lock held for writing. Returns -1 on out of memory. */
+static int historySaveEdit(struct linenoiseState *l) {
+    linenoiseEditor *e = l->e;
+    unsigned long newest = e->history_base+e->history_len;
+
+    if (l->history_seq == 0) {
+        char *scratch = realloc(e->scratch,l->len+1);
+
+        if (scratch == NULL) return -1;
+        memcpy(scratch,l->buf,l->pos);
+        memcpy(scratch+l->pos,lineTail(l),l->len-l->pos);
+        scratch[l->len] = '\0';
+        e->scratch = scratch;
+    } else if (l->history_seq > e->history_base && l->history_seq <= newest) {
+        int pos = l->history_seq-1-e->history_base;
+        const char *buf = lineString(l);
+
+        if (strcmp(historyLine(e,pos),buf)) {
+            char *copy = strdup(buf);
+            if (copy) {
+                historyIndexRemove(e,pos);
+                free(historyLine(e,pos));
+                e->history[historySlot(e,pos)] = copy;
+                historyIndexInsert(e,pos);
+                e->history_gen++;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Show the history entry with sequence number 'seq', or the typed line
+ * when 0, the cursor at 'pos' if the entry is long enough. Called with
+ * history_lock held for writing, which is released. */
+static void historyShow(struct linenoiseState *l, unsigned long seq,
+                        size_t pos)
+{
+    linenoiseEditor *e = l->e;
+    const char *line;
+
+    if (historySaveEdit(l) == -1) goto done;
+    line = seq ? historyLineBySeq(e,seq) : e->scratch;
+    if (lineSet(l,line,strlen(line)) == -1) goto done;
+    if (pos < l->len) lineMoveGap(l,pos);
+    l->history_seq = seq;
+    pthread_rwlock_unlock(&e->history_lock);
+    refreshLine(l);
+    return;
+
+done:
+    pthread_rwlock_unlock(&e->history_lock);
+}
+
+/* Substitute the currently edited line with the next or previous history
+ * entry as specified by 'dir'. */
+#define LINENOISE_HISTORY_NEXT 0
+#define LINENOISE_HISTORY_PREV 1
+void linenoiseEditHistoryNext(struct linenoiseState *l, int dir) {
+    linenoiseEditor *e = l->e;
+    unsigned long newest, seq;
+
+    pthread_rwlock_wrlock(&e->history_lock);
+    newest = e->history_base+e->history_len;
+    if (e->history_len == 0) goto done;
+
+    /* Find the entry to show: entries are numbered by age, the typed line
+     * has number 0 and follows the newest entry. */
+    if (dir == LINENOISE_HISTORY_PREV) {
+        if (l->history_seq == 0 || l->history_seq > newest) seq = newest;
+        else if (l->history_seq > e->history_base+1) seq = l->history_seq-1;
+        else goto done;
+    } else {
+        if (l->history_seq == 0) goto done;
+        seq = l->history_seq+1;
+        if (seq <= e->history_base) seq = e->history_base+1;
+        if (seq > newest) seq = 0;
+    }
+    historyShow(l,seq,SIZE_MAX);
+    return;
+
+done:
+    pthread_rwlock_unlock(&e->history_lock);
+}
+
+/* Show the next entry, in the direction 'dir', starting with the text
+ * before the cursor and different from the line, leaving the cursor where
+ * it is. Searching forward past the newest entry gets back to the typed
+ * line. The entries are scanned in order, which is fine for a key press. */
+void linenoiseEditHistorySearch(struct linenoiseState *l, int dir) {
+    linenoiseEditor *e = l->e;
+    unsigned long newest, seq;
+    const char *line;
+
+    pthread_rwlock_wrlock(&e->history_lock);
+    newest = e->history_base+e->history_len;
+    seq = l->history_seq;
+    if (seq == 0 || seq > newest) seq = newest+1;
+    else if (seq <= e->history_base) seq = e->history_base;
+    line = lineString(l);
+    while (1) {
+        const char *entry;
+
+        if (dir == LINENOISE_HISTORY_PREV) {
+            if (seq <= e->history_base+1) goto done;
+            seq--;
+        } else {
+            if (++seq > newest) break;
+        }
+        entry = historyLineBySeq(e,seq);
+        if (strncmp(entry,l->buf,l->pos) == 0 && strcmp(entry,line) != 0)
+            break;
+    }
+    if (seq > newest) {
+        if (l->history_seq == 0) goto done;
+        seq = 0;
+    }
+    historyShow(l,seq,seq ? l->pos : SIZE_MAX);
+    return;
+
+done:
+    pthread_rwlock_unlock(&e->history_lock);
+}
+
+/* Delete the character at the right of the cursor without altering the cursor
+ * position. Basically this is what happens with the "Delete" keyboard key. */
+void linenoiseEditDelete(struct linenoiseState *l) {
+    if (l->len > 0 && l->pos < l->len) {
+        size_t n = linenoiseUtf8NextLen(lineTail(l),0,l->len-l->pos);
+        size_t width = linenoiseUtf8Width(lineTail(l),n);
+        int inplace = width && linePlainAt(l,l->pos+n) && refreshInPlace(l,0);
+
+        /* The gap just grows over the deleted bytes. */
+        lineDeleteAfter(l,n);
+        if (inplace)
+            refreshDelete(l,width);
+        else
+            refreshLine(l);
+    }
+}
+
+/* Backspace implementation. */
+void linenoiseEditBackspace(struct linenoiseState *l) {
+    if (l->pos > 0 && l->len > 0) {
+        size_t n = linenoiseUtf8PrevLen(l->buf,l->pos);
+        size_t width = linenoiseUtf8Width(l->buf+l->pos-n,n);
+        int inplace = width && linePlainAt(l,l->pos) && refreshInPlace(l,0);
+
+        lineDeleteBefore(l,n);
+        if (inplace) {
+            abMoveCursor(&l->e->out,-(long)width);
+            refreshDelete(l,width);
+        } else {
+            refreshLine(l);
+        }
+    }
+}
+
+/* Swap the character before the cursor with the one under it, then move
+ * the cursor forward unless it reached the last character. */
+void linenoiseEditTranspose(struct linenoiseState *l) {
+    char tmp[64];
+    size_t a, b, mid;
+
+    if (l->pos == 0 || l->pos >= l->len) return;
+    a = linenoiseUtf8PrevLen(l->buf,l->pos);
+    b = linenoiseUtf8NextLen(lineTail(l),0,l->len-l->pos);
+    if (a > sizeof(tmp)) return;
+    /* Take the character before the cursor out of the line, then put it
+     * back after the other one. */
+    memcpy(tmp,l->buf+l->pos-a,a);
+    lineDeleteBefore(l,a);
+    mid = l->pos+b;
+    lineMoveGap(l,mid);
+    lineInsert(l,tmp,a); /* Can't fail, there was room for 'a' bytes. */
+    /* At the end the cursor stays between the two characters. */
+    if (l->pos == l->len) lineMoveGap(l,mid);
+    refreshLine(l);
+}
+
+/* Save the 'n' bytes of the line starting at 'pos' in the kill buffer of
+ * the editor, for linenoiseEditYank(). */
+static void lineKill(struct linenoiseState *l, size_t pos, size_t n) {
+    linenoiseEditor *e = l->e;
+    size_t before = pos < l->pos ? l->pos-pos : 0;
+    char *kill;
+
+    if (n == 0) return;
+    if (before > n) before = n;
+    if ((kill = realloc(e->killbuf,n)) == NULL) return;
+    memcpy(kill,l->buf+pos,before);
+    if (n > before)
+        memcpy(kill+before,lineTail(l)+(pos+before-l->pos),n-before);
+    e->killbuf = kill;
+    e->killlen = n;
+}
+
+/* Delete the previosu word, maintaining the cursor at the start of the
+ * current word. */
+void linenoiseEditDeletePrevWord(struct linenoiseState *l) {
+    size_t pos = l->pos;
+
+    while (pos > 0 && l->buf[pos-1] == ' ')
+        pos--;
+    while (pos > 0 && l->buf[pos-1] != ' ')
+        pos--;
+    lineKill(l,pos,l->pos-pos);
+    lineDeleteBefore(l,l->pos-pos);
+    refreshLine(l);
+}
+
+/* Emacs words: letters, digits and multi byte characters. Return the end
+ * of the word after the cursor, and the start of the one before it. */
+static size_t lineWordEnd(struct linenoiseState *l) {
+    size_t pos = l->pos;
+
+    while (pos < l->len && !isWordByte(lineByte(l,pos))) pos++;
+    while (pos < l->len && isWordByte(lineByte(l,pos))) pos++;
+    return pos;
+}
+
+static size_t lineWordStart(struct linenoiseState *l) {
+    size_t pos = l->pos;
+
+    while (pos > 0 && !isWordByte((unsigned char)l->buf[pos-1])) pos--;
+    while (pos > 0 && isWordByte((unsigned char)l->buf[pos-1])) pos--;
+    return pos;
+}
+
+/* Move the cursor to the end of the next word. */
+void linenoiseEditMoveWordRight(struct linenoiseState *l) {
+    size_t pos = lineWordEnd(l);
+
+    if (pos != l->pos) {
+        size_t oldpos = l->pos;
+
+        lineMoveGap(l,pos);
+        refreshCursor(l,oldpos);
+    }
 }
 
-static void abAppend(struct abuf *ab, const char *s, int len) {
-    char *new = realloc(ab->b,ab->len+len);
+/* Move the cursor to the start of the previous word. */
+void linenoiseEditMoveWordLeft(struct linenoiseState *l) {
+    size_t pos = lineWordStart(l);
 
-    if (new == NULL) return;
-    memcpy(new+ab->len,s,len);
-    ab->b = new;
-    ab->len += len;
+    if (pos != l->pos) {
+        size_t oldpos = l->pos;
+
+        lineMoveGap(l,pos);
+        refreshCursor(l,oldpos);
+    }
 }
 
-static void abFree(struct abuf *ab) {
-    free(ab->b);
+/* Kill from the cursor to the end of the next word. */
+void linenoiseEditKillWord(struct linenoiseState *l) {
+    size_t n = lineWordEnd(l)-l->pos;
+
+    if (n) {
+        lineKill(l,l->pos,n);
+        lineDeleteAfter(l,n);
+        refreshLine(l);
+    }
 }
 
-/* Helper of refreshSingleLine() and refreshMultiLine() to show hints
- * to the right of the prompt. */
-void refreshShowHints(struct abuf *ab, struct linenoiseState *l, int plen) {
-    char seq[64];
-    if (hintsCallback && plen+l->len < l->cols) {
-        int color = -1, bold = 0;
-        char *hint = hintsCallback(l->buf,&color,&bold);
-        if (hint) {
-            int hintlen = strlen(hint);
-            int hintmaxlen = l->cols-(plen+l->len);
-            if (hintlen > hintmaxlen) hintlen = hintmaxlen;
-            if (bold == 1 && color == -1) color = 37;
-            if (color != -1 || bold != 0)
-                snprintf(seq,64,"\033[%d;%d;49m",bold,color);
-            else
-                seq[0] = '\0';
-            abAppend(ab,seq,strlen(seq));
-            abAppend(ab,hint,hintlen);
-            if (color != -1 || bold != 0)
-                abAppend(ab,"\033[0m",4);
-            /* Call the function to free the hint returned. */
-            if (freeHintsCallback) freeHintsCallback(hint);
-        }
+/* Kill from the start of the previous word to the cursor. */
+void linenoiseEditBackwardKillWord(struct linenoiseState *l) {
+    size_t n = l->pos-lineWordStart(l);
+
+    if (n) {
+        lineKill(l,l->pos-n,n);
+        lineDeleteBefore(l,n);
+        refreshLine(l);
     }
 }
 
-/* Single line low level line refresh.
- *
- * Rewrite the currently edited line accordingly to the buffer content,
- * cursor position, and number of columns of the terminal. */
-static void refreshSingleLine(struct linenoiseState *l) {
-    char seq[64];
-    size_t plen = strlen(l->prompt);
-    int fd = l->ofd;
-    char *buf = l->buf;
-    size_t len = l->len;
-    size_t pos = l->pos;
-    struct abuf ab;
+/* Insert the text last killed at the cursor. Returns like
+ * linenoiseEditInsert(). */
+int linenoiseEditYank(struct linenoiseState *l) {
+    linenoiseEditor *e = l->e;
 
-    while((plen+pos) >= l->cols) {
-        buf++;
-        len--;
-        pos--;
+    if (e->killlen == 0) return 0;
+    return linenoiseEditInsert(l,e->killbuf,e->killlen);
+}
+
+/* Key actions, see linenoiseEdit(). They are given the key that triggered
+ * them, and return 0 to go on editing, 1 when the line is done, or -1 on
+ * error with errno set. */
+typedef int linenoiseKeyAction(struct linenoiseState *l, int key);
+
+/* Insert the character typed, reading the rest of its bytes. Control
+ * characters and escape sequences that are not bound are ignored. */
+static int actionInsert(struct linenoiseState *l, int key) {
+    char cbuf[4];
+    size_t clen, j;
+
+    if (key >= 0x100 || (key < 0x20 && key != TAB) || key == 0x7f)
+        return 0;
+    cbuf[0] = key;
+    clen = linenoiseUtf8SeqLen(cbuf[0]);
+    for (j = 1; j < clen; j++)
+        if (readByte(l->e,cbuf+j) != 1) break;
+    return linenoiseEditInsert(l,cbuf,j) ? -1 : 0;
+}
+
+static int actionAccept(struct linenoiseState *l, int key) {
+    linenoiseEditor *e = l->e;
+
+    ((void)key);
+    if ((e->mlmode || lineCount(l) > 1) && l->pos != l->len) {
+        lineMoveGap(l,l->len);
+        refreshLine(l);
     }
-    while (plen+len > l->cols) {
-        len--;
+    if (e->hintsCallback || e->autosuggest) {
+        /* Force a refresh without hints to leave the previous
+         * line as the user typed it after a newline. */
+        linenoiseEditorHintsCallback *hc = e->hintsCallback;
+        int as = e->autosuggest;
+        e->hintsCallback = NULL;
+        e->autosuggest = 0;
+        refreshLine(l);
+        e->hintsCallback = hc;
+        e->autosuggest = as;
     }
+    return 1;
+}
 
-    abInit(&ab);
-    /* Cursor to left edge */
-    snprintf(seq,64,"\r");
-    abAppend(&ab,seq,strlen(seq));
-    /* Write the prompt and the current buffer content */
-    abAppend(&ab,l->prompt,strlen(l->prompt));
-    abAppend(&ab,buf,len);
-    /* Show hits if any. */
-    refreshShowHints(&ab,l,plen);
-    /* Erase to right */
-    snprintf(seq,64,"\x1b[0K");
-    abAppend(&ab,seq,strlen(seq));
-    /* Move cursor to original position. */
-    snprintf(seq,64,"\r\x1b[%dC", (int)(pos+plen));
-    abAppend(&ab,seq,strlen(seq));
-    if (write(fd,ab.b,ab.len) == -1) {} /* Can't recover from write error. */
-    abFree(&ab);
+static int actionInterrupt(struct linenoiseState *l, int key) {
+    ((void)l);
+    ((void)key);
+    errno = EAGAIN;
+    return -1;
 }
 
-/* Multi line low level line refresh.
- *
- * Rewrite the currently edited line accordingly to the buffer content,
- * cursor position, and number of columns of the terminal. */
-static void refreshMultiLine(struct linenoiseState *l) {
-    char seq[64];
-    int plen = strlen(l->prompt);
-    int rows = (plen+l->len+l->cols-1)/l->cols; /* rows used by current buf. */
-    int rpos = (plen+l->oldpos+l->cols)/l->cols; /* cursor relative row. */
-    int rpos2; /* rpos after refresh. */
-    int col; /* colum position, zero-based. */
-    int old_rows = l->maxrows;
-    int fd = l->ofd, j;
-    struct abuf ab;
-
-    /* Update maxrows if needed. */
-    if (rows > (int)l->maxrows) l->maxrows = rows;
-
-    /* First step: clear all the lines used before. To do so start by
-     * going to the last row. */
-    abInit(&ab);
-    if (old_rows-rpos > 0) {
-        lndebug("go down %d", old_rows-rpos);
-        snprintf(seq,64,"\x1b[%dB", old_rows-rpos);
-        abAppend(&ab,seq,strlen(seq));
-    }
+/* Remove the char at the right of the cursor, or if the line is empty,
+ * act as end-of-file. */
+static int actionDeleteOrEof(struct linenoiseState *l, int key) {
+    ((void)key);
+    if (l->len == 0) return -1;
+    linenoiseEditDelete(l);
+    return 0;
+}
 
-    /* Now for every row clear it, go up. */
-    for (j = 0; j < old_rows-1; j++) {
-        lndebug("clear+up");
-        snprintf(seq,64,"\r\x1b[0K\x1b[1A");
-        abAppend(&ab,seq,strlen(seq));
-    }
+static int actionDelete(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditDelete(l);
+    return 0;
+}
 
-    /* Clean the top line. */
-    lndebug("clear");
-    snprintf(seq,64,"\r\x1b[0K");
-    abAppend(&ab,seq,strlen(seq));
+static int actionBackspace(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditBackspace(l);
+    return 0;
+}
 
-    /* Write the prompt and the current buffer content */
-    abAppend(&ab,l->prompt,strlen(l->prompt));
-    abAppend(&ab,l->buf,l->len);
+static int actionTranspose(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditTranspose(l);
+    return 0;
+}
 
-    /* Show hits if any. */
-    refreshShowHints(&ab,l,plen);
+static int actionLeft(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditMoveLeft(l);
+    return 0;
+}
 
-    /* If we are at the very end of the screen with our prompt, we need to
-     * emit a newline and move the prompt to the first column. */
-    if (l->pos &&
-        l->pos == l->len &&
-        (l->pos+plen) % l->cols == 0)
-    {
-        lndebug("<newline>");
-        abAppend(&ab,"\n",1);
-        snprintf(seq,64,"\r");
-        abAppend(&ab,seq,strlen(seq));
-        rows++;
-        if (rows > (int)l->maxrows) l->maxrows = rows;
-    }
+static int actionRight(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditMoveRight(l);
+    return 0;
+}
 
-    /* Move cursor to right position. */
-    rpos2 = (plen+l->pos+l->cols)/l->cols; /* current cursor relative row. */
-    lndebug("rpos2 %d", rpos2);
+/* Go to the previous line, or the previous history entry from the first
+ * one. */
+static int actionUp(struct linenoiseState *l, int key) {
+    ((void)key);
+    if (!linenoiseEditMoveUp(l))
+        linenoiseEditHistoryNext(l,LINENOISE_HISTORY_PREV);
+    return 0;
+}
 
-    /* Go up till we reach the expected positon. */
-    if (rows-rpos2 > 0) {
-        lndebug("go-up %d", rows-rpos2);
-        snprintf(seq,64,"\x1b[%dA", rows-rpos2);
-        abAppend(&ab,seq,strlen(seq));
-    }
+static int actionDown(struct linenoiseState *l, int key) {
+    ((void)key);
+    if (!linenoiseEditMoveDown(l))
+        linenoiseEditHistoryNext(l,LINENOISE_HISTORY_NEXT);
+    return 0;
+}
 
-    /* Set column. */
-    col = (plen+(int)l->pos) % (int)l->cols;
-    lndebug("set col %d", 1+col);
-    if (col)
-        snprintf(seq,64,"\r\x1b[%dC", col);
-    else
-        snprintf(seq,64,"\r");
-    abAppend(&ab,seq,strlen(seq));
+static int actionHome(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditMoveHome(l);
+    return 0;
+}
 
-    lndebug("\n");
-    l->oldpos = l->pos;
+static int actionEnd(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditMoveEnd(l);
+    return 0;
+}
 
-    if (write(fd,ab.b,ab.len) == -1) {} /* Can't recover from write error. */
-    abFree(&ab);
+static int actionNewline(struct linenoiseState *l, int key) {
+    ((void)key);
+    return linenoiseEditInsert(l,"\n",1) ? -1 : 0;
 }
 
-/* Calls the two low level functions refreshSingleLine() or
- * refreshMultiLine() according to the selected mode. */
-static void refreshLine(struct linenoiseState *l) {
-    if (mlmode)
-        refreshMultiLine(l);
-    else
-        refreshSingleLine(l);
+/* Delete the whole line. */
+static int actionKillLine(struct linenoiseState *l, int key) {
+    ((void)key);
+    lineKill(l,0,l->len);
+    lineSet(l,"",0);
+    refreshLine(l);
+    return 0;
 }
 
-/* Insert the character 'c' at cursor current position.
- *
- * On error writing to the terminal -1 is returned, otherwise 0. */
-int linenoiseEditInsert(struct linenoiseState *l, char c) {
-    if (l->len < l->buflen) {
-        if (l->len == l->pos) {
-            l->buf[l->pos] = c;
-            l->pos++;
-            l->len++;
-            l->buf[l->len] = '\0';
-            if ((!mlmode && l->plen+l->len < l->cols && !hintsCallback)) {
-                /* Avoid a full update of the line in the
-                 * trivial case. */
-                if (write(l->ofd,&c,1) == -1) return -1;
-            } else {
-                refreshLine(l);
-            }
-        } else {
-            memmove(l->buf+l->pos+1,l->buf+l->pos,l->len-l->pos);
-            l->buf[l->pos] = c;
-            l->len++;
-            l->pos++;
-            l->buf[l->len] = '\0';
-            refreshLine(l);
-        }
-    }
+/* Delete from the cursor to the end of the line, or join the next line
+ * when already there. */
+static int actionKillToEnd(struct linenoiseState *l, int key) {
+    size_t n = lineEnd(l,l->lbefore)-l->pos;
+
+    ((void)key);
+    if (n == 0 && l->pos < l->len) n = 1;
+    lineKill(l,l->pos,n);
+    lineDeleteAfter(l,n);
+    refreshLine(l);
     return 0;
 }
 
-/* Move cursor on the left. */
-void linenoiseEditMoveLeft(struct linenoiseState *l) {
-    if (l->pos > 0) {
-        l->pos--;
-        refreshLine(l);
-    }
+static int actionClearScreen(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditorClearScreen(l->e);
+    l->promptshown = 0;
+    refreshLine(l);
+    return 0;
 }
 
-/* Move cursor on the right. */
-void linenoiseEditMoveRight(struct linenoiseState *l) {
-    if (l->pos != l->len) {
-        l->pos++;
-        refreshLine(l);
-    }
+static int actionDeletePrevWord(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditDeletePrevWord(l);
+    return 0;
 }
 
-/* Move cursor to the start of the line. */
-void linenoiseEditMoveHome(struct linenoiseState *l) {
-    if (l->pos != 0) {
-        l->pos = 0;
-        refreshLine(l);
-    }
+static int actionWordLeft(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditMoveWordLeft(l);
+    return 0;
 }
 
-/* Move cursor to the end of the line. */
-void linenoiseEditMoveEnd(struct linenoiseState *l) {
-    if (l->pos != l->len) {
-        l->pos = l->len;
-        refreshLine(l);
-    }
+static int actionWordRight(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditMoveWordRight(l);
+    return 0;
 }
 
-/* Substitute the currently edited line with the next or previous history
- * entry as specified by 'dir'. */
-#define LINENOISE_HISTORY_NEXT 0
-#define LINENOISE_HISTORY_PREV 1
-void linenoiseEditHistoryNext(struct linenoiseState *l, int dir) {
-    if (history_len > 1) {
-        /* Update the current history entry before to
-         * overwrite it with the next one. */
-        free(history[history_len - 1 - l->history_index]);
-        history[history_len - 1 - l->history_index] = strdup(l->buf);
-        /* Show the new entry */
-        l->history_index += (dir == LINENOISE_HISTORY_PREV) ? 1 : -1;
-        if (l->history_index < 0) {
-            l->history_index = 0;
-            return;
-        } else if (l->history_index >= history_len) {
-            l->history_index = history_len-1;
-            return;
+static int actionKillWord(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditKillWord(l);
+    return 0;
+}
+
+static int actionBackwardKillWord(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditBackwardKillWord(l);
+    return 0;
+}
+
+static int actionYank(struct linenoiseState *l, int key) {
+    ((void)key);
+    return linenoiseEditYank(l) ? -1 : 0;
+}
+
+static int actionPrevHistory(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditHistoryNext(l,LINENOISE_HISTORY_PREV);
+    return 0;
+}
+
+static int actionNextHistory(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditHistoryNext(l,LINENOISE_HISTORY_NEXT);
+    return 0;
+}
+
+static int actionHistorySearchBackward(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditHistorySearch(l,LINENOISE_HISTORY_PREV);
+    return 0;
+}
+
+static int actionHistorySearchForward(struct linenoiseState *l, int key) {
+    ((void)key);
+    linenoiseEditHistorySearch(l,LINENOISE_HISTORY_NEXT);
+    return 0;
+}
+
+static int keyDispatch(struct linenoiseState *l, int key);
+
+/* Complete the line when there is a completion callback, otherwise insert
+ * the key. The key ending the completion is handled next. */
+static int actionComplete(struct linenoiseState *l, int key) {
+    int next;
+
+    if (l->e->completionCallback == NULL) return actionInsert(l,key);
+    next = completeLine(l);
+    if (next < 0) return 1; /* Return on errors */
+    if (next == 0) return 0;
+    return keyDispatch(l,next);
+}
+
+/* The built-in actions by name, sorted, for linenoiseEditorBindKey(). */
+static const struct keyActionName {
+    const char *name;
+    linenoiseKeyAction *action;
+} keyActionNames[] = {
+    {"accept_line", actionAccept},
+    {"backward_char", actionLeft},
+    {"backward_delete_char", actionBackspace},
+    {"backward_kill_word", actionBackwardKillWord},
+    {"backward_word", actionWordLeft},
+    {"beginning_of_line", actionHome},
+    {"clear_screen", actionClearScreen},
+    {"complete", actionComplete},
+    {"delete_char", actionDelete},
+    {"delete_char_or_eof", actionDeleteOrEof},
+    {"end_of_line", actionEnd},
+    {"forward_char", actionRight},
+    {"forward_word", actionWordRight},
+    {"history_search_backward", actionHistorySearchBackward},
+    {"history_search_forward", actionHistorySearchForward},
+    {"insert_newline", actionNewline},
+    {"interrupt", actionInterrupt},
+    {"kill_line", actionKillToEnd},
+    {"kill_whole_line", actionKillLine},
+    {"kill_word", actionKillWord},
+    {"next_history", actionNextHistory},
+    {"next_line", actionDown},
+    {"previous_history", actionPrevHistory},
+    {"previous_line", actionUp},
+    {"self_insert", actionInsert},
+    {"transpose_chars", actionTranspose},
+    {"unix_word_rubout", actionDeletePrevWord},
+    {"yank", actionYank}
+};
+
+static int keyActionNameCompare(const void *key, const void *elem) {
+    return strcmp(key,((const struct keyActionName *)elem)->name);
+}
+
+static linenoiseKeyAction *keyActionByName(const char *name) {
+    const struct keyActionName *a;
+
+    a = bsearch(name,keyActionNames,
+                sizeof(keyActionNames)/sizeof(keyActionNames[0]),
+                sizeof(keyActionNames[0]),keyActionNameCompare);
+    return a ? a->action : NULL;
+}
+
+/* Return 1 if 'name' is the name of a built-in action. */
+int linenoiseKeyActionExists(const char *name) {
+    return keyActionByName(name) != NULL;
+}
+
+/* A key bound to an action, or to a callback of the program. */
+struct keyBinding {
+    int key;
+    linenoiseKeyAction *action;
+    linenoiseEditorKeyCallback *callback; /* Called instead of 'action'. */
+    void *data;
+};
+
+/* The keys bound by default, sorted by key. Other keys are inserted. An
+ * editor copies them to its own table when a key is bound. */
+static const struct keyBinding keyBindings[] = {
+    {CTRL_A, actionHome},
+    {CTRL_B, actionLeft},
+    {CTRL_C, actionInterrupt},
+    {CTRL_D, actionDeleteOrEof},
+    {CTRL_E, actionEnd},
+    {CTRL_F, actionRight},
+    {CTRL_H, actionBackspace},
+    {TAB, actionComplete},
+    {CTRL_J, actionNewline},
+    {CTRL_K, actionKillToEnd},
+    {CTRL_L, actionClearScreen},
+    {ENTER, actionAccept},
+    {CTRL_N, actionDown},
+    {CTRL_P, actionUp},
+    {CTRL_T, actionTranspose},
+    {CTRL_U, actionKillLine},
+    {CTRL_W, actionDeletePrevWord},
+    {CTRL_Y, actionYank},
+    {BACKSPACE, actionBackspace},
+    {KEY_UP, actionUp},
+    {KEY_DOWN, actionDown},
+    {KEY_RIGHT, actionRight},
+    {KEY_LEFT, actionLeft},
+    {KEY_HOME, actionHome},
+    {KEY_END, actionEnd},
+    {KEY_DELETE, actionDelete},
+    {KEY_PAGE_UP, actionHistorySearchBackward},
+    {KEY_PAGE_DOWN, actionHistorySearchForward},
+    {KEY_ALT|ENTER, actionNewline},
+    {KEY_ALT|'b', actionWordLeft},
+    {KEY_ALT|'d', actionKillWord},
+    {KEY_ALT|'f', actionWordRight},
+    {KEY_ALT|BACKSPACE, actionBackwardKillWord},
+    {KEY_ALT|KEY_RIGHT, actionWordRight},
+    {KEY_ALT|KEY_LEFT, actionWordLeft},
+    {KEY_CTRL|KEY_RIGHT, actionWordRight},
+    {KEY_CTRL|KEY_LEFT, actionWordLeft}
+};
+
+static int keyBindingCompare(const void *key, const void *elem) {
+    int k = *(const int *)key;
+    const struct keyBinding *b = elem;
+
+    return k < b->key ? -1 : k > b->key;
+}
+
+/* Return the binding of 'key', or NULL if it is not bound. */
+static const struct keyBinding *keyBinding(linenoiseEditor *e, int key) {
+    if (e->bindings == NULL)
+        return bsearch(&key,keyBindings,
+                       sizeof(keyBindings)/sizeof(keyBindings[0]),
+                       sizeof(keyBindings[0]),keyBindingCompare);
+    return bsearch(&key,e->bindings,e->nbindings,sizeof(e->bindings[0]),
+                   keyBindingCompare);
+}
+
+/* Replace the binding of nb->key in the table of the editor, or remove it
+ * when it has neither an action nor a callback. Returns -1 on out of
+ * memory. */
+static int keyBind(linenoiseEditor *e, const struct keyBinding *nb) {
+    struct keyBinding *b;
+    size_t i;
+
+    if (e->bindings == NULL) {
+        if ((e->bindings = malloc(sizeof(keyBindings))) == NULL) return -1;
+        memcpy(e->bindings,keyBindings,sizeof(keyBindings));
+        e->nbindings = sizeof(keyBindings)/sizeof(keyBindings[0]);
+    }
+    for (i = 0; i < e->nbindings && e->bindings[i].key < nb->key; i++);
+    if (i < e->nbindings && e->bindings[i].key == nb->key) {
+        if (nb->action || nb->callback) {
+            e->bindings[i] = *nb;
+        } else {
+            memmove(e->bindings+i,e->bindings+i+1,
+                    (e->nbindings-i-1)*sizeof(*b));
+            e->nbindings--;
         }
-        strncpy(l->buf,history[history_len - 1 - l->history_index],l->buflen);
-        l->buf[l->buflen-1] = '\0';
-        l->len = l->pos = strlen(l->buf);
-        refreshLine(l);
+        return 0;
     }
+    if (!nb->action && !nb->callback) return 0;
+    b = realloc(e->bindings,(e->nbindings+1)*sizeof(*b));
+    if (b == NULL) return -1;
+    memmove(b+i+1,b+i,(e->nbindings-i)*sizeof(*b));
+    b[i] = *nb;
+    e->bindings = b;
+    e->nbindings++;
+    return 0;
 }
 
-/* Delete the character at the right of the cursor without altering the cursor
- * position. Basically this is what happens with the "Delete" keyboard key. */
-void linenoiseEditDelete(struct linenoiseState *l) {
-    if (l->len > 0 && l->pos < l->len) {
-        memmove(l->buf+l->pos,l->buf+l->pos+1,l->len-l->pos-1);
-        l->len--;
-        l->buf[l->len] = '\0';
-        refreshLine(l);
+/* Return the code of the key the terminal sends as the 'len' bytes of
+ * 'seq', for linenoiseEditorBindKey(), or -1 if they are not exactly one
+ * key, or a character of more than one byte. */
+int linenoiseKeyCode(const char *seq, size_t len) {
+    struct keyDecoder d;
+    int key = -1;
+    size_t i;
+
+    keyInit(&d);
+    for (i = 0; i < len; i++) {
+        if (key != -1) return -1;
+        key = keyFeed(&d,(unsigned char)seq[i]);
     }
+    if (key == -1 && len) key = keyTimeout(&d);
+    if (key == KEY_UNKNOWN || (key >= 0x80 && key < 0x100)) return -1;
+    return key;
 }
 
-/* Backspace implementation. */
-void linenoiseEditBackspace(struct linenoiseState *l) {
-    if (l->pos > 0 && l->len > 0) {
-        memmove(l->buf+l->pos-1,l->buf+l->pos,l->len-l->pos);
-        l->pos--;
-        l->len--;
-        l->buf[l->len] = '\0';
+/* Bind 'key', as returned by linenoiseKeyCode(), to the built-in action
+ * named 'action', or remove its binding when NULL, so that it is inserted
+ * if it is a character and ignored otherwise. Keys must not be bound while
+ * the editor reads a line. Returns -1 with errno set to EINVAL if there is
+ * no such action, or ENOMEM. */
+int linenoiseEditorBindKey(linenoiseEditor *e, int key, const char *action) {
+    struct keyBinding b = {key, NULL, NULL, NULL};
+
+    if (action && (b.action = keyActionByName(action)) == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    return keyBind(e,&b);
+}
+
+/* Bind 'key' to 'fn', called with 'data' when the key is pressed. */
+int linenoiseEditorBindKeyCallback(linenoiseEditor *e, int key,
+                                   linenoiseEditorKeyCallback *fn,
+                                   void *data)
+{
+    struct keyBinding b = {key, NULL, fn, data};
+
+    return keyBind(e,&b);
+}
+
+/* Call the callback bound to 'key', apply the changes it made to the line
+ * and the cursor, then run the action it asked for, if any. */
+static int keyCallback(struct linenoiseState *l, const struct keyBinding *b,
+                       int key)
+{
+    linenoiseKeyEvent ev;
+    linenoiseKeyAction *action = NULL;
+
+    memset(&ev,0,sizeof(ev));
+    ev.key = key;
+    ev.line = lineString(l);
+    ev.len = l->len;
+    ev.pos = l->pos;
+    b->callback(l->e,b->data,&ev);
+    if (ev.action) action = keyActionByName(ev.action);
+    if (ev.replace) {
+        int ret = lineSet(l,ev.replace,ev.replacelen);
+
+        free(ev.replace);
+        if (ret == -1) return -1;
+    }
+    if (ev.pos > l->len) ev.pos = l->len;
+    if (ev.replace || ev.pos != l->pos) {
+        lineMoveGap(l,ev.pos);
         refreshLine(l);
     }
+    return action ? action(l,key) : 0;
 }
 
-/* Delete the previosu word, maintaining the cursor at the start of the
- * current word. */
-void linenoiseEditDeletePrevWord(struct linenoiseState *l) {
-    size_t old_pos = l->pos;
-    size_t diff;
-
-    while (l->pos > 0 && l->buf[l->pos-1] == ' ')
-        l->pos--;
-    while (l->pos > 0 && l->buf[l->pos-1] != ' ')
-        l->pos--;
-    diff = old_pos - l->pos;
-    memmove(l->buf+l->pos,l->buf+old_pos,l->len-old_pos+1);
-    l->len -= diff;
-    refreshLine(l);
+/* Run the action bound to 'key'. */
+static int keyDispatch(struct linenoiseState *l, int key) {
+    const struct keyBinding *b = keyBinding(l->e,key);
+
+    if (b == NULL) return actionInsert(l,key);
+    if (b->callback) return keyCallback(l,b,key);
+    return b->action(l,key);
 }
 
 /* This function is the core of the line editing capability of linenoise.
  * It expects 'fd' to be already in "raw mode" so that every key pressed
  * will be returned ASAP to read().
  *
- * The resulting string is put into 'buf' when the user type enter, or
- * when ctrl+d is typed.
+ * The resulting string is put into e->buf, grown as needed, when the user
+ * type enter, or when ctrl+d is typed.
  *
  * The function returns the length of the current buffer. */
-static int linenoiseEdit(int stdin_fd, int stdout_fd, char *buf, size_t buflen, const char *prompt)
+static int linenoiseEdit(linenoiseEditor *e, const char *prompt)
 {
     struct linenoiseState l;
 
     /* Populate the linenoise state that we pass to functions implementing
      * specific editing functionalities. */
-    l.ifd = stdin_fd;
-    l.ofd = stdout_fd;
-    l.buf = buf;
-    l.buflen = buflen;
+    l.e = e;
+    l.ifd = e->ifd;
+    l.ofd = e->ofd;
+    l.buf = e->buf;
+    l.buflen = e->buflen;
     l.prompt = prompt;
     l.plen = strlen(prompt);
-    l.oldpos = l.pos = 0;
+    l.pcols = linenoiseUtf8Width(prompt,l.plen);
+    l.pos = 0;
     l.len = 0;
-    l.cols = getColumns(stdin_fd, stdout_fd);
-    l.maxrows = 0;
-    l.history_index = 0;
+    l.cols = getColumns(e);
+    e->stats_key_start = 0; /* The answer of the terminal is not a key. */
+    e->stats_key_bytes = 0;
+    recordStart(e,l.cols,prompt);
+    l.lines = e->lines;
+    l.lcap = e->linescap;
+    l.lbefore = l.lafter = 0;
+    l.topline = 0;
+    l.toprow = 0;
+    l.oldrows = 0;
+    l.oldcrow = 0;
+    l.history_seq = 0;
+    l.suggested = 0;
+    l.promptshown = 1;
+    l.hoff = 0;
+    highlightReset(&l);
 
     /* Buffer starts empty. */
     l.buf[0] = '\0';
-    l.buflen--; /* Make sure there is always space for the nulterm */
 
-    /* The latest history entry is always our current buffer, that
-     * initially is just an empty string. */
-    linenoiseHistoryAdd("");
-
-    if (write(l.ofd,prompt,l.plen) == -1) return -1;
+    if (writeOut(e,prompt,l.plen) == -1) return -1;
     while(1) {
-        char c;
-        int nread;
-        char seq[3];
-
-        nread = read(l.ifd,&c,1);
-        if (nread <= 0) return l.len;
-
-        /* Only autocomplete when the callback is set. It returns < 0 when
-         * there was an error reading from fd. Otherwise it will return the
-         * character that should be handled next. */
-        if (c == 9 && completionCallback != NULL) {
-            c = completeLine(&l);
-            /* Return on errors */
-            if (c < 0) return l.len;
-            /* Read next character when 0 */
-            if (c == 0) continue;
-        }
+        int key, nread, ret;
 
-        switch(c) {
-        case ENTER:    /* enter */
-            history_len--;
-            free(history[history_len]);
-            if (mlmode) linenoiseEditMoveEnd(&l);
-            if (hintsCallback) {
-                /* Force a refresh without hints to leave the previous
-                 * line as the user typed it after a newline. */
-                linenoiseHintsCallback *hc = hintsCallback;
-                hintsCallback = NULL;
-                refreshLine(&l);
-                hintsCallback = hc;
-            }
-            return (int)l.len;
-        case CTRL_C:     /* ctrl-c */
-            errno = EAGAIN;
-            return -1;
-        case BACKSPACE:   /* backspace */
-        case 8:     /* ctrl-h */
-            linenoiseEditBackspace(&l);
-            break;
-        case CTRL_D:     /* ctrl-d, remove char at right of cursor, or if the
-                            line is empty, act as end-of-file. */
-            if (l.len > 0) {
-                linenoiseEditDelete(&l);
-            } else {
-                history_len--;
-                free(history[history_len]);
-                return -1;
-            }
-            break;
-        case CTRL_T:    /* ctrl-t, swaps current character with previous. */
-            if (l.pos > 0 && l.pos < l.len) {
-                int aux = buf[l.pos-1];
-                buf[l.pos-1] = buf[l.pos];
-                buf[l.pos] = aux;
-                if (l.pos != l.len-1) l.pos++;
-                refreshLine(&l);
-            }
-            break;
-        case CTRL_B:     /* ctrl-b */
-            linenoiseEditMoveLeft(&l);
-            break;
-        case CTRL_F:     /* ctrl-f */
-            linenoiseEditMoveRight(&l);
-            break;
-        case CTRL_P:    /* ctrl-p */
-            linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_PREV);
-            break;
-        case CTRL_N:    /* ctrl-n */
-            linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_NEXT);
-            break;
-        case ESC:    /* escape sequence */
-            /* Read the next two bytes representing the escape sequence.
-             * Use two calls to handle slow terminals returning the two
-             * chars at different times. */
-            if (read(l.ifd,seq,1) == -1) break;
-            if (read(l.ifd,seq+1,1) == -1) break;
-
-            /* ESC [ sequences. */
-            if (seq[0] == '[') {
-                if (seq[1] >= '0' && seq[1] <= '9') {
-                    /* Extended escape, read additional byte. */
-                    if (read(l.ifd,seq+2,1) == -1) break;
-                    if (seq[2] == '~') {
-                        switch(seq[1]) {
-                        case '3': /* Delete key. */
-                            linenoiseEditDelete(&l);
-                            break;
-                        }
-                    }
-                } else {
-                    switch(seq[1]) {
-                    case 'A': /* Up */
-                        linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_PREV);
-                        break;
-                    case 'B': /* Down */
-                        linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_NEXT);
-                        break;
-                    case 'C': /* Right */
-                        linenoiseEditMoveRight(&l);
-                        break;
-                    case 'D': /* Left */
-                        linenoiseEditMoveLeft(&l);
-                        break;
-                    case 'H': /* Home */
-                        linenoiseEditMoveHome(&l);
-                        break;
-                    case 'F': /* End*/
-                        linenoiseEditMoveEnd(&l);
-                        break;
-                    }
-                }
-            }
+        nread = readKey(e,&key);
+        if (nread == -1 && errno == ECANCELED) return -1;
+        if (nread <= 0) return lineFinish(&l);
 
-            /* ESC O sequences. */
-            else if (seq[0] == 'O') {
-                switch(seq[1]) {
-                case 'H': /* Home */
-                    linenoiseEditMoveHome(&l);
-                    break;
-                case 'F': /* End*/
-                    linenoiseEditMoveEnd(&l);
-                    break;
-                }
-            }
-            break;
-        default:
-            if (linenoiseEditInsert(&l,c)) return -1;
-            break;
-        case CTRL_U: /* Ctrl+u, delete the whole line. */
-            buf[0] = '\0';
-            l.pos = l.len = 0;
-            refreshLine(&l);
-            break;
-        case CTRL_K: /* Ctrl+k, delete from current to end of line. */
-            buf[l.pos] = '\0';
-            l.len = l.pos;
-            refreshLine(&l);
-            break;
-        case CTRL_A: /* Ctrl+a, go to the start of the line */
-            linenoiseEditMoveHome(&l);
-            break;
-        case CTRL_E: /* ctrl+e, go to the end of the line */
-            linenoiseEditMoveEnd(&l);
-            break;
-        case CTRL_L: /* ctrl+l, clear screen */
-            linenoiseClearScreen();
-            refreshLine(&l);
-            break;
-        case CTRL_W: /* ctrl+w, delete previous word */
-            linenoiseEditDeletePrevWord(&l);
-            break;
+        /* Telnet clients send Enter as CR LF or CR NUL: the byte after
+         * the CR that accepted the previous line is part of it. */
+        if (e->crpending) {
+            e->crpending = 0;
+            if (key == CTRL_J || key == 0) continue;
         }
+        ret = keyDispatch(&l,key);
+        if (ret == 1) {
+            e->crpending = e->rawinput && key == ENTER;
+            return lineFinish(&l);
+        }
+        if (ret == -1) return -1;
     }
-    return l.len;
+    return lineFinish(&l);
 }
 
 /* This special mode is used by linenoise in order to print scan codes
@@ -959,7 +3652,7 @@ void linenoisePrintKeyCodes(void) {
 
     printf("Linenoise key codes debugging mode.\n"
             "Press keys to see scan codes. Type 'quit' at any time to exit.\n");
-    if (enableRawMode(STDIN_FILENO) == -1) return;
+    if (enableRawMode(&default_editor) == -1) return;
     memset(quit,' ',4);
     while(1) {
         char c;
@@ -976,32 +3669,64 @@ void linenoisePrintKeyCodes(void) {
         printf("\r"); /* Go left edge manually, we are in raw mode. */
         fflush(stdout);
     }
-    disableRawMode(STDIN_FILENO);
+    disableRawMode(&default_editor);
 }
 
 /* This function calls the line editing function linenoiseEdit() using
  * the STDIN file descriptor set in raw mode. */
-static int linenoiseRaw(char *buf, size_t buflen, const char *prompt) {
+static int linenoiseRaw(linenoiseEditor *e, const char *prompt) {
     int count;
 
-    if (buflen == 0) {
-        errno = EINVAL;
-        return -1;
-    }
-
-    if (enableRawMode(STDIN_FILENO) == -1) return -1;
-    count = linenoiseEdit(STDIN_FILENO, STDOUT_FILENO, buf, buflen, prompt);
-    disableRawMode(STDIN_FILENO);
-    printf("\n");
+    if (enableRawMode(e) == -1) return -1;
+    e->stats_editing = 1;
+    e->buffering = 1;
+    count = linenoiseEdit(e, prompt);
+    /* Still in raw mode, so the line feed needs its carriage return. It
+     * goes out with the last refresh of the line. */
+    if (writeOut(e,"\r\n",2) == -1) {} /* Can't recover from write error. */
+    outFlush(e);
+    e->buffering = 0;
+    e->stats_editing = 0;
+    statsKeyDone(e);
+    recordEnd(e,count == -1 ? NULL : e->buf,count);
+    disableRawMode(e);
     return count;
 }
 
+/* Read a byte of a line of input that is not a terminal. Between
+ * linenoiseEditorBeginReadAhead() and linenoiseEditorEndReadAhead() the
+ * input is read ahead in chunks kept for the next lines: the lines of a
+ * file or a pipe take a read() call every LINENOISE_INPUT_BATCH bytes,
+ * rather than a poll() and a read() every byte. */
+static int readLineByte(linenoiseEditor *e, char *c) {
+    ssize_t nread;
+
+    if (e->inpos < e->inlen) {
+        *c = e->inbuf[e->inpos++];
+        return 1;
+    }
+    if (readByte(e,c) != 1) return -1;
+    if (!e->readahead || !inputPending(e)) return 1;
+    if (e->inbuf == NULL &&
+        (e->inbuf = malloc(LINENOISE_INPUT_BATCH)) == NULL) return 1;
+    nread = read(e->ifd,e->inbuf,LINENOISE_INPUT_BATCH);
+    e->inpos = 0;
+    e->inlen = nread > 0 ? nread : 0;
+    statsAdd(e,&e->stats.reads,1);
+    statsAdd(e,&e->stats.bytes_read,e->inlen);
+    return 1;
+}
+
 /* This function is called when linenoise() is called with the standard
  * input file descriptor not attached to a TTY. So for example when the
  * program using linenoise is called in pipe or with a file redirected
  * to its standard input. In this case, we want to be able to return the
- * line regardless of its length (by default we are limited to 4k). */
-static char *linenoiseNoTTY(void) {
+ * line regardless of its length (by default we are limited to 4k).
+ *
+ * The input is read a byte at a time, so that nothing past the line is
+ * consumed and the read can be cancelled, unless the caller asked to read
+ * ahead (see readLineByte()). */
+static char *linenoiseNoTTY(linenoiseEditor *e) {
     char *line = NULL;
     size_t len = 0, maxlen = 0;
 
@@ -1016,7 +3741,8 @@ static char *linenoiseNoTTY(void) {
                 return NULL;
             }
         }
-        int c = fgetc(stdin);
+        char ch;
+        int c = readLineByte(e,&ch) == 1 ? (unsigned char)ch : EOF;
         if (c == EOF || c == '\n') {
             if (c == EOF && len == 0) {
                 free(line);
@@ -1037,31 +3763,76 @@ static char *linenoiseNoTTY(void) {
  * for a blacklist of stupid terminals, and later either calls the line
  * editing function or uses dummy fgets() so that you will be able to type
  * something even in the most desperate of the conditions. */
-char *linenoise(const char *prompt) {
-    char buf[LINENOISE_MAX_LINE];
-    int count;
+char *linenoiseEditorReadLine(linenoiseEditor *e, const char *prompt) {
+    char *line = NULL;
+
+    /* The line buffer and the wake up pipe are kept around for the next
+     * calls. */
+    if (e->buf == NULL) {
+        if ((e->buf = malloc(LINENOISE_MAX_LINE)) == NULL) return NULL;
+        e->buflen = LINENOISE_MAX_LINE;
+    }
+    if (e->wakefd[0] == -1) {
+        int fds[2];
+
+        if (pipe(fds) == -1) return NULL;
+        fcntl(fds[0],F_SETFD,FD_CLOEXEC);
+        fcntl(fds[1],F_SETFD,FD_CLOEXEC);
+        fcntl(fds[0],F_SETFL,O_NONBLOCK);
+        fcntl(fds[1],F_SETFL,O_NONBLOCK);
+        e->wakefd[0] = fds[0];
+        __atomic_store_n(&e->wakefd[1],fds[1],__ATOMIC_SEQ_CST);
+    }
 
-    if (!isatty(STDIN_FILENO)) {
+    if (!isatty(e->ifd) && !e->rawinput) {
         /* Not a tty: read from file / pipe. In this mode we don't want any
          * limit to the line size, so we call a function to handle that. */
-        return linenoiseNoTTY();
-    } else if (isUnsupportedTerm()) {
+        line = linenoiseNoTTY(e);
+    } else if (e->ifd == STDIN_FILENO && isUnsupportedTerm()) {
+        /* TERM only describes the terminal of the process itself. */
         size_t len;
 
         printf("%s",prompt);
         fflush(stdout);
-        if (fgets(buf,LINENOISE_MAX_LINE,stdin) == NULL) return NULL;
-        len = strlen(buf);
-        while(len && (buf[len-1] == '\n' || buf[len-1] == '\r')) {
-            len--;
-            buf[len] = '\0';
-        }
-        return strdup(buf);
-    } else {
-        count = linenoiseRaw(buf,LINENOISE_MAX_LINE,prompt);
-        if (count == -1) return NULL;
-        return strdup(buf);
+        line = linenoiseNoTTY(e);
+        len = line ? strlen(line) : 0;
+        while(len && line[len-1] == '\r') line[--len] = '\0';
+    } else if (linenoiseRaw(e,prompt) != -1) {
+        line = strdup(e->buf);
+    }
+    /* Don't keep the memory of a huge line around. */
+    if (e->buflen > LINENOISE_MAX_LINE) {
+        free(e->buf);
+        e->buf = NULL;
+    }
+    if (e->linescap > LINENOISE_MAX_LINE) {
+        free(e->lines);
+        e->lines = NULL;
+        e->linescap = 0;
     }
+    if (e->highlights.cap > LINENOISE_MAX_LINE) {
+        freeHighlights(&e->highlights);
+        freeHighlights(&e->hlspans);
+    }
+    if (e->out.cap > LINENOISE_OUTPUT_BATCH) abFree(&e->out);
+    free(e->flat);
+    e->flat = NULL;
+    e->flatlen = 0;
+    /* A cancel is only meant for the read in progress. */
+    __atomic_store_n(&e->cancelled,0,__ATOMIC_SEQ_CST);
+    return line;
+}
+
+/* Make the linenoiseEditorReadLine() call in progress, or the next one,
+ * return NULL with errno set to ECANCELED. This is the only function that
+ * may be called while another thread is editing a line with the same
+ * editor, for example from a signal handler or a watchdog thread. */
+void linenoiseEditorCancel(linenoiseEditor *e) {
+    int fd;
+
+    __atomic_store_n(&e->cancelled,1,__ATOMIC_SEQ_CST);
+    fd = __atomic_load_n(&e->wakefd[1],__ATOMIC_SEQ_CST);
+    if (fd != -1 && write(fd,"x",1) == -1) {} /* A full pipe is fine. */
 }
 
 /* This is just a wrapper the user may want to call in order to make sure
@@ -1074,167 +3845,985 @@ void linenoiseFree(void *ptr) {
 
 /* ================================ History ================================= */
 
+/* Return the slot of the history holding the entry 'j', from the oldest. */
+static int historySlot(linenoiseEditor *e, int j) {
+    int slot = e->history_head+j;
+
+    return slot < e->history_max_len ? slot : slot-e->history_max_len;
+}
+
+/* Return the entry 'j' of the history, from the oldest. */
+static char *historyLine(linenoiseEditor *e, int j) {
+    return e->history[historySlot(e,j)];
+}
+
+/* Return the entry with sequence number 'seq', that must be in the
+ * history. */
+static char *historyLineBySeq(linenoiseEditor *e, unsigned long seq) {
+    return historyLine(e,seq-1-e->history_base);
+}
+
 /* Free the history, but does not reset it. Only used when we have to
  * exit() to avoid memory leaks are reported by valgrind & co. */
-static void freeHistory(void) {
-    if (history) {
+static void freeHistory(linenoiseEditor *e) {
+    if (e->history) {
         int j;
 
-        for (j = 0; j < history_len; j++)
-            free(history[j]);
-        free(history);
+        for (j = 0; j < e->history_len; j++)
+            free(historyLine(e,j));
+        free(e->history);
     }
+    free(e->history_nodes);
+    e->history_nodes = NULL;
+    e->history_nodes_len = 0;
+    e->history_root = -1;
 }
 
 // Allocate fresh memory for history and reset history length.
-static void resetHistory(void) {
-    history = malloc(sizeof(char*)*history_max_len);
-    if (history == NULL) return;
-    memset(history, 0, (sizeof(char*)*history_max_len));
-    history_len = 0;
+static void resetHistory(linenoiseEditor *e) {
+    e->history = malloc(sizeof(char*)*e->history_max_len);
+    if (e->history == NULL) return;
+    memset(e->history, 0, (sizeof(char*)*e->history_max_len));
+    e->history_len = 0;
+    e->history_head = 0;
 }
 
-/* At exit we'll try to fix the terminal to the initial conditions. */
-static void linenoiseAtExit(void) {
-    disableRawMode(STDIN_FILENO);
-    freeHistory();
+/* ============================ History index =============================== */
+
+/* A node of the treap indexing the history, see linenoiseEditor. Children
+ * are referenced by slot, -1 for none. */
+struct historyNode {
+    int left, right;
+    unsigned long seq;          /* Sequence number of the entry. */
+    unsigned long max;          /* Max sequence number of the subtree. */
+};
+
+/* Return the priority of the node of the entry 'seq': a hash, so that the
+ * shape of the tree doesn't depend on the order entries are added in. */
+static unsigned int historyNodePriority(unsigned long seq) {
+    return (unsigned int)((seq*0x9e3779b97f4a7c15ULL)>>32);
+}
+
+/* Return true if the node in slot 'a' sorts before the one in slot 'b':
+ * by text, then by age. */
+static int historyNodeBefore(linenoiseEditor *e, int a, int b) {
+    int c = strcmp(e->history[a],e->history[b]);
+
+    return c < 0 || (c == 0 && e->history_nodes[a].seq <
+                               e->history_nodes[b].seq);
+}
+
+/* Recompute the max of the node in slot 'n' from its children. */
+static void historyNodeUpdate(linenoiseEditor *e, int n) {
+    struct historyNode *nodes = e->history_nodes, *node = nodes+n;
+
+    node->max = node->seq;
+    if (node->left != -1 && nodes[node->left].max > node->max)
+        node->max = nodes[node->left].max;
+    if (node->right != -1 && nodes[node->right].max > node->max)
+        node->max = nodes[node->right].max;
+}
+
+/* Make room for the nodes of the first 'need' slots. On error -1 is
+ * returned. */
+static int historyNodesGrow(linenoiseEditor *e, int need) {
+    struct historyNode *nodes;
+    int len = e->history_nodes_len ? e->history_nodes_len : 16;
+
+    if (need <= e->history_nodes_len) return 0;
+    while (len < need) len *= 2;
+    if (len > e->history_max_len) len = e->history_max_len;
+    nodes = realloc(e->history_nodes,sizeof(*nodes)*len);
+    if (nodes == NULL) return -1;
+    e->history_nodes = nodes;
+    e->history_nodes_len = len;
+    return 0;
+}
+
+/* Insert the node in slot 'n' in the subtree rooted in slot 't', and
+ * return the new root of the subtree. */
+static int historyTreeInsert(linenoiseEditor *e, int t, int n) {
+    struct historyNode *nodes = e->history_nodes;
+    int child;
+
+    if (t == -1) return n;
+    if (historyNodeBefore(e,n,t)) {
+        child = nodes[t].left = historyTreeInsert(e,nodes[t].left,n);
+        if (historyNodePriority(nodes[child].seq) >
+            historyNodePriority(nodes[t].seq))
+        {
+            nodes[t].left = nodes[child].right;
+            nodes[child].right = t;
+            historyNodeUpdate(e,t);
+            t = child;
+        }
+    } else {
+        child = nodes[t].right = historyTreeInsert(e,nodes[t].right,n);
+        if (historyNodePriority(nodes[child].seq) >
+            historyNodePriority(nodes[t].seq))
+        {
+            nodes[t].right = nodes[child].left;
+            nodes[child].left = t;
+            historyNodeUpdate(e,t);
+            t = child;
+        }
+    }
+    historyNodeUpdate(e,t);
+    return t;
+}
+
+/* Join the subtrees rooted in slots 'a' and 'b', all the nodes of 'a'
+ * sorting before the ones of 'b', and return the new root. */
+static int historyTreeMerge(linenoiseEditor *e, int a, int b) {
+    struct historyNode *nodes = e->history_nodes;
+
+    if (a == -1) return b;
+    if (b == -1) return a;
+    if (historyNodePriority(nodes[a].seq) > historyNodePriority(nodes[b].seq)) {
+        nodes[a].right = historyTreeMerge(e,nodes[a].right,b);
+        historyNodeUpdate(e,a);
+        return a;
+    }
+    nodes[b].left = historyTreeMerge(e,a,nodes[b].left);
+    historyNodeUpdate(e,b);
+    return b;
+}
+
+/* Remove the node in slot 'n' from the subtree rooted in slot 't', if it
+ * is there, and return the new root of the subtree. */
+static int historyTreeRemove(linenoiseEditor *e, int t, int n) {
+    struct historyNode *nodes = e->history_nodes;
+
+    if (t == -1) return -1;
+    if (t == n) return historyTreeMerge(e,nodes[t].left,nodes[t].right);
+    if (historyNodeBefore(e,n,t))
+        nodes[t].left = historyTreeRemove(e,nodes[t].left,n);
+    else
+        nodes[t].right = historyTreeRemove(e,nodes[t].right,n);
+    historyNodeUpdate(e,t);
+    return t;
+}
+
+/* Compute the max of the subtree rooted in slot 't', after it was built
+ * by historyIndexRebuild(). */
+static void historyTreeUpdateAll(linenoiseEditor *e, int t) {
+    if (t == -1) return;
+    historyTreeUpdateAll(e,e->history_nodes[t].left);
+    historyTreeUpdateAll(e,e->history_nodes[t].right);
+    historyNodeUpdate(e,t);
+}
+
+/* Entry sorted by historyIndexRebuild(). The line is carried along since
+ * qsort() gives the comparison function no way to reach the editor. */
+struct historyIndexEntry {
+    const char *line;
+    unsigned long seq;
+    int slot;
+};
+
+static int historyIndexCompare(const void *a, const void *b) {
+    const struct historyIndexEntry *ea = a, *eb = b;
+    int c = strcmp(ea->line,eb->line);
+
+    if (c) return c;
+    return ea->seq < eb->seq ? -1 : (ea->seq > eb->seq);
+}
+
+/* Rebuild the whole index from scratch. Used after bulk changes such as
+ * loading a file, where sorting once is cheaper than inserting every
+ * entry: the tree is built from the sorted entries in O(n), keeping on a
+ * stack the right spine of the part built so far. */
+static void historyIndexRebuild(linenoiseEditor *e) {
+    int len = e->history_len, depth = 0, j;
+    struct historyIndexEntry *entries;
+    struct historyNode *nodes;
+    int *spine;
+
+    if (historyNodesGrow(e,e->history_head ? e->history_max_len : len) == -1)
+        return;
+    entries = malloc(sizeof(*entries)*(len ? len : 1));
+    spine = malloc(sizeof(int)*(len ? len : 1));
+    if (entries == NULL || spine == NULL) {
+        free(entries);
+        free(spine);
+        return;
+    }
+    for (j = 0; j < len; j++) {
+        entries[j].slot = historySlot(e,j);
+        entries[j].line = e->history[entries[j].slot];
+        entries[j].seq = e->history_base+j+1;
+    }
+    qsort(entries,len,sizeof(*entries),historyIndexCompare);
+    nodes = e->history_nodes;
+    for (j = 0; j < len; j++) {
+        int n = entries[j].slot, last = -1;
+        unsigned int prio = historyNodePriority(entries[j].seq);
+
+        nodes[n].seq = entries[j].seq;
+        nodes[n].right = -1;
+        while (depth && historyNodePriority(nodes[spine[depth-1]].seq) < prio)
+            last = spine[--depth];
+        nodes[n].left = last;
+        if (depth) nodes[spine[depth-1]].right = n;
+        spine[depth++] = n;
+    }
+    e->history_root = len ? spine[0] : -1;
+    historyTreeUpdateAll(e,e->history_root);
+    free(entries);
+    free(spine);
+    e->history_index_dirty = 0;
+}
+
+/* Return 1 if the index should not be updated incrementally. */
+static int historyIndexSkip(linenoiseEditor *e) {
+    if (e->history_index_dirty) return 1;
+    if (++e->history_index_updates > LINENOISE_HISTORY_INDEX_BATCH) {
+        e->history_index_dirty = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/* Add the entry 'j' of the history, from the oldest, to the index. */
+static void historyIndexInsert(linenoiseEditor *e, int j) {
+    int n = historySlot(e,j);
+
+    if (historyIndexSkip(e)) return;
+    if (historyNodesGrow(e,n+1) == -1) {
+        e->history_index_dirty = 1;
+        return;
+    }
+    e->history_nodes[n].left = e->history_nodes[n].right = -1;
+    e->history_nodes[n].seq = e->history_base+j+1;
+    e->history_nodes[n].max = e->history_nodes[n].seq;
+    e->history_root = historyTreeInsert(e,e->history_root,n);
+}
+
+/* Remove the entry 'j' of the history, from the oldest, from the index.
+ * Must be called before the entry is freed or replaced. */
+static void historyIndexRemove(linenoiseEditor *e, int j) {
+    if (historyIndexSkip(e)) return;
+    e->history_root = historyTreeRemove(e,e->history_root,historySlot(e,j));
+}
+
+/* Return the most recent history entry starting with the first 'len'
+ * bytes of 'prefix' and longer than it, or NULL if there is none.
+ * 'prefix' must be null terminated at 'len'. */
+static const char *historySuggest(linenoiseEditor *e, const char *prefix,
+                                  size_t len)
+{
+    struct historyNode *nodes;
+    unsigned long best = 0;
+    int t, a, b;
+
+    if (e->history == NULL || len == 0) return NULL;
+    e->history_index_updates = 0;
+    if (e->history_index_dirty) historyIndexRebuild(e);
+    if (e->history_index_dirty || e->history_root == -1) return NULL;
+
+    /* The entries wanted sort after the prefix itself (the entries equal
+     * to it sort first), and up to the last one starting with it. Walk
+     * down to the first node in that range, where the paths to its two
+     * ends split. */
+    nodes = e->history_nodes;
+    t = e->history_root;
+    while (t != -1) {
+        if (strcmp(e->history[t],prefix) <= 0)
+            t = nodes[t].right;
+        else if (strncmp(e->history[t],prefix,len) > 0)
+            t = nodes[t].left;
+        else
+            break;
+    }
+    if (t == -1) return NULL;
+    best = nodes[t].seq;
+
+    /* On the left, every node after the start of the range is in it with
+     * its right subtree. */
+    for (a = nodes[t].left; a != -1; ) {
+        if (strcmp(e->history[a],prefix) > 0) {
+            if (nodes[a].seq > best) best = nodes[a].seq;
+            if (nodes[a].right != -1 && nodes[nodes[a].right].max > best)
+                best = nodes[nodes[a].right].max;
+            a = nodes[a].left;
+        } else {
+            a = nodes[a].right;
+        }
+    }
+    /* On the right, every node before its end is in it with its left
+     * subtree. */
+    for (b = nodes[t].right; b != -1; ) {
+        if (strncmp(e->history[b],prefix,len) <= 0) {
+            if (nodes[b].seq > best) best = nodes[b].seq;
+            if (nodes[b].left != -1 && nodes[nodes[b].left].max > best)
+                best = nodes[nodes[b].left].max;
+            b = nodes[b].right;
+        } else {
+            b = nodes[b].left;
+        }
+    }
+    return historyLineBySeq(e,best);
+}
+
+/* Like historySuggest(), but returns a heap allocated copy of the entry
+ * so that it can be used after the lock is released. */
+static char *historySuggestDup(linenoiseEditor *e, const char *prefix,
+                               size_t len)
+{
+    const char *s;
+    char *copy = NULL;
+
+    /* Looking up may rebuild the index, hence the write lock. */
+    pthread_rwlock_wrlock(&e->history_lock);
+    s = historySuggest(e,prefix,len);
+    if (s) copy = strdup(s);
+    pthread_rwlock_unlock(&e->history_lock);
+    return copy;
+}
+
+/* Return the most recent history entry that starts with 'prefix' and is
+ * longer than it, or NULL. The returned copy should be freed with
+ * linenoiseFree(). */
+char *linenoiseEditorHistorySuggest(linenoiseEditor *e, const char *prefix) {
+    return historySuggestDup(e,prefix,strlen(prefix));
+}
+
+/* Return true if 'needle' occurs in 'hay'. With SSE2 the positions where
+ * both the first and the last byte of the needle match are found 16 at a
+ * time, and only those are compared in full. */
+static int containsLiteral(const char *hay, size_t hlen, const char *needle,
+                           size_t nlen)
+{
+    const char *p, *end;
+
+    if (nlen == 0) return 1;
+    if (nlen > hlen) return 0;
+    p = hay;
+    end = hay+hlen-nlen+1; /* Past the last position to try. */
+#ifdef __SSE2__
+    {
+        __m128i first = _mm_set1_epi8(needle[0]);
+        __m128i last = _mm_set1_epi8(needle[nlen-1]);
+
+        while (end-p >= 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)p);
+            __m128i b = _mm_loadu_si128((const __m128i*)(p+nlen-1));
+            unsigned int mask = _mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(a,first),_mm_cmpeq_epi8(b,last)));
+
+            while (mask) {
+                if (!memcmp(p+__builtin_ctz(mask),needle,nlen)) return 1;
+                mask &= mask-1;
+            }
+            p += 16;
+        }
+    }
+#endif
+    while (p < end && (p = memchr(p,needle[0],end-p)) != NULL) {
+        if (!memcmp(p,needle,nlen)) return 1;
+        p++;
+    }
+    return 0;
+}
+
+/* Find the entries containing the 'len' bytes of 'needle', oldest first,
+ * or newest first if 'reverse' is true, and stop after 'limit' of them if
+ * it is positive. The indexes and the text of the entries found are stored
+ * in 'm', see linenoiseHistoryMatches, to be released with
+ * linenoiseHistoryMatchesFree(). Returns -1 on out of memory. */
+int linenoiseEditorHistorySearch(linenoiseEditor *e, const char *needle,
+                                 size_t len, int limit, int reverse,
+                                 linenoiseHistoryMatches *m)
+{
+    size_t size = 0;
+    int cap = 0, j, k;
+    char *p;
+
+    memset(m,0,sizeof(*m));
+    pthread_rwlock_rdlock(&e->history_lock);
+    m->base = e->history_base+1;
+    m->gen = e->history_gen;
+    for (k = 0; k < e->history_len; k++) {
+        const char *line;
+        size_t linelen;
+
+        if (limit > 0 && m->count == limit) break;
+        j = reverse ? e->history_len-1-k : k;
+        line = historyLine(e,j);
+        linelen = strlen(line);
+        if (!containsLiteral(line,linelen,needle,len)) continue;
+        if (m->count == cap) {
+            int *indexes;
+
+            cap = cap ? cap*2 : 16;
+            indexes = realloc(m->indexes,sizeof(int)*cap);
+            if (indexes == NULL) goto oom;
+            m->indexes = indexes;
+        }
+        m->indexes[m->count++] = j;
+        size += linelen+1;
+    }
+    p = m->lines = malloc(size+1);
+    if (m->lines == NULL) goto oom;
+    for (k = 0; k < m->count; k++) {
+        const char *line = historyLine(e,m->indexes[k]);
+        size_t linelen = strlen(line)+1;
+
+        memcpy(p,line,linelen);
+        p += linelen;
+    }
+    pthread_rwlock_unlock(&e->history_lock);
+    return 0;
+
+oom:
+    pthread_rwlock_unlock(&e->history_lock);
+    linenoiseHistoryMatchesFree(m);
+    return -1;
+}
+
+void linenoiseHistoryMatchesFree(linenoiseHistoryMatches *m) {
+    free(m->indexes);
+    free(m->lines);
+    m->indexes = NULL;
+    m->lines = NULL;
+    m->count = 0;
 }
 
 /* This is the API call to add a new entry in the linenoise history.
- * It uses a fixed array of char pointers that are shifted (memmoved)
- * when the history max length is reached in order to remove the older
- * entry and make room for the new one, so it is not exactly suitable for huge
- * histories, but will work well for a few hundred of entries.
- *
- * Using a circular buffer is smarter, but a bit more complex to handle. */
-int linenoiseHistoryAdd(const char *line) {
+ * When the history max length is reached the new entry takes the slot of
+ * the oldest one, so adding is O(log n) for the index, whatever the size
+ * of the history. */
+static int historyAdd(linenoiseEditor *e, const char *line) {
     char *linecopy;
 
-    if (history_max_len == 0) return 0;
+    if (e->history_max_len == 0) return 0;
 
     /* Initialization on first call. */
-    if (history == NULL) {
-        resetHistory();
-        if (history == NULL) return 0;
+    if (e->history == NULL) {
+        resetHistory(e);
+        if (e->history == NULL) return 0;
     }
 
     /* Don't add duplicated lines. */
-    if (history_len && !strcmp(history[history_len-1], line)) return 0;
+    if (e->history_len && !strcmp(historyLine(e,e->history_len-1), line))
+        return 0;
 
     /* Add an heap allocated copy of the line in the history.
      * If we reached the max length, remove the older line. */
     linecopy = strdup(line);
     if (!linecopy) return 0;
-    if (history_len == history_max_len) {
-        free(history[0]);
-        memmove(history,history+1,sizeof(char*)*(history_max_len-1));
-        history_len--;
+    if (e->history_len == e->history_max_len) {
+        historyIndexRemove(e,0);
+        free(e->history[e->history_head]);
+        e->history[e->history_head] = NULL;
+        e->history_head = historySlot(e,1);
+        e->history_len--;
+        e->history_base++;
+        statsAdd(e,&e->stats.history_evictions,1);
     }
-    history[history_len] = linecopy;
-    history_len++;
+    e->history[historySlot(e,e->history_len)] = linecopy;
+    e->history_len++;
+    historyIndexInsert(e,e->history_len-1);
     return 1;
 }
 
+int linenoiseEditorHistoryAdd(linenoiseEditor *e, const char *line) {
+    uint64_t start = statsStart(e);
+    int retval;
+
+    pthread_rwlock_wrlock(&e->history_lock);
+    retval = historyAdd(e,line);
+    pthread_rwlock_unlock(&e->history_lock);
+    statsRecordTime(e,&e->stats.history_add,start);
+    return retval;
+}
+
 /* Set the maximum length for the history. This function can be called even
  * if there is already some history, the function will make sure to retain
  * just the latest 'len' elements if the new history length value is smaller
  * than the amount of items already inside the history. */
-int linenoiseHistorySetMaxLen(int len) {
+int linenoiseEditorHistorySetMaxLen(linenoiseEditor *e, int len) {
     char **new;
 
     if (len < 1) return 0;
-    if (history) {
-        int tocopy = history_len;
+    pthread_rwlock_wrlock(&e->history_lock);
+    if (e->history) {
+        int tocopy = e->history_len, j;
 
         new = malloc(sizeof(char*)*len);
-        if (new == NULL) return 0;
+        if (new == NULL) {
+            pthread_rwlock_unlock(&e->history_lock);
+            return 0;
+        }
 
         /* If we can't copy everything, free the elements we'll not use. */
         if (len < tocopy) {
-            int j;
-
-            for (j = 0; j < tocopy-len; j++) free(history[j]);
+            for (j = 0; j < tocopy-len; j++) free(historyLine(e,j));
+            e->history_base += tocopy-len;
+            statsAdd(e,&e->stats.history_evictions,tocopy-len);
             tocopy = len;
         }
+        e->history_index_dirty = 1;
         memset(new,0,sizeof(char*)*len);
-        memcpy(new,history+(history_len-tocopy), sizeof(char*)*tocopy);
-        free(history);
-        history = new;
+        for (j = 0; j < tocopy; j++)
+            new[j] = historyLine(e,e->history_len-tocopy+j);
+        free(e->history);
+        e->history = new;
+        e->history_head = 0;
     }
-    history_max_len = len;
-    if (history_len > history_max_len)
-        history_len = history_max_len;
+    e->history_max_len = len;
+    if (e->history_len > e->history_max_len)
+        e->history_len = e->history_max_len;
+    pthread_rwlock_unlock(&e->history_lock);
     return 1;
 }
 
-/* Save the history in the specified file. On success 0 is returned
- * otherwise -1 is returned. */
-int linenoiseHistorySave(const char *filename) {
-    mode_t old_umask = umask(S_IXUSR|S_IRWXG|S_IRWXO);
+/* Write the history entry 'line' to 'fp' on a line of its own, its
+ * newlines and carriage returns escaped as \n and \r, and its backslashes
+ * doubled. */
+static void historyWriteLine(FILE *fp, const char *line) {
+    const char *p;
+
+    while ((p = strpbrk(line,"\\\n\r")) != NULL) {
+        fwrite(line,1,p-line,fp);
+        fputc('\\',fp);
+        fputc(*p == '\n' ? 'n' : *p == '\r' ? 'r' : '\\',fp);
+        line = p+1;
+    }
+    fputs(line,fp);
+    fputc('\n',fp);
+}
+
+/* Undo the escaping of historyWriteLine() in place. A backslash followed
+ * by anything else is kept. */
+static void historyUnescape(char *line) {
+    char *src, *dst;
+
+    for (src = dst = line; *src; src++) {
+        if (*src == '\\' && (src[1] == 'n' || src[1] == 'r' ||
+                              src[1] == '\\')) {
+            src++;
+            *dst++ = *src == 'n' ? '\n' : *src == 'r' ? '\r' : '\\';
+        } else {
+            *dst++ = *src;
+        }
+    }
+    *dst = '\0';
+}
+
+/* Save the history in the specified file: the LINENOISE_HISTORY_HEADER
+ * line, then an entry per line, see historyWriteLine(). On success 0 is
+ * returned otherwise -1 is returned. The file is written from a snapshot,
+ * so the history can be changed meanwhile. */
+int linenoiseEditorHistorySave(linenoiseEditor *e, const char *filename) {
+    uint64_t start = statsStart(e);
+    mode_t old_umask;
     FILE *fp;
-    int j;
+    char *snap, *p;
+    int count, j;
 
+    snap = linenoiseEditorHistorySnapshot(e,&count);
+    if (snap == NULL) return -1;
+    old_umask = umask(S_IXUSR|S_IRWXG|S_IRWXO);
     fp = fopen(filename,"w");
     umask(old_umask);
-    if (fp == NULL) return -1;
+    if (fp == NULL) {
+        free(snap);
+        return -1;
+    }
     chmod(filename,S_IRUSR|S_IWUSR);
-    for (j = 0; j < history_len; j++)
-        fprintf(fp,"%s\n",history[j]);
+    fputs(LINENOISE_HISTORY_HEADER "\n",fp);
+    for (j = 0, p = snap; j < count; j++, p += strlen(p)+1)
+        historyWriteLine(fp,p);
     fclose(fp);
+    free(snap);
+    statsRecordTime(e,&e->stats.history_save,start);
     return 0;
 }
 
 /* Load the history from the specified file. If the file does not exist
- * zero is returned and no operation is performed.
+ * zero is returned and no operation is performed. The entries are escaped
+ * if the file starts with the LINENOISE_HISTORY_HEADER line, and read
+ * verbatim otherwise, like the files saved before the escaping was added.
  *
  * If the file exists and the operation succeeded 0 is returned, otherwise
  * on error -1 is returned. */
-int linenoiseHistoryLoad(const char *filename) {
+int linenoiseEditorHistoryLoad(linenoiseEditor *e, const char *filename) {
     FILE *fp = fopen(filename,"r");
-    char buf[LINENOISE_MAX_LINE];
+    char *buf = NULL;
+    size_t bufsize = 0;
+    ssize_t len;
+    uint64_t start;
+    int escaped = 0, first = 1;
 
     if (fp == NULL) return -1;
-
-    while (fgets(buf,LINENOISE_MAX_LINE,fp) != NULL) {
-        char *p;
-
-        p = strchr(buf,'\r');
-        if (!p) p = strchr(buf,'\n');
-        if (p) *p = '\0';
-        linenoiseHistoryAdd(buf);
+    start = statsStart(e);
+
+    /* Sort once at the end instead of inserting every line. The lock is
+     * taken for every line, so readers are never kept waiting on the file. */
+    pthread_rwlock_wrlock(&e->history_lock);
+    e->history_index_dirty = 1;
+    pthread_rwlock_unlock(&e->history_lock);
+    while ((len = getline(&buf,&bufsize,fp)) != -1) {
+        if (len && buf[len-1] == '\n') buf[--len] = '\0';
+        if (len && buf[len-1] == '\r') buf[--len] = '\0';
+        if (first) {
+            first = 0;
+            if (!strcmp(buf,LINENOISE_HISTORY_HEADER)) {
+                escaped = 1;
+                continue;
+            }
+        }
+        if (escaped) historyUnescape(buf);
+        pthread_rwlock_wrlock(&e->history_lock);
+        historyAdd(e,buf);
+        pthread_rwlock_unlock(&e->history_lock);
     }
+    free(buf);
     fclose(fp);
+    statsRecordTime(e,&e->stats.history_load,start);
     return 0;
 }
 
-int linenoiseHistorySize(void) {
-    return history_len;
+int linenoiseEditorHistorySize(linenoiseEditor *e) {
+    int len;
+
+    pthread_rwlock_rdlock(&e->history_lock);
+    len = e->history_len;
+    pthread_rwlock_unlock(&e->history_lock);
+    return len;
 }
 
-char *linenoiseHistoryGet(int index) {
-    if (index < 0 || index+1 > history_len)
-        return NULL;
-    return history[index];
+/* Return the entry at 'index', owned by the history: it is only valid
+ * until the history is changed. See linenoiseEditorHistoryDup(). */
+char *linenoiseEditorHistoryGet(linenoiseEditor *e, int index) {
+    char *line = NULL;
+
+    pthread_rwlock_rdlock(&e->history_lock);
+    if (index >= 0 && index < e->history_len) line = historyLine(e,index);
+    pthread_rwlock_unlock(&e->history_lock);
+    return line;
 }
 
-char *linenoiseHistoryReplaceLine(int index, char *line) {
-    char *linecopy, *old_line;
+/* Return a heap allocated copy of the entry at 'index', or NULL. Safe to
+ * use while other threads change the history. */
+char *linenoiseEditorHistoryDup(linenoiseEditor *e, int index) {
+    char *line = NULL;
 
-    if (index < 0 || index+1 > history_len)
-        return NULL;
+    pthread_rwlock_rdlock(&e->history_lock);
+    if (index >= 0 && index < e->history_len) line = strdup(historyLine(e,index));
+    pthread_rwlock_unlock(&e->history_lock);
+    return line;
+}
+
+/* Copy the whole history in a single heap allocated block, oldest entry
+ * first, every entry null terminated. The number of entries is stored in
+ * 'count'. Returns NULL on out of memory. */
+char *linenoiseEditorHistorySnapshot(linenoiseEditor *e, int *count) {
+    size_t size = 0;
+    char *snap, *p;
+    int j;
+
+    pthread_rwlock_rdlock(&e->history_lock);
+    for (j = 0; j < e->history_len; j++) size += strlen(historyLine(e,j))+1;
+    snap = malloc(size ? size : 1);
+    if (snap) {
+        for (j = 0, p = snap; j < e->history_len; j++) {
+            size_t len = strlen(historyLine(e,j))+1;
+            memcpy(p,historyLine(e,j),len);
+            p += len;
+        }
+        *count = e->history_len;
+    }
+    pthread_rwlock_unlock(&e->history_lock);
+    return snap;
+}
+
+/* Copy the entries from 'start' to 'start+count', clamped to the history,
+ * in a single heap allocated block of null terminated lines. A negative
+ * 'start' counts from the end of the history. Entries are
+ * numbered by sequence numbers that never change, unless the entry itself
+ * is replaced, which changes the generation of the history: when 'gen' is
+ * still the current generation, the entries numbered from 'lo' to 'hi'
+ * (excluded) are skipped, because the caller has a copy of them already.
+ * The range and the history are described in 'r'. Returns NULL on out of
+ * memory. */
+char *linenoiseEditorHistoryRange(linenoiseEditor *e, int start, int count,
+                                  unsigned long gen, unsigned long lo,
+                                  unsigned long hi, linenoiseHistoryRange *r)
+{
+    char *block, *p;
+    size_t size = 1;
+    int j;
+
+    pthread_rwlock_rdlock(&e->history_lock);
+    if (start < 0) start += e->history_len;
+    if (start < 0) start = 0;
+    if (start > e->history_len) start = e->history_len;
+    if (count < 0) count = 0;
+    if (count > e->history_len-start) count = e->history_len-start;
+    r->base = e->history_base+1;
+    r->len = e->history_len;
+    r->seq = r->base+start;
+    r->count = count;
+    r->gen = e->history_gen;
+    if (gen != e->history_gen) lo = hi = 0;
+
+    for (j = start; j < start+count; j++) {
+        unsigned long seq = r->base+j;
+        if (seq < lo || seq >= hi) size += strlen(historyLine(e,j))+1;
+    }
+    p = block = malloc(size);
+    if (block) {
+        for (j = start; j < start+count; j++) {
+            unsigned long seq = r->base+j;
+            size_t len;
+
+            if (seq >= lo && seq < hi) continue;
+            len = strlen(historyLine(e,j))+1;
+            memcpy(p,historyLine(e,j),len);
+            p += len;
+        }
+        *p = '\0';
+    }
+    pthread_rwlock_unlock(&e->history_lock);
+    return block;
+}
+
+char *linenoiseEditorHistoryReplaceLine(linenoiseEditor *e, int index,
+                                        char *line)
+{
+    char *linecopy, *old_line;
 
     /* Allocate memory for this new line so it can be freed */
     linecopy = strdup(line);
     if (!linecopy)
         return NULL;
 
-    old_line = history[index];
-    history[index] = linecopy;
+    pthread_rwlock_wrlock(&e->history_lock);
+    if (index < 0 || index+1 > e->history_len) {
+        pthread_rwlock_unlock(&e->history_lock);
+        free(linecopy);
+        return NULL;
+    }
+    historyIndexRemove(e,index);
+    old_line = historyLine(e,index);
+    e->history[historySlot(e,index)] = linecopy;
+    historyIndexInsert(e,index);
+    e->history_gen++;
+    pthread_rwlock_unlock(&e->history_lock);
 
     return old_line;
 }
 
+void linenoiseEditorHistoryClear(linenoiseEditor *e) {
+    pthread_rwlock_wrlock(&e->history_lock);
+    /* Entries are never numbered twice, in case one is being edited. */
+    e->history_base += e->history_len;
+    freeHistory(e);
+    resetHistory(e);
+    pthread_rwlock_unlock(&e->history_lock);
+}
+
+/* ================================ Editors ================================= */
+
+/* Create a new editor attached to stdin and stdout, with the same defaults
+ * as the default editor. Returns NULL on out of memory. */
+linenoiseEditor *linenoiseEditorNew(void) {
+    linenoiseEditor *e = calloc(1,sizeof(*e));
+
+    if (e == NULL) return NULL;
+    e->ifd = STDIN_FILENO;
+    e->ofd = STDOUT_FILENO;
+    e->history_max_len = LINENOISE_DEFAULT_HISTORY_MAX_LEN;
+    e->history_root = -1;
+    e->esctimeout = LINENOISE_DEFAULT_ESC_TIMEOUT;
+    e->wakefd[0] = e->wakefd[1] = -1;
+    e->rec_fd = -1;
+    if (pthread_rwlock_init(&e->history_lock,NULL) != 0) {
+        free(e);
+        return NULL;
+    }
+    pthread_mutex_init(&e->stats_lock,NULL);
+    pthread_mutex_lock(&editors_lock);
+    e->next = editors;
+    editors = e;
+    pthread_mutex_unlock(&editors_lock);
+    return e;
+}
+
+/* Release the memory used by an editor. Its terminal is restored if it
+ * was left in raw mode. */
+static void freeEditor(linenoiseEditor *e) {
+    disableRawMode(e);
+    freeHistory(e);
+    freeCompletions(&e->completions);
+    free(e->completions_set);
+    free(e->buf);
+    free(e->flat);
+    free(e->lines);
+    freeHighlights(&e->highlights);
+    freeHighlights(&e->hlspans);
+    free(e->scratch);
+    free(e->bindings);
+    free(e->killbuf);
+    free(e->inbuf);
+    abFree(&e->out);
+    if (e->wakefd[0] != -1) {
+        close(e->wakefd[0]);
+        close(e->wakefd[1]);
+    }
+    pthread_rwlock_destroy(&e->history_lock);
+    pthread_mutex_destroy(&e->stats_lock);
+}
+
+/* Free an editor created with linenoiseEditorNew(). */
+void linenoiseEditorFree(linenoiseEditor *e) {
+    linenoiseEditor **p;
+
+    if (e == NULL || e == &default_editor) return;
+    pthread_mutex_lock(&editors_lock);
+    for (p = &editors; *p; p = &(*p)->next) {
+        if (*p == e) {
+            *p = e->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&editors_lock);
+    freeEditor(e);
+    free(e);
+}
+
+/* Edit lines read from 'ifd' and write to 'ofd' instead of stdin and
+ * stdout. 'ifd' is switched to raw mode while a line is edited, and
+ * restored afterwards. The descriptors are not closed by the editor. */
+void linenoiseEditorSetFds(linenoiseEditor *e, int ifd, int ofd) {
+    e->ifd = ifd;
+    e->ofd = ofd;
+}
+
+/* Tell the editor that its input is not a tty but still delivers every
+ * key as soon as it is typed, like a socket connected to a telnet client
+ * in character mode. The line is then edited without touching the
+ * terminal mode, instead of being read as plain text. */
+void linenoiseEditorSetRawInput(linenoiseEditor *e, int enable) {
+    e->rawinput = enable;
+}
+
+/* Attach an opaque pointer to the editor, so that callbacks can find the
+ * state of the program owning it. */
+void linenoiseEditorSetData(linenoiseEditor *e, void *data) {
+    e->data = data;
+}
+
+void *linenoiseEditorGetData(linenoiseEditor *e) {
+    return e->data;
+}
+
+/* At exit we'll try to fix the terminal of every editor to the initial
+ * conditions. */
+static void linenoiseAtExit(void) {
+    linenoiseEditor *e;
+
+    pthread_mutex_lock(&editors_lock);
+    for (e = editors; e; e = e->next) {
+        disableRawMode(e);
+        if (e->sessiontty) tcsetattr(e->ifd,TCSADRAIN,&e->orig_termios);
+    }
+    pthread_mutex_unlock(&editors_lock);
+    freeEditor(&default_editor);
+}
+
+/* ============================= Default editor ============================= */
+
+/* The original linenoise API, acting on the default editor. */
+
+static void defaultCompletionCallback(linenoiseEditor *e, const char *buf,
+                                      linenoiseCompletions *lc)
+{
+    ((void)e);
+    completionCallback(buf,lc);
+}
+
+static char *defaultHintsCallback(linenoiseEditor *e, const char *buf,
+                                  int *color, int *bold)
+{
+    ((void)e);
+    return hintsCallback(buf,color,bold);
+}
+
+static void defaultFreeHintsCallback(linenoiseEditor *e, void *hint) {
+    ((void)e);
+    freeHintsCallback(hint);
+}
+
+void linenoiseSetCompletionCallback(linenoiseCompletionCallback *fn) {
+    completionCallback = fn;
+    default_editor.completionCallback = fn ? defaultCompletionCallback : NULL;
+}
+
+void linenoiseSetHintsCallback(linenoiseHintsCallback *fn) {
+    hintsCallback = fn;
+    default_editor.hintsCallback = fn ? defaultHintsCallback : NULL;
+}
+
+void linenoiseSetFreeHintsCallback(linenoiseFreeHintsCallback *fn) {
+    freeHintsCallback = fn;
+    default_editor.freeHintsCallback = fn ? defaultFreeHintsCallback : NULL;
+}
+
+char *linenoise(const char *prompt) {
+    return linenoiseEditorReadLine(&default_editor,prompt);
+}
+
+void linenoiseClearScreen(void) {
+    linenoiseEditorClearScreen(&default_editor);
+}
+
+void linenoiseSetMultiLine(int ml) {
+    linenoiseEditorSetMultiLine(&default_editor,ml);
+}
+
+void linenoiseSetAutoSuggest(int enable) {
+    linenoiseEditorSetAutoSuggest(&default_editor,enable);
+}
+
+void linenoiseSetCompletionMenu(int enable) {
+    linenoiseEditorSetCompletionMenu(&default_editor,enable);
+}
+
+int linenoiseHistoryAdd(const char *line) {
+    return linenoiseEditorHistoryAdd(&default_editor,line);
+}
+
+int linenoiseHistorySetMaxLen(int len) {
+    return linenoiseEditorHistorySetMaxLen(&default_editor,len);
+}
+
+int linenoiseHistorySave(const char *filename) {
+    return linenoiseEditorHistorySave(&default_editor,filename);
+}
+
+int linenoiseHistoryLoad(const char *filename) {
+    return linenoiseEditorHistoryLoad(&default_editor,filename);
+}
+
+int linenoiseHistorySize(void) {
+    return linenoiseEditorHistorySize(&default_editor);
+}
+
+char *linenoiseHistoryGet(int index) {
+    return linenoiseEditorHistoryGet(&default_editor,index);
+}
+
+char *linenoiseHistoryReplaceLine(int index, char *line) {
+    return linenoiseEditorHistoryReplaceLine(&default_editor,index,line);
+}
+
+char *linenoiseHistorySuggest(const char *prefix) {
+    return linenoiseEditorHistorySuggest(&default_editor,prefix);
+}
+
 void linenoiseHistoryClear(void) {
-    freeHistory();
-    resetHistory();
+    linenoiseEditorHistoryClear(&default_editor);
 }
@@ -39,6 +39,8 @@
 #ifndef __LINENOISE_H
 #define __LINENOISE_H
 
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -46,8 +48,88 @@ extern "C" {
 typedef struct linenoiseCompletions {
   size_t len;
   char **cvec;
+  size_t *clen;                       /* Length of every candidate. */
+  size_t cap;                         /* Allocated slots in cvec/clen. */
+  struct linenoiseArenaBlock *arena;  /* Storage of the candidates text. */
 } linenoiseCompletions;
 
+/* A range of history entries, see linenoiseEditorHistoryRange(). */
+typedef struct linenoiseHistoryRange {
+  unsigned long base;   /* Sequence number of the oldest entry. */
+  unsigned long seq;    /* Sequence number of the first entry of the range. */
+  unsigned long gen;    /* Generation of the history. */
+  int len;              /* Entries in the history. */
+  int count;            /* Entries in the range. */
+} linenoiseHistoryRange;
+
+/* Entries found by linenoiseEditorHistorySearch(). */
+typedef struct linenoiseHistoryMatches {
+  int count;
+  int *indexes;         /* Index of every entry found. */
+  char *lines;          /* Their text, null terminated, in the same order. */
+  unsigned long base;   /* Same as in linenoiseHistoryRange. */
+  unsigned long gen;
+} linenoiseHistoryMatches;
+
+/* A span of the edited line shown with a color, see
+ * linenoiseEditorSetHighlightCallback(). Offsets are in bytes. */
+typedef struct linenoiseHighlight {
+  size_t start;
+  size_t len;
+  int color;            /* SGR color code, -1 for the default one. */
+  int bold;
+} linenoiseHighlight;
+
+typedef struct linenoiseHighlights {
+  size_t len;
+  size_t cap;
+  linenoiseHighlight *spans;
+} linenoiseHighlights;
+
+/* Given to the callback of a key bound with
+ * linenoiseEditorBindKeyCallback(). The callback may move the cursor,
+ * replace the line, and ask for a built-in action to run next. */
+typedef struct linenoiseKeyEvent {
+  int key;              /* Code of the key pressed. */
+  const char *line;     /* The edited line, null terminated. */
+  size_t len;
+  size_t pos;           /* Byte offset of the cursor, may be changed. */
+  char *replace;        /* New line allocated with malloc(), or NULL. */
+  size_t replacelen;
+  const char *action;   /* Name of the action to run next, or NULL. */
+} linenoiseKeyEvent;
+
+/* First bytes of a session log, see linenoiseEditorRecord(). */
+#define LINENOISE_RECORD_MAGIC "LNREC1\n"
+
+/* Histogram of the values recorded by the stats, in power of two buckets:
+ * buckets[b] counts the values in [2^b, 2^(b+1)). */
+#define LINENOISE_HISTOGRAM_BUCKETS 40
+typedef struct linenoiseHistogram {
+  unsigned long long count;
+  unsigned long long sum;
+  unsigned long long max;
+  unsigned long long buckets[LINENOISE_HISTOGRAM_BUCKETS];
+} linenoiseHistogram;
+
+/* Stats of an editor. Times are in nanoseconds. */
+typedef struct linenoiseStats {
+  unsigned long long reads;             /* read() calls on the input. */
+  unsigned long long writes;            /* write() calls on the output. */
+  unsigned long long bytes_read;
+  unsigned long long bytes_written;
+  unsigned long long history_evictions; /* Entries dropped to make room. */
+  linenoiseHistogram key_latency;       /* From a key to waiting for the next. */
+  linenoiseHistogram refresh_bytes;     /* Bytes written by every refresh. */
+  linenoiseHistogram key_bytes;         /* Bytes written for every key. */
+  linenoiseHistogram completion;        /* Time in the completion callback. */
+  linenoiseHistogram hints;             /* Time in the hints callback. */
+  linenoiseHistogram highlight;         /* Time highlighting the line. */
+  linenoiseHistogram history_add;
+  linenoiseHistogram history_load;
+  linenoiseHistogram history_save;
+} linenoiseStats;
+
 typedef void(linenoiseCompletionCallback)(const char *, linenoiseCompletions *);
 typedef char*(linenoiseHintsCallback)(const char *, int *color, int *bold);
 typedef void(linenoiseFreeHintsCallback)(void *);
@@ -55,6 +137,8 @@ void linenoiseSetCompletionCallback(linenoiseCompletionCallback *);
 void linenoiseSetHintsCallback(linenoiseHintsCallback *);
 void linenoiseSetFreeHintsCallback(linenoiseFreeHintsCallback *);
 void linenoiseAddCompletion(linenoiseCompletions *, const char *);
+void linenoiseAddCompletions(linenoiseCompletions *, const char **strs,
+                             const size_t *lens, size_t n);
 
 char *linenoise(const char *prompt);
 void linenoiseFree(void *ptr);
@@ -65,11 +149,75 @@ int linenoiseHistoryLoad(const char *filename);
 int linenoiseHistorySize();
 char *linenoiseHistoryGet(int index);
 char *linenoiseHistoryReplaceLine(int index, char *line);
+char *linenoiseHistorySuggest(const char *prefix);
 void linenoiseHistoryClear();
 void linenoiseClearScreen(void);
 void linenoiseSetMultiLine(int ml);
+void linenoiseSetAutoSuggest(int enable);
+void linenoiseSetCompletionMenu(int enable);
 void linenoisePrintKeyCodes(void);
 
+/* Independent editors, each with its own settings, callbacks, terminal
+ * and history. The functions above act on a default editor. */
+typedef struct linenoiseEditor linenoiseEditor;
+typedef void(linenoiseEditorCompletionCallback)(linenoiseEditor *, const char *, linenoiseCompletions *);
+typedef char*(linenoiseEditorHintsCallback)(linenoiseEditor *, const char *, int *color, int *bold);
+typedef void(linenoiseEditorFreeHintsCallback)(linenoiseEditor *, void *);
+typedef void(linenoiseEditorHighlightCallback)(linenoiseEditor *, const char *, size_t len, linenoiseHighlights *);
+typedef void(linenoiseEditorKeyCallback)(linenoiseEditor *, void *data, linenoiseKeyEvent *);
+typedef ssize_t(linenoiseEditorWriteCallback)(linenoiseEditor *, const void *, size_t);
+
+linenoiseEditor *linenoiseEditorNew(void);
+void linenoiseEditorFree(linenoiseEditor *e);
+void linenoiseEditorSetFds(linenoiseEditor *e, int ifd, int ofd);
+void linenoiseEditorSetRawInput(linenoiseEditor *e, int enable);
+void linenoiseEditorSetData(linenoiseEditor *e, void *data);
+void *linenoiseEditorGetData(linenoiseEditor *e);
+void linenoiseEditorSetCompletionCallback(linenoiseEditor *e, linenoiseEditorCompletionCallback *);
+void linenoiseEditorSetHintsCallback(linenoiseEditor *e, linenoiseEditorHintsCallback *);
+void linenoiseEditorSetFreeHintsCallback(linenoiseEditor *e, linenoiseEditorFreeHintsCallback *);
+void linenoiseEditorSetHighlightCallback(linenoiseEditor *e, linenoiseEditorHighlightCallback *);
+void linenoiseEditorSetWriteCallback(linenoiseEditor *e, linenoiseEditorWriteCallback *);
+void linenoiseAddHighlight(linenoiseHighlights *h, size_t start, size_t len, int color, int bold);
+char *linenoiseEditorReadLine(linenoiseEditor *e, const char *prompt);
+void linenoiseEditorCancel(linenoiseEditor *e);
+int linenoiseEditorBeginSession(linenoiseEditor *e);
+void linenoiseEditorEndSession(linenoiseEditor *e);
+void linenoiseEditorBeginReadAhead(linenoiseEditor *e);
+void linenoiseEditorEndReadAhead(linenoiseEditor *e);
+int linenoiseEditorHistoryAdd(linenoiseEditor *e, const char *line);
+int linenoiseEditorHistorySetMaxLen(linenoiseEditor *e, int len);
+int linenoiseEditorHistorySave(linenoiseEditor *e, const char *filename);
+int linenoiseEditorHistoryLoad(linenoiseEditor *e, const char *filename);
+int linenoiseEditorHistorySize(linenoiseEditor *e);
+char *linenoiseEditorHistoryGet(linenoiseEditor *e, int index);
+char *linenoiseEditorHistoryDup(linenoiseEditor *e, int index);
+char *linenoiseEditorHistorySnapshot(linenoiseEditor *e, int *count);
+int linenoiseEditorHistorySearch(linenoiseEditor *e, const char *needle, size_t len, int limit, int reverse, linenoiseHistoryMatches *m);
+void linenoiseHistoryMatchesFree(linenoiseHistoryMatches *m);
+char *linenoiseEditorHistoryRange(linenoiseEditor *e, int start, int count, unsigned long gen, unsigned long lo, unsigned long hi, linenoiseHistoryRange *r);
+char *linenoiseEditorHistoryReplaceLine(linenoiseEditor *e, int index, char *line);
+char *linenoiseEditorHistorySuggest(linenoiseEditor *e, const char *prefix);
+void linenoiseEditorHistoryClear(linenoiseEditor *e);
+void linenoiseEditorClearScreen(linenoiseEditor *e);
+void linenoiseEditorSetMultiLine(linenoiseEditor *e, int ml);
+void linenoiseEditorSetAutoSuggest(linenoiseEditor *e, int enable);
+void linenoiseEditorSetCompletionMenu(linenoiseEditor *e, int enable);
+void linenoiseEditorSetHighlight(linenoiseEditor *e, int enable);
+void linenoiseEditorSetColumns(linenoiseEditor *e, int cols);
+void linenoiseEditorSetRows(linenoiseEditor *e, int rows);
+void linenoiseEditorSetEscapeTimeout(linenoiseEditor *e, int ms);
+int linenoiseKeyCode(const char *seq, size_t len);
+int linenoiseKeyActionExists(const char *name);
+int linenoiseEditorBindKey(linenoiseEditor *e, int key, const char *action);
+int linenoiseEditorBindKeyCallback(linenoiseEditor *e, int key, linenoiseEditorKeyCallback *fn, void *data);
+void linenoiseEditorSetStats(linenoiseEditor *e, int enable);
+int linenoiseEditorStatsEnabled(linenoiseEditor *e);
+void linenoiseEditorGetStats(linenoiseEditor *e, linenoiseStats *stats);
+void linenoiseEditorResetStats(linenoiseEditor *e);
+unsigned long long linenoiseHistogramPercentile(const linenoiseHistogram *h, double p);
+int linenoiseEditorRecord(linenoiseEditor *e, int fd);
+
 #ifdef __cplusplus
 }
 #endif
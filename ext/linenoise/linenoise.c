@@ -1,16 +1,59 @@
 #include <ruby.h>
 #include <ruby/io.h>
+#include <ruby/re.h>
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+#include <ruby/ractor.h>
+#endif
+#include <ruby/thread.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 #include "line_noise.h"
+#include "screen.h"
+#include "utf8.h"
 
-static VALUE mLinenoise;
-static ID id_call, id_multiline, id_hint_bold, id_hint_color, completion_proc,
-          hint_proc;
-static VALUE hint_boldness;
-static int hint_color;
+static VALUE mLinenoise, cEditor, cHistory, cScreen;
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+static rb_ractor_local_key_t default_editor_key;
+#else
+static VALUE default_editor;
+#endif
+static ID id_call, id_fileno, id_input, id_output, id_raw_input;
+static ID id_rows, id_columns, id_limit, id_reverse, id_indices, id_history;
 
-#define COMPLETION_PROC "completion_proc"
-#define HINT_PROC "hint_proc"
+/* Ruby side of a linenoiseEditor. The Linenoise module methods act on the
+ * default editor of the current Ractor. */
+struct editor {
+    linenoiseEditor *le;
+    VALUE input;
+    VALUE output;
+    VALUE history;
+    VALUE completion_proc;
+    VALUE hint_proc;
+    VALUE multiline;
+    VALUE autosuggest;
+    VALUE completion_menu;
+    VALUE hint_color;
+    VALUE hint_bold;
+    VALUE highlight;
+    VALUE highlight_proc;
+    VALUE recorder;
+    VALUE columns;
+    VALUE escape_timeout;
+    VALUE bindings; /* The procs bound to keys, by key code. */
+    linenoiseScreen *screen; /* The output, when it is a Linenoise::Screen. */
+    int hint_color_code;
+    int busy;   /* A thread is reading a line with this editor. */
+    int state;  /* Tag of the exception raised by a proc, if any. */
+};
+
+struct history {
+    VALUE editor;
+    VALUE cache;                /* Frozen strings of a range of entries. */
+    unsigned long cache_seq;    /* Sequence number of the first one. */
+    unsigned long cache_gen;    /* Generation of the history they are from. */
+};
 
 /*
  * Document-module: Linenoise
@@ -87,11 +130,201 @@ static int hint_color;
  *   # The cap sets how many entries history can hold. When the capacity is
  *   # exceeded, older entries are removed.
  *   Linenoise::HISTORY.max_size = 3
+ *
+ * == Using several editors
+ *
+ * The methods of the module share a single default editor. A
+ * {Linenoise::Editor} has its own history, procs and settings, so several of
+ * them can be used side by side.
+ *
+ *   shell = Linenoise::Editor.new
+ *   shell.completion_proc = proc { |input| %w[ls cd pwd].grep(/\A#{input}/) }
+ *   shell.history << 'ls'
+ *
+ *   shell.linenoise('$ ')
+ *
+ * == Using Ractors
+ *
+ * Linenoise can be used from any Ractor. Every Ractor has its own default
+ * editor, whose history is returned by {Linenoise.history}: only the main
+ * Ractor can access {Linenoise::HISTORY}.
+ *
+ *   Ractor.new do
+ *     Linenoise.history.load('linenoise_history')
+ *     Linenoise.history.suggest('git')
+ *   end
+ */
+
+/*
+ * Document-class: Linenoise::Editor
+ *
+ * An independent line editor. Every editor has its own history, completion
+ * and hint procs, and settings. It responds to the same methods as the
+ * {Linenoise} module, which forwards them to a default editor.
+ *
+ *   editor = Linenoise::Editor.new
+ *   editor.multiline = false
+ *   editor.history.max_size = 10
+ *
+ *   while line = editor.linenoise('> ')
+ *     p line
+ *   end
+ */
+
+/*
+ * Document-class: Linenoise::History
+ *
+ * The history of an editor, returned by {Linenoise::Editor#history}.
+ * {Linenoise::HISTORY} is the history of the default editor.
+ */
+
+/*
+ * Document-class: Linenoise::Screen
+ *
+ * An in-memory terminal: a grid of cells and a cursor, which interprets the
+ * text and the escape sequences written by an editor. Give it as the output
+ * of an editor to look at what a line looks like, or to measure the cost of
+ * rendering it, without a terminal.
+ *
+ *   screen = Linenoise::Screen.new(rows: 5, columns: 20)
+ *   editor = Linenoise::Editor.new(input: socket, output: screen,
+ *                                  raw_input: true)
+ *   editor.linenoise('> ')
+ *   screen.lines.first #=> "> ls -l"
  */
 
 /* Hint colors */
 enum {red = 31, green, yellow, blue, magenta, cyan, white};
 
+static void
+editor_mark(void *ptr)
+{
+    struct editor *ed = ptr;
+
+    rb_gc_mark(ed->input);
+    rb_gc_mark(ed->output);
+    rb_gc_mark(ed->history);
+    rb_gc_mark(ed->completion_proc);
+    rb_gc_mark(ed->hint_proc);
+    rb_gc_mark(ed->multiline);
+    rb_gc_mark(ed->autosuggest);
+    rb_gc_mark(ed->completion_menu);
+    rb_gc_mark(ed->hint_color);
+    rb_gc_mark(ed->hint_bold);
+    rb_gc_mark(ed->highlight);
+    rb_gc_mark(ed->highlight_proc);
+    rb_gc_mark(ed->recorder);
+    rb_gc_mark(ed->columns);
+    rb_gc_mark(ed->escape_timeout);
+    rb_gc_mark(ed->bindings);
+}
+
+static void
+editor_free(void *ptr)
+{
+    struct editor *ed = ptr;
+
+    linenoiseEditorFree(ed->le);
+    xfree(ed);
+}
+
+static size_t
+editor_memsize(const void *ptr)
+{
+    return sizeof(struct editor);
+}
+
+static const rb_data_type_t editor_type = {
+    "Linenoise::Editor",
+    {editor_mark, editor_free, editor_memsize,},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static void
+history_mark(void *ptr)
+{
+    struct history *hist = ptr;
+
+    rb_gc_mark(hist->editor);
+    rb_gc_mark(hist->cache);
+}
+
+static size_t
+history_memsize(const void *ptr)
+{
+    return sizeof(struct history);
+}
+
+static const rb_data_type_t history_type = {
+    "Linenoise::History",
+    {history_mark, RUBY_TYPED_DEFAULT_FREE, history_memsize,},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static void
+screen_free(void *ptr)
+{
+    linenoiseScreenFree(ptr);
+}
+
+static size_t
+screen_memsize(const void *ptr)
+{
+    return ptr ? linenoiseScreenMemsize(ptr) : 0;
+}
+
+static const rb_data_type_t screen_type = {
+    "Linenoise::Screen",
+    {NULL, screen_free, screen_memsize,},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+/* Editors are not shareable, so every Ractor gets its own default editor
+ * when it first uses the Linenoise module. */
+static VALUE
+get_default_editor(void)
+{
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+    VALUE editor;
+
+    if (!rb_ractor_local_storage_value_lookup(default_editor_key, &editor)) {
+        editor = rb_class_new_instance(0, NULL, cEditor);
+        rb_ractor_local_storage_value_set(default_editor_key, editor);
+    }
+    return editor;
+#else
+    return default_editor;
+#endif
+}
+
+/* Returns the editor +self+ stands for: itself for a Linenoise::Editor, the
+ * default editor for the Linenoise module. */
+static struct editor *
+get_editor(VALUE self)
+{
+    if (!rb_typeddata_is_kind_of(self, &editor_type))
+        self = get_default_editor();
+    return rb_check_typeddata(self, &editor_type);
+}
+
+static linenoiseEditor *
+get_history(VALUE self)
+{
+    struct history *hist = rb_check_typeddata(self, &history_type);
+
+    return get_editor(hist->editor)->le;
+}
+
+static linenoiseScreen *
+get_screen(VALUE self)
+{
+    linenoiseScreen *screen = rb_check_typeddata(self, &screen_type);
+
+    if (screen == NULL)
+        rb_raise(rb_eArgError, "uninitialized screen");
+    return screen;
+}
+
 static void
 mustbe_callable(VALUE proc)
 {
@@ -99,67 +332,363 @@ mustbe_callable(VALUE proc)
         rb_raise(rb_eArgError, "argument must respond to `call'");
 }
 
+struct protected_call {
+    struct editor *ed;
+    VALUE (*func)(VALUE);
+    VALUE arg;
+};
+
+static void *
+protected_call_with_gvl(void *ptr)
+{
+    struct protected_call *call = ptr;
+    int state = 0;
+
+    rb_protect(call->func, call->arg, &state);
+    if (state) {
+        call->ed->state = state;
+        linenoiseEditorCancel(call->ed->le);
+    }
+    return NULL;
+}
+
+/*
+ * Linenoise calls the procs while the line is read without the GVL. The
+ * exception they raise cancels the line and is raised again by
+ * linenoise_linenoise(), the procs are not called any more meanwhile.
+ */
+static void
+editor_call(struct editor *ed, VALUE (*func)(VALUE), VALUE arg)
+{
+    struct protected_call call;
+
+    if (ed->state)
+        return;
+    call.ed = ed;
+    call.func = func;
+    call.arg = arg;
+    rb_thread_call_with_gvl(protected_call_with_gvl, &call);
+}
+
+struct readline_args {
+    linenoiseEditor *le;
+    const char *prompt;
+    char *line;
+    int error;
+    int history;    /* Add the line to the history. */
+};
+
+static void *
+readline_without_gvl(void *ptr)
+{
+    struct readline_args *args = ptr;
+
+    args->line = linenoiseEditorReadLine(args->le, args->prompt);
+    args->error = args->line ? 0 : errno;
+    if (args->line && args->history && *args->line)
+        linenoiseEditorHistoryAdd(args->le, args->line);
+    return NULL;
+}
+
+static VALUE
+check_ints(VALUE unused)
+{
+    rb_thread_check_ints();
+    return Qnil;
+}
+
+static void
+readline_interrupt(void *ptr)
+{
+    linenoiseEditorCancel(ptr);
+}
+
+/* Reads a line for linenoise() and each_line(), adding it to the history
+ * if 'history' is set. */
+static VALUE
+editor_readline(VALUE self, VALUE prompt, int history)
+{
+    struct editor *ed = get_editor(self);
+    struct readline_args args;
+    VALUE result = Qnil;
+    int state;
+
+    StringValueCStr(prompt);
+    if (ed->busy)
+        rb_raise(rb_eRuntimeError, "editor is already reading a line");
+    /* Other threads may change the string while the GVL is released. */
+    prompt = rb_str_new_frozen(prompt);
+
+    /* Whatever was printed to the output before must show up first. */
+    if (RB_TYPE_P(ed->output, T_FILE))
+        rb_io_flush(ed->output);
+    args.le = ed->le;
+    args.prompt = RSTRING_PTR(prompt);
+    args.history = history;
+    ed->busy = 1;
+    do {
+        /* The read is skipped when an interrupt is already pending, and
+         * then handled like a cancelled one. */
+        args.line = NULL;
+        args.error = ECANCELED;
+        rb_thread_call_without_gvl2(readline_without_gvl, &args,
+                                    readline_interrupt, ed->le);
+        /* Raise the interrupt that cancelled the read. A cancel without
+         * one came too late for the previous read: try again. */
+        if (args.error == ECANCELED && !ed->state) {
+            int tag;
+
+            rb_protect(check_ints, Qnil, &tag);
+            if (tag) {
+                ed->busy = 0;
+                rb_jump_tag(tag);
+            }
+        }
+    } while (args.error == ECANCELED && !ed->state);
+    ed->busy = 0;
+    state = ed->state;
+    ed->state = 0;
+    if (args.line) {
+        if (!state)
+            result = rb_locale_str_new_cstr(args.line);
+        free(args.line);
+    }
+    RB_GC_GUARD(prompt);
+    if (state)
+        rb_jump_tag(state);
+    rb_thread_check_ints();
+
+    return result;
+}
+
 /*
  * call-seq:
  *   Linenoise.linenoise(prompt) -> string or nil
+ *   editor.linenoise(prompt) -> string or nil
  *
  * Shows the +prompt+ and reads the inputted line with line editing.
  *
  * Returns nil when the inputted line is empty and user inputs EOF
  * (Presses ^D on UNIX).
  *
+ * Other threads keep running while the line is read, and may use the
+ * history of the editor meanwhile. The read can be interrupted like any
+ * blocking IO, for example with Thread#raise or Thread#kill. An editor reads
+ * one line at a time.
+ *
  * Aliased as +readline+ for easier integration with Readline-enabled apps.
+ *
+ * @raise RuntimeError if the editor is already reading a line
  */
 static VALUE
 linenoise_linenoise(VALUE self, VALUE prompt)
 {
-    VALUE result;
-    char *line;
+    return editor_readline(self, prompt, 0);
+}
 
-    line = linenoise(StringValueCStr(prompt));
-    if (line) {
-        result = rb_locale_str_new_cstr(line);
-    }
-    else
-        result = Qnil;
-    if (line) free(line);
+static VALUE
+session_end(VALUE self)
+{
+    linenoiseEditorEndSession(get_editor(self)->le);
+    return Qnil;
+}
 
-    return result;
+/*
+ * call-seq:
+ *   Linenoise.session { ... } -> obj
+ *   editor.session { ... } -> obj
+ *
+ * Keeps the terminal in raw mode while the block runs, instead of switching
+ * it for every line read. The lines typed or pasted ahead of a prompt are
+ * kept for it, where switching the mode would throw them away.
+ *
+ * Between the lines, printing and ^C work as usual. Reading the terminal
+ * with something else than the editor gets the raw keys, without echo.
+ * Sessions may be nested. Returns the value of the block.
+ *
+ *   Linenoise.session do
+ *     while (line = Linenoise.linenoise('> '))
+ *       puts eval(line)
+ *     end
+ *   end
+ *
+ * @raise RuntimeError if the editor is reading a line
+ */
+static VALUE
+linenoise_session(VALUE self)
+{
+    struct editor *ed = get_editor(self);
+
+    rb_need_block();
+    if (ed->busy)
+        rb_raise(rb_eRuntimeError, "editor is reading a line");
+    if (linenoiseEditorBeginSession(ed->le) == -1)
+        rb_sys_fail("linenoiseEditorBeginSession");
+    return rb_ensure(rb_yield, Qnil, session_end, self);
 }
 
-static void
-linenoise_attempted_completion_function(const char *buf, struct linenoiseCompletions *lc)
+struct each_line_args {
+    VALUE self;
+    VALUE prompt;
+    int history;
+};
+
+static VALUE
+each_line_loop(VALUE ptr)
+{
+    struct each_line_args *args = (struct each_line_args *)ptr;
+    VALUE line;
+
+    while (!NIL_P(line = editor_readline(args->self, args->prompt,
+                                         args->history)))
+        rb_yield(line);
+    return args->self;
+}
+
+static VALUE
+each_line_end(VALUE self)
+{
+    linenoiseEditorEndReadAhead(get_editor(self)->le);
+    return session_end(self);
+}
+
+/*
+ * call-seq:
+ *   Linenoise.each_line(prompt, history: false) { |line| ... } -> Linenoise
+ *   editor.each_line(prompt, history: false) { |line| ... } -> editor
+ *   Linenoise.each_line(prompt, history: false) -> enumerator
+ *   editor.each_line(prompt, history: false) -> enumerator
+ *
+ * Reads lines like {Linenoise.linenoise} until it returns nil (^D or the
+ * end of a file), and yields them. The lines are read in a
+ * {Linenoise.session}, so the ones typed ahead are kept. With
+ * <tt>history: true</tt> every line that isn't empty is added to the
+ * history before being yielded.
+ *
+ * Input that is not a terminal is read in chunks rather than byte by byte.
+ * When the loop ends early, the input read past the last line is handed
+ * back to a file, but it stays in the editor for a pipe or a socket: only
+ * the next lines read by the editor get it.
+ *
+ * Returns an Enumerator when no block is given.
+ *
+ *   Linenoise.each_line('> ', history: true) do |line|
+ *     puts eval(line)
+ *   end
+ *
+ * @raise RuntimeError if the editor is reading a line
+ */
+static VALUE
+linenoise_each_line(int argc, VALUE *argv, VALUE self)
+{
+    struct each_line_args args;
+    VALUE prompt, opts, history;
+    ID keywords[1];
+
+    RETURN_ENUMERATOR(self, argc, argv);
+    rb_scan_args(argc, argv, "1:", &prompt, &opts);
+    keywords[0] = id_history;
+    rb_get_kwargs(opts, keywords, 0, 1, &history);
+    StringValueCStr(prompt);
+
+    args.self = self;
+    args.prompt = rb_str_new_frozen(prompt);
+    args.history = history != Qundef && RTEST(history);
+    if (get_editor(self)->busy)
+        rb_raise(rb_eRuntimeError, "editor is reading a line");
+    if (linenoiseEditorBeginSession(get_editor(self)->le) == -1)
+        rb_sys_fail("linenoiseEditorBeginSession");
+    linenoiseEditorBeginReadAhead(get_editor(self)->le);
+    return rb_ensure(each_line_loop, (VALUE)&args, each_line_end, self);
+}
+
+struct callback_args {
+    struct editor *ed;
+    const char *buf;
+    struct linenoiseCompletions *lc;
+    int *color;
+    int *bold;
+    char *hint;
+    size_t len;
+    linenoiseHighlights *hl;
+};
+
+/*
+ * Hands all the candidates returned by the completion proc to Linenoise in a
+ * single call. Strings in the locale encoding (or plain ASCII) skip the
+ * encoding compatibility check.
+ */
+static VALUE
+call_completion_proc(VALUE ptr)
 {
-    VALUE proc, ary, str;
+    struct callback_args *args = (struct callback_args *)ptr;
+    struct linenoiseCompletions *lc = args->lc;
+    VALUE proc, ary, str, encobj, vstrs, vlens;
     long i, matches;
+    int encidx, copied = 0;
     rb_encoding *enc;
-    VALUE encobj;
+    const char **strs;
+    size_t *lens;
 
-    proc = rb_attr_get(mLinenoise, completion_proc);
+    proc = args->ed->completion_proc;
     if (NIL_P(proc))
-        return;
+        return Qnil;
 
-    ary = rb_funcall(proc, id_call, 1, rb_locale_str_new_cstr(buf));
+    ary = rb_funcall(proc, id_call, 1, rb_locale_str_new_cstr(args->buf));
     if (!RB_TYPE_P(ary, T_ARRAY))
         ary = rb_Array(ary);
 
     matches = RARRAY_LEN(ary);
     if (matches == 0)
-        return;
+        return Qnil;
 
     enc = rb_locale_encoding();
     encobj = rb_enc_from_encoding(enc);
+    encidx = rb_enc_to_index(enc);
+    strs = ALLOCV_N(const char *, vstrs, matches);
+    lens = ALLOCV_N(size_t, vlens, matches);
     for (i = 0; i < matches; i++) {
-        str = rb_obj_as_string(RARRAY_AREF(ary, i));
-        StringValueCStr(str);
-        rb_enc_check(encobj, str);
-        linenoiseAddCompletion(lc, RSTRING_PTR(str));
+        str = RARRAY_AREF(ary, i);
+        if (!RB_TYPE_P(str, T_STRING)) {
+            /* Keep converted strings alive without touching the caller's
+             * array. */
+            if (!copied) {
+                ary = rb_ary_dup(ary);
+                copied = 1;
+            }
+            str = rb_obj_as_string(str);
+            rb_ary_store(ary, i, str);
+        }
+        if (memchr(RSTRING_PTR(str), '\0', RSTRING_LEN(str)))
+            rb_raise(rb_eArgError, "string contains null byte");
+        if (ENCODING_GET(str) != encidx && !rb_enc_str_asciionly_p(str))
+            rb_enc_check(encobj, str);
+        strs[i] = RSTRING_PTR(str);
+        lens[i] = RSTRING_LEN(str);
     }
+    linenoiseAddCompletions(lc, strs, lens, matches);
+    RB_GC_GUARD(ary);
+    ALLOCV_END(vstrs);
+    ALLOCV_END(vlens);
+    return Qnil;
+}
+
+static void
+linenoise_attempted_completion_function(linenoiseEditor *le, const char *buf,
+                                        struct linenoiseCompletions *lc)
+{
+    struct callback_args args;
+
+    args.ed = linenoiseEditorGetData(le);
+    args.buf = buf;
+    args.lc = lc;
+    editor_call(args.ed, call_completion_proc, (VALUE)&args);
 }
 
 /*
  * call-seq:
  *   Linenoise.completion_proc = proc
+ *   editor.completion_proc = proc
  *
  * Specifies a Proc object +proc+ to determine completion behavior. It should
  * take input string and return an array of completion candidates.
@@ -183,77 +712,190 @@ linenoise_attempted_completion_function(const char *buf, struct linenoiseComplet
 static VALUE
 linenoise_set_completion_proc(VALUE self, VALUE proc)
 {
+    struct editor *ed = get_editor(self);
+
     mustbe_callable(proc);
-    linenoiseSetCompletionCallback(linenoise_attempted_completion_function);
-    return rb_ivar_set(mLinenoise, completion_proc, proc);
+    linenoiseEditorSetCompletionCallback(ed->le, NIL_P(proc) ? NULL :
+        linenoise_attempted_completion_function);
+    return ed->completion_proc = proc;
 }
 
 /*
  * call-seq:
  *   Linenoise.completion_proc -> proc
+ *   editor.completion_proc -> proc
  *
  * Returns the completion Proc object.
  */
 static VALUE
 linenoise_get_completion_proc(VALUE self)
 {
-    return rb_attr_get(mLinenoise, completion_proc);
+    return get_editor(self)->completion_proc;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.completion_menu = bool -> bool
+ *   editor.completion_menu = bool -> bool
+ *
+ * Specifies completion menu mode. By default, pressing Tab cycles through the
+ * completion candidates one at a time. In menu mode, Tab first inserts the
+ * longest common prefix of the candidates, then lists them in columns below
+ * the line, a page at a time. The menu is navigated with Tab, Shift+Tab, the
+ * arrow keys and Page Up/Page Down. Enter accepts the selected candidate and
+ * Ctrl+G dismisses the menu.
+ *
+ *   Linenoise.completion_menu = true
+ */
+static VALUE
+linenoise_set_completion_menu(VALUE self, VALUE vbool)
+{
+    struct editor *ed = get_editor(self);
+
+    linenoiseEditorSetCompletionMenu(ed->le, RTEST(vbool) ? 1 : 0);
+    return ed->completion_menu = vbool;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.completion_menu?
+ *   editor.completion_menu?
+ *
+ * Checks if completion menu mode is enabled.
+ */
+static VALUE
+linenoise_get_completion_menu(VALUE self)
+{
+    return get_editor(self)->completion_menu;
 }
 
 /*
  * call-seq:
  *   Linenoise.multiline = bool -> bool
+ *   editor.multiline = bool -> bool
  *
  * Specifies multiline mode. By default, Linenoise uses single line editing,
  * that is, a single row on the screen will be used, and as the user types more,
  * the text will scroll towards left to make room.
+ *
+ * In both modes ctrl-j or alt-enter insert a newline, and up and down move
+ * between the lines before going through history. A buffer taller than the
+ * screen is scrolled to follow the cursor.
  */
 static VALUE
 linenoise_set_multiline(VALUE self, VALUE vbool)
 {
-    int i = RTEST(vbool) ? 1 : 0;
-    rb_ivar_set(mLinenoise, id_multiline, vbool);
-    linenoiseSetMultiLine(i);
-    return vbool;
+    struct editor *ed = get_editor(self);
+
+    linenoiseEditorSetMultiLine(ed->le, RTEST(vbool) ? 1 : 0);
+    return ed->multiline = vbool;
 }
 
 /*
  * call-seq:
  *   Linenoise.multiline?
+ *   editor.multiline?
  *
  * Checks if multiline mode is enabled.
  */
 static VALUE
 linenoise_get_multiline(VALUE self)
 {
-    return rb_attr_get(mLinenoise, id_multiline);
+    return get_editor(self)->multiline;
 }
 
-static char *
-linenoise_attempted_hint_function(const char *buf, int *color, int *bold)
+/*
+ * call-seq:
+ *   Linenoise.autosuggest = bool -> bool
+ *   editor.autosuggest = bool -> bool
+ *
+ * Specifies autosuggestion mode. When enabled, the most recent history entry
+ * that starts with the current input is shown as a hint, fish-style. Pressing
+ * Right or End at the end of the line accepts the suggestion. A hint returned
+ * by {Linenoise.hint_proc} takes precedence; return +nil+ from it to let the
+ * suggestion through.
+ *
+ *   Linenoise.autosuggest = true
+ */
+static VALUE
+linenoise_set_autosuggest(VALUE self, VALUE vbool)
+{
+    struct editor *ed = get_editor(self);
+
+    linenoiseEditorSetAutoSuggest(ed->le, RTEST(vbool) ? 1 : 0);
+    return ed->autosuggest = vbool;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.autosuggest?
+ *   editor.autosuggest?
+ *
+ * Checks if autosuggestion mode is enabled.
+ */
+static VALUE
+linenoise_get_autosuggest(VALUE self)
+{
+    return get_editor(self)->autosuggest;
+}
+
+/*
+ * The hint is copied, since nothing keeps the string returned by the proc
+ * alive until Linenoise is done with it. The copy is made with malloc(), as
+ * it is freed without the GVL.
+ */
+static VALUE
+call_hint_proc(VALUE ptr)
 {
+    struct callback_args *args = (struct callback_args *)ptr;
+    struct editor *ed = args->ed;
     VALUE proc, str, encobj;
     rb_encoding *enc;
 
-    *bold = RTEST(hint_boldness) ? 1 : 0;
-    *color = hint_color;
+    *args->bold = RTEST(ed->hint_bold) ? 1 : 0;
+    *args->color = ed->hint_color_code;
 
-    proc = rb_attr_get(mLinenoise, hint_proc);
+    proc = ed->hint_proc;
     if (NIL_P(proc))
-        return NULL;
+        return Qnil;
 
-    str = rb_funcall(proc, id_call, 1, rb_locale_str_new_cstr(buf));
+    str = rb_funcall(proc, id_call, 1, rb_locale_str_new_cstr(args->buf));
+    if (NIL_P(str))
+        return Qnil;
     enc = rb_locale_encoding();
     encobj = rb_enc_from_encoding(enc);
     StringValueCStr(str);
     rb_enc_check(encobj, str);
 
-    return RSTRING_PTR(str);
+    args->hint = strdup(RSTRING_PTR(str));
+    return Qnil;
+}
+
+static char *
+linenoise_attempted_hint_function(linenoiseEditor *le, const char *buf,
+                                  int *color, int *bold)
+{
+    struct callback_args args;
+
+    args.ed = linenoiseEditorGetData(le);
+    args.buf = buf;
+    args.color = color;
+    args.bold = bold;
+    args.hint = NULL;
+    editor_call(args.ed, call_hint_proc, (VALUE)&args);
+    return args.hint;
+}
+
+static void
+linenoise_free_hint_function(linenoiseEditor *le, void *hint)
+{
+    free(hint);
 }
 
 /*
  * call-seq:
  *   Linenoise.hint_proc = proc
+ *   editor.hint_proc = proc
  *
  * Specifies a Proc object +proc+ to determine hint behavior. It should take
  * input string and return the completion according to the input.
@@ -280,26 +922,31 @@ linenoise_attempted_hint_function(const char *buf, int *color, int *bold)
 static VALUE
 linenoise_set_hint_proc(VALUE self, VALUE proc)
 {
+    struct editor *ed = get_editor(self);
+
     mustbe_callable(proc);
-    linenoiseSetHintsCallback(linenoise_attempted_hint_function);
-    return rb_ivar_set(mLinenoise, hint_proc, proc);
+    linenoiseEditorSetHintsCallback(ed->le, NIL_P(proc) ? NULL :
+        linenoise_attempted_hint_function);
+    return ed->hint_proc = proc;
 }
 
 /*
  * call-seq:
  *   Linenoise.hint_proc -> proc
+ *   editor.hint_proc -> proc
  *
  * Returns the hint Proc object.
  */
 static VALUE
 linenoise_get_hint_proc(VALUE self)
 {
-    return rb_attr_get(mLinenoise, hint_proc);
+    return get_editor(self)->hint_proc;
 }
 
 /*
  * call-seq:
  *   Linenoise.hint_color = Integer -> Integer
+ *   editor.hint_color = Integer -> Integer
  *
  * Sets the hint color. Allowed values are in a range from 31 to 37. Setting
  * this option to 0 removes the color and uses the default font color.
@@ -318,6 +965,7 @@ linenoise_get_hint_proc(VALUE self)
 static VALUE
 linenoise_set_hint_color(VALUE self, VALUE color)
 {
+    struct editor *ed = get_editor(self);
     int c = 0;
 
     switch (TYPE(color)) {
@@ -331,29 +979,31 @@ linenoise_set_hint_color(VALUE self, VALUE color)
     }
 
     if (c == 0 || (c >= 31 && c <= 37)) {
-        hint_color = c;
+        ed->hint_color_code = c;
     }
     else
         rb_raise(rb_eArgError, "color '%d' is not in range (31-37)", c);
 
-    return rb_ivar_set(mLinenoise, id_hint_color, color);
+    return ed->hint_color = color;
 }
 
 /*
  * call-seq:
  *   Linenoise.hint_color -> Integer
+ *   editor.hint_color -> Integer
  *
  * Checks hint font color.
  */
 static VALUE
 linenoise_get_hint_color(VALUE self)
 {
-    return rb_attr_get(mLinenoise, id_hint_color);
+    return get_editor(self)->hint_color;
 }
 
 /*
  * call-seq:
  *   Linenoise.hint_bold = bool -> bool
+ *   editor.hint_bold = bool -> bool
  *
  * Sets hint boldness. +false+ means normal text, +true+ means bold. Defults to
  * +false+.
@@ -363,57 +1013,593 @@ linenoise_get_hint_color(VALUE self)
 static VALUE
 linenoise_set_hint_boldness(VALUE self, VALUE boldness)
 {
-    hint_boldness = boldness;
-    return rb_ivar_set(mLinenoise, id_hint_bold, boldness);
+    return get_editor(self)->hint_bold = boldness;
 }
 
 /*
  * call-seq:
  *   Linenoise.hint_bold? -> bool
+ *   editor.hint_bold? -> bool
  *
  * Checks if the hint font is bold.
  */
 static VALUE
 linenoise_get_hint_boldness(VALUE self)
 {
-    return rb_attr_get(mLinenoise, id_hint_bold);
+    return get_editor(self)->hint_bold;
 }
 
 /*
- * call-seq:
- *   Linenoise.clear_screen -> self
- *
- * Clears screen from characters.
+ * Converts the character offset +nth+ of the text given to the highlight
+ * proc to a byte offset. Spans usually come in order, so the search goes on
+ * from the previous one, kept in +last+ and +lastptr+.
  */
-static VALUE
-linenoise_clear_screen(VALUE self)
+static long
+highlight_offset(VALUE str, rb_encoding *enc, long nth, long *last,
+                 const char **lastptr)
 {
-    linenoiseClearScreen();
-    return self;
+    const char *p = RSTRING_PTR(str), *e = RSTRING_END(str);
+
+    if (nth < 0)
+        rb_raise(rb_eArgError, "negative highlight offset %ld", nth);
+    if (rb_enc_mbmaxlen(enc) == 1 ||
+        rb_enc_str_coderange(str) == ENC_CODERANGE_7BIT)
+        return nth < e - p ? nth : e - p;
+    if (nth < *last) {
+        *last = 0;
+        *lastptr = p;
+    }
+    *lastptr = rb_enc_nth(*lastptr, e, nth - *last, enc);
+    *last = nth;
+    return *lastptr - p;
 }
 
+/*
+ * Hands the spans returned by the highlight proc to Linenoise. They are
+ * +[start, length, color, bold]+ arrays, in characters of the text given to
+ * the proc, +bold+ being optional.
+ */
 static VALUE
-hist_set_max_len(VALUE self, VALUE len)
+call_highlight_proc(VALUE ptr)
 {
-    linenoiseHistorySetMaxLen(NUM2INT(len));
-    return len;
+    struct callback_args *args = (struct callback_args *)ptr;
+    rb_encoding *enc = rb_locale_encoding();
+    VALUE proc, str, ary, span, color;
+    long i, start, end, last = 0;
+    const char *lastptr;
+    int c;
+
+    proc = args->ed->highlight_proc;
+    if (NIL_P(proc))
+        return Qnil;
+
+    str = rb_enc_str_new(args->buf, args->len, enc);
+    ary = rb_funcall(proc, id_call, 1, str);
+    if (NIL_P(ary))
+        return Qnil;
+    ary = rb_Array(ary);
+    lastptr = RSTRING_PTR(str);
+    for (i = 0; i < RARRAY_LEN(ary); i++) {
+        span = rb_Array(RARRAY_AREF(ary, i));
+        if (RARRAY_LEN(span) < 3)
+            rb_raise(rb_eArgError, "highlight must be [start, length, color]");
+        start = NUM2LONG(RARRAY_AREF(span, 0));
+        end = start + NUM2LONG(RARRAY_AREF(span, 1));
+        color = RARRAY_AREF(span, 2);
+        c = NIL_P(color) ? -1 : NUM2INT(color);
+        if (c < -1 || c > 255)
+            rb_raise(rb_eArgError, "color '%d' is not in range (0-255)", c);
+        if (end <= start)
+            continue;
+        start = highlight_offset(str, enc, start, &last, &lastptr);
+        end = highlight_offset(str, enc, end, &last, &lastptr);
+        linenoiseAddHighlight(args->hl, start, end - start, c,
+                              RARRAY_LEN(span) > 3 &&
+                              RTEST(RARRAY_AREF(span, 3)));
+    }
+    RB_GC_GUARD(str);
+    return Qnil;
 }
 
-static VALUE
-hist_push(VALUE self, VALUE str)
+static void
+linenoise_attempted_highlight_function(linenoiseEditor *le, const char *buf,
+                                       size_t len, linenoiseHighlights *hl)
 {
-    linenoiseHistoryAdd(StringValueCStr(str));
-    return self;
+    struct callback_args args;
+
+    args.ed = linenoiseEditorGetData(le);
+    args.buf = buf;
+    args.len = len;
+    args.hl = hl;
+    editor_call(args.ed, call_highlight_proc, (VALUE)&args);
 }
 
+/*
+ * call-seq:
+ *   Linenoise.highlight = bool -> bool
+ *   editor.highlight = bool -> bool
+ *
+ * Specifies highlighting mode. When enabled, the input is colored by a
+ * built-in lexer: keywords of SQL and Ruby in bold blue, numbers in
+ * magenta, strings in green and comments (starting with <tt>--</tt> or
+ * <tt>#</tt>) in gray. Only the part of the input changed by a key is lexed
+ * again. A {Linenoise.highlight_proc} replaces the built-in lexer.
+ *
+ *   Linenoise.highlight = true
+ */
 static VALUE
-hist_push_method(int argc, VALUE *argv, VALUE self)
+linenoise_set_highlight(VALUE self, VALUE vbool)
 {
-    VALUE str;
+    struct editor *ed = get_editor(self);
+
+    linenoiseEditorSetHighlight(ed->le, RTEST(vbool) ? 1 : 0);
+    return ed->highlight = vbool;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.highlight?
+ *   editor.highlight?
+ *
+ * Checks if highlighting mode is enabled.
+ */
+static VALUE
+linenoise_get_highlight(VALUE self)
+{
+    return get_editor(self)->highlight;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.highlight_proc = proc
+ *   editor.highlight_proc = proc
+ *
+ * Specifies a Proc object +proc+ to color the input. It takes some text and
+ * returns the spans of it to color, as <tt>[start, length, color]</tt> or
+ * <tt>[start, length, color, bold]</tt> arrays, where +start+ and +length+
+ * are in characters and +color+ is an SGR color code (see
+ * {Linenoise.hint_color}), or +nil+ for the default color.
+ *
+ * The proc is not given the whole input every time, only the lines changed
+ * since it was last called, so it shouldn't expect the text to start at the
+ * beginning of a statement. The spans of the other lines are kept.
+ *
+ *   Linenoise.highlight_proc = proc do |text|
+ *     text.enum_for(:scan, /\d+/).map do
+ *       match = Regexp.last_match
+ *       [match.begin(0), match[0].size, Linenoise::YELLOW]
+ *     end
+ *   end
+ *
+ * @raise ArgumentError if +proc+ is not a Proc
+ */
+static VALUE
+linenoise_set_highlight_proc(VALUE self, VALUE proc)
+{
+    struct editor *ed = get_editor(self);
+
+    mustbe_callable(proc);
+    linenoiseEditorSetHighlightCallback(ed->le, NIL_P(proc) ? NULL :
+        linenoise_attempted_highlight_function);
+    return ed->highlight_proc = proc;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.highlight_proc -> proc
+ *   editor.highlight_proc -> proc
+ *
+ * Returns the highlight Proc object.
+ */
+static VALUE
+linenoise_get_highlight_proc(VALUE self)
+{
+    return get_editor(self)->highlight_proc;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.escape_timeout = seconds -> seconds
+ *   editor.escape_timeout = seconds -> seconds
+ *
+ * Specifies how long to wait for the rest of an escape sequence after an
+ * Escape byte, before taking it for the Escape key. Arrows and other keys
+ * send their whole sequence at once, so the default of 0.05 seconds is only
+ * felt when Escape itself is pressed. Raise it for slow links that split
+ * sequences.
+ *
+ *   Linenoise.escape_timeout = 0.2
+ */
+static VALUE
+linenoise_set_escape_timeout(VALUE self, VALUE seconds)
+{
+    struct editor *ed = get_editor(self);
+    double t = NUM2DBL(seconds);
+
+    if (t < 0)
+        rb_raise(rb_eArgError, "negative escape timeout");
+    linenoiseEditorSetEscapeTimeout(ed->le,
+                                    t < INT_MAX / 1000 ? (int)(t * 1000 + 0.5)
+                                                       : INT_MAX);
+    return ed->escape_timeout = seconds;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.escape_timeout -> seconds
+ *   editor.escape_timeout -> seconds
+ *
+ * Returns the time to wait for the rest of an escape sequence.
+ */
+static VALUE
+linenoise_get_escape_timeout(VALUE self)
+{
+    return get_editor(self)->escape_timeout;
+}
+
+struct key_args {
+    struct editor *ed;
+    linenoiseKeyEvent *ev;
+};
+
+/*
+ * Calls the proc bound to a key with the line and the cursor, in characters,
+ * and hands back the line, the cursor or the action it returns.
+ */
+static VALUE
+call_key_proc(VALUE ptr)
+{
+    struct key_args *args = (struct key_args *)ptr;
+    linenoiseKeyEvent *ev = args->ev;
+    rb_encoding *enc = rb_locale_encoding();
+    VALUE proc, ret, line = Qnil, cursor = Qnil;
+    const char *p, *e;
+    long n;
+
+    proc = rb_hash_lookup(args->ed->bindings, INT2FIX(ev->key));
+    if (NIL_P(proc))
+        return Qnil;
+
+    ret = rb_funcall(proc, id_call, 2, rb_enc_str_new(ev->line, ev->len, enc),
+                     LONG2NUM(rb_enc_strlen(ev->line, ev->line + ev->pos,
+                                            enc)));
+    if (SYMBOL_P(ret)) {
+        const char *name = rb_id2name(SYM2ID(ret));
+
+        if (!linenoiseKeyActionExists(name))
+            rb_raise(rb_eArgError, "unknown action '%s'", name);
+        ev->action = name;
+        return Qnil;
+    }
+    if (RB_TYPE_P(ret, T_ARRAY)) {
+        line = rb_ary_entry(ret, 0);
+        cursor = rb_ary_entry(ret, 1);
+    } else if (RB_TYPE_P(ret, T_STRING)) {
+        line = ret;
+    } else if (RB_INTEGER_TYPE_P(ret)) {
+        cursor = ret;
+    } else if (!NIL_P(ret)) {
+        rb_raise(rb_eTypeError, "bound proc must return a String, an Integer, "
+                                "a Symbol or nil");
+    }
+
+    if (NIL_P(line)) {
+        p = ev->line;
+        e = p + ev->len;
+    } else {
+        StringValueCStr(line);
+        rb_enc_check(rb_enc_from_encoding(enc), line);
+        p = RSTRING_PTR(line);
+        e = RSTRING_END(line);
+    }
+    if (!NIL_P(cursor)) {
+        n = NUM2LONG(cursor);
+        if (n < 0)
+            rb_raise(rb_eArgError, "negative cursor position %ld", n);
+        ev->pos = rb_enc_nth(p, e, n, enc) - p;
+    } else if (!NIL_P(line)) {
+        ev->pos = e - p;
+    }
+    if (!NIL_P(line)) {
+        if ((ev->replace = malloc(e - p + 1)) == NULL)
+            rb_memerror();
+        memcpy(ev->replace, p, e - p);
+        ev->replacelen = e - p;
+    }
+    RB_GC_GUARD(line);
+    return Qnil;
+}
+
+static void
+linenoise_key_function(linenoiseEditor *le, void *data, linenoiseKeyEvent *ev)
+{
+    struct key_args args;
+
+    args.ed = linenoiseEditorGetData(le);
+    args.ev = ev;
+    editor_call(args.ed, call_key_proc, (VALUE)&args);
+}
+
+/*
+ * call-seq:
+ *   Linenoise.bind(keys, action) -> action
+ *   editor.bind(keys, action) -> action
+ *
+ * Binds the key the terminal sends as the string +keys+ to +action+, the
+ * Symbol of a built-in action, or a Proc object. +nil+ removes the binding,
+ * a character is then inserted and other keys are ignored.
+ *
+ *   Linenoise.bind("\C-r", :history_search_backward)
+ *   Linenoise.bind("\e[1;5C", :forward_word)  # Ctrl+Right
+ *   Linenoise.bind("\ex", ->(line, cursor) { [line.upcase, cursor] })
+ *
+ * Built-in actions run without calling Ruby:
+ *
+ * [:accept_line] Return the line (Enter).
+ * [:backward_char, :forward_char] Move by a character (Left, Right).
+ * [:backward_word, :forward_word] Move by a word (Alt+B, Alt+F, Ctrl+Left,
+ *                                 Ctrl+Right).
+ * [:beginning_of_line, :end_of_line] Move to the start or end of the line
+ *                                    (Home, End).
+ * [:previous_line, :next_line] Move to the line above or below, or to the
+ *                              history entry from the first or last line
+ *                              (Up, Down).
+ * [:previous_history, :next_history] Show the previous or next history
+ *                                    entry.
+ * [:history_search_backward, :history_search_forward] Show the previous or
+ *   next history entry starting like the line before the cursor (Page Up,
+ *   Page Down).
+ * [:backward_delete_char, :delete_char] Delete a character (Backspace,
+ *                                       Delete).
+ * [:delete_char_or_eof] Delete a character, or end the input when the line
+ *                       is empty (Ctrl+D).
+ * [:kill_line, :kill_whole_line] Kill to the end of the line, or all of it
+ *                                (Ctrl+K, Ctrl+U).
+ * [:kill_word, :backward_kill_word] Kill to the end or start of a word
+ *                                   (Alt+D, Alt+Backspace).
+ * [:unix_word_rubout] Kill to the previous space (Ctrl+W).
+ * [:yank] Insert the text last killed (Ctrl+Y).
+ * [:transpose_chars] Swap two characters (Ctrl+T).
+ * [:insert_newline] Insert a newline (Ctrl+J, Alt+Enter).
+ * [:complete] Call the completion proc (Tab).
+ * [:clear_screen] Clear the screen (Ctrl+L).
+ * [:interrupt] Abort the line: linenoise returns +nil+ (Ctrl+C).
+ * [:self_insert] Insert the character.
+ *
+ * A proc is called only for the keys bound to it, with the line and the
+ * cursor position in characters. It returns a String to replace the line,
+ * an Integer to move the cursor, both as <tt>[line, cursor]</tt>, a Symbol to
+ * run a built-in action, or +nil+ to leave the line as it is.
+ *
+ * Keys can't be bound while the editor reads a line.
+ *
+ * @raise ArgumentError if +keys+ is not a single key, or +action+ is not a
+ *   known action or a Proc
+ * @raise RuntimeError if the editor is reading a line
+ */
+static VALUE
+linenoise_bind(VALUE self, VALUE keys, VALUE action)
+{
+    struct editor *ed = get_editor(self);
+    int key;
+
+    StringValue(keys);
+    key = linenoiseKeyCode(RSTRING_PTR(keys), RSTRING_LEN(keys));
+    if (key < 0)
+        rb_raise(rb_eArgError, "%s is not a single key",
+                 RSTRING_PTR(rb_inspect(keys)));
+    if (ed->busy)
+        rb_raise(rb_eRuntimeError, "editor is reading a line");
+
+    if (NIL_P(action) || SYMBOL_P(action)) {
+        const char *name = NIL_P(action) ? NULL : rb_id2name(SYM2ID(action));
+
+        if (linenoiseEditorBindKey(ed->le, key, name) == -1) {
+            if (errno == EINVAL)
+                rb_raise(rb_eArgError, "unknown action '%s'", name);
+            rb_memerror();
+        }
+        rb_hash_delete(ed->bindings, INT2FIX(key));
+    } else {
+        mustbe_callable(action);
+        if (linenoiseEditorBindKeyCallback(ed->le, key, linenoise_key_function,
+                                           NULL) == -1)
+            rb_memerror();
+        rb_hash_aset(ed->bindings, INT2FIX(key), action);
+    }
+    return action;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.display_width(string) -> Integer
+ *
+ * Returns the number of terminal columns +string+ takes when displayed, the
+ * way Linenoise measures the prompt and the edited line. CJK characters and
+ * emoji take two columns, combining marks none.
+ *
+ *   Linenoise.display_width('abc')
+ *   #=> 3
+ *   Linenoise.display_width('日本')
+ *   #=> 4
+ */
+static VALUE
+linenoise_display_width(VALUE self, VALUE str)
+{
+    StringValue(str);
+    return SIZET2NUM(linenoiseUtf8Width(RSTRING_PTR(str), RSTRING_LEN(str)));
+}
+
+/*
+ * call-seq:
+ *   Linenoise.clear_screen -> self
+ *   editor.clear_screen -> self
+ *
+ * Clears screen from characters.
+ */
+static VALUE
+linenoise_clear_screen(VALUE self)
+{
+    linenoiseEditorClearScreen(get_editor(self)->le);
+    return self;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.stats_enabled = bool -> bool
+ *   editor.stats_enabled = bool -> bool
+ *
+ * Enables the collection of {Linenoise.stats}. Disabled stats cost next to
+ * nothing. Disabling them keeps what was collected so far.
+ */
+static VALUE
+linenoise_set_stats_enabled(VALUE self, VALUE vbool)
+{
+    linenoiseEditorSetStats(get_editor(self)->le, RTEST(vbool) ? 1 : 0);
+    return vbool;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.stats_enabled?
+ *   editor.stats_enabled?
+ *
+ * Checks if stats are collected.
+ */
+static VALUE
+linenoise_get_stats_enabled(VALUE self)
+{
+    return linenoiseEditorStatsEnabled(get_editor(self)->le) ? Qtrue : Qfalse;
+}
+
+static VALUE
+stat_value(unsigned long long value, int time)
+{
+    if (time)
+        return DBL2NUM(value / 1e9);
+    return ULL2NUM(value);
+}
+
+static VALUE
+histogram_hash(const linenoiseHistogram *h, int time)
+{
+    VALUE hash = rb_hash_new();
+
+    rb_hash_aset(hash, ID2SYM(rb_intern("count")), ULL2NUM(h->count));
+    rb_hash_aset(hash, ID2SYM(rb_intern("sum")), stat_value(h->sum, time));
+    rb_hash_aset(hash, ID2SYM(rb_intern("max")), stat_value(h->max, time));
+    rb_hash_aset(hash, ID2SYM(rb_intern("p50")),
+                 stat_value(linenoiseHistogramPercentile(h, 0.5), time));
+    rb_hash_aset(hash, ID2SYM(rb_intern("p90")),
+                 stat_value(linenoiseHistogramPercentile(h, 0.9), time));
+    rb_hash_aset(hash, ID2SYM(rb_intern("p99")),
+                 stat_value(linenoiseHistogramPercentile(h, 0.99), time));
+    return hash;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.stats -> hash
+ *   editor.stats -> hash
+ *
+ * Returns the stats collected while {Linenoise.stats_enabled} is on:
+ *
+ * +reads+, +writes+:: read and write system calls on the terminal
+ * +bytes_read+, +bytes_written+:: bytes read from and written to it
+ * +history_evictions+:: history entries dropped to make room for new ones
+ * +key_latency+:: time from reading a key to being ready for the next one,
+ *                 rendering included
+ * +refresh_bytes+:: bytes written by every refresh of the line
+ * +key_bytes+:: bytes written for every key, refreshes or not, the keys typed
+ *               ahead counting as one
+ * +completion+, +hints+:: time spent calling the completion and hint procs
+ * +highlight+:: time spent highlighting the line, with the highlight proc or
+ *               not
+ * +history_add+, +history_load+, +history_save+:: time spent changing,
+ *                                                 loading and saving history
+ *
+ * Histograms are hashes with the +count+ of the values, their +sum+, +max+
+ * and the estimated +p50+, +p90+ and +p99+ percentiles. Times are in
+ * seconds.
+ *
+ *   Linenoise.stats_enabled = true
+ *   Linenoise.linenoise('> ')
+ *   Linenoise.stats[:key_latency][:p99]
+ *   #=> 0.000262143
+ */
+static VALUE
+linenoise_stats(VALUE self)
+{
+    linenoiseStats stats;
+    VALUE hash = rb_hash_new();
+
+    linenoiseEditorGetStats(get_editor(self)->le, &stats);
+    rb_hash_aset(hash, ID2SYM(rb_intern("reads")), ULL2NUM(stats.reads));
+    rb_hash_aset(hash, ID2SYM(rb_intern("writes")), ULL2NUM(stats.writes));
+    rb_hash_aset(hash, ID2SYM(rb_intern("bytes_read")),
+                 ULL2NUM(stats.bytes_read));
+    rb_hash_aset(hash, ID2SYM(rb_intern("bytes_written")),
+                 ULL2NUM(stats.bytes_written));
+    rb_hash_aset(hash, ID2SYM(rb_intern("history_evictions")),
+                 ULL2NUM(stats.history_evictions));
+    rb_hash_aset(hash, ID2SYM(rb_intern("key_latency")),
+                 histogram_hash(&stats.key_latency, 1));
+    rb_hash_aset(hash, ID2SYM(rb_intern("refresh_bytes")),
+                 histogram_hash(&stats.refresh_bytes, 0));
+    rb_hash_aset(hash, ID2SYM(rb_intern("key_bytes")),
+                 histogram_hash(&stats.key_bytes, 0));
+    rb_hash_aset(hash, ID2SYM(rb_intern("completion")),
+                 histogram_hash(&stats.completion, 1));
+    rb_hash_aset(hash, ID2SYM(rb_intern("hints")),
+                 histogram_hash(&stats.hints, 1));
+    rb_hash_aset(hash, ID2SYM(rb_intern("highlight")),
+                 histogram_hash(&stats.highlight, 1));
+    rb_hash_aset(hash, ID2SYM(rb_intern("history_add")),
+                 histogram_hash(&stats.history_add, 1));
+    rb_hash_aset(hash, ID2SYM(rb_intern("history_load")),
+                 histogram_hash(&stats.history_load, 1));
+    rb_hash_aset(hash, ID2SYM(rb_intern("history_save")),
+                 histogram_hash(&stats.history_save, 1));
+    return hash;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.reset_stats -> self
+ *   editor.reset_stats -> self
+ *
+ * Sets all the {Linenoise.stats} back to zero.
+ */
+static VALUE
+linenoise_reset_stats(VALUE self)
+{
+    linenoiseEditorResetStats(get_editor(self)->le);
+    return self;
+}
+
+static VALUE
+hist_set_max_len(VALUE self, VALUE len)
+{
+    linenoiseEditorHistorySetMaxLen(get_history(self), NUM2INT(len));
+    return len;
+}
+
+static VALUE
+hist_push(VALUE self, VALUE str)
+{
+    linenoiseEditorHistoryAdd(get_history(self), StringValueCStr(str));
+    return self;
+}
+
+static VALUE
+hist_push_method(int argc, VALUE *argv, VALUE self)
+{
+    linenoiseEditor *le = get_history(self);
+    VALUE str;
 
     while (argc--) {
         str = *argv++;
-        linenoiseHistoryAdd(StringValueCStr(str));
+        linenoiseEditorHistoryAdd(le, StringValueCStr(str));
     }
     return self;
 }
@@ -423,7 +1609,7 @@ hist_save(VALUE self, VALUE filename)
 {
     char *file = StringValueCStr(filename);
 
-    if (linenoiseHistorySave(file) == -1) {
+    if (linenoiseEditorHistorySave(get_history(self), file) == -1) {
         rb_raise(rb_eArgError,
                  "couldn't save Linenoise history to file '%s'", file);
     }
@@ -436,7 +1622,7 @@ hist_load(VALUE self, VALUE filename)
 {
     char *file = StringValueCStr(filename);
 
-    if (linenoiseHistoryLoad(file) == -1) {
+    if (linenoiseEditorHistoryLoad(get_history(self), file) == -1) {
         rb_raise(rb_eArgError,
                  "couldn't load Linenoise history from file '%s'", file);
     }
@@ -444,64 +1630,484 @@ hist_load(VALUE self, VALUE filename)
 }
 
 static VALUE
-hist_length(VALUE self)
+hist_length(VALUE self)
+{
+    return INT2NUM(linenoiseEditorHistorySize(get_history(self)));
+}
+
+struct history_range {
+    struct history *hist;
+    linenoiseHistoryRange r;
+    char *lines;
+    unsigned long lo, hi;   /* Entries found in the cache. */
+    VALUE entries;
+};
+
+static VALUE
+hist_build_range(VALUE ptr)
+{
+    struct history_range *range = (struct history_range *)ptr;
+    const char *line = range->lines;
+    long i;
+
+    range->entries = rb_ary_new_capa(range->r.count);
+    for (i = 0; i < range->r.count; i++) {
+        unsigned long seq = range->r.seq + i;
+        VALUE str;
+
+        if (seq >= range->lo && seq < range->hi) {
+            str = RARRAY_AREF(range->hist->cache, seq - range->lo);
+        } else {
+            str = rb_obj_freeze(rb_locale_str_new_cstr(line));
+            line += strlen(line) + 1;
+        }
+        rb_ary_push(range->entries, str);
+    }
+    return range->entries;
+}
+
+static VALUE
+hist_free_range(VALUE ptr)
+{
+    free(((struct history_range *)ptr)->lines);
+    return Qnil;
+}
+
+/* Keeps the strings of a contiguous range of entries, grown with every
+ * range read next to it, and replaced by a range read elsewhere. */
+static void
+hist_update_cache(struct history_range *range)
+{
+    struct history *hist = range->hist;
+    unsigned long lo = range->lo, hi = range->hi;
+    unsigned long first = range->r.seq, end = first + range->r.count;
+    const VALUE *entries = RARRAY_CONST_PTR(range->entries);
+    VALUE cache;
+
+    if (range->r.count == 0)
+        return;
+    if (lo < hi && first <= hi && end >= lo) {
+        if (first >= lo && end <= hi)
+            return;
+        cache = rb_ary_new_capa((end > hi ? end : hi) -
+                                (first < lo ? first : lo));
+        if (first < lo)
+            rb_ary_cat(cache, entries, lo - first);
+        rb_ary_concat(cache, hist->cache);
+        if (end > hi)
+            rb_ary_cat(cache, entries + (hi - first), end - hi);
+        if (first < lo)
+            lo = first;
+    } else {
+        cache = rb_ary_new_from_values(range->r.count, entries);
+        lo = first;
+    }
+    /* Forget the entries evicted from the history. */
+    if (lo < range->r.base) {
+        cache = rb_ary_subseq(cache, range->r.base - lo, RARRAY_LEN(cache));
+        lo = range->r.base;
+    }
+    hist->cache = cache;
+    hist->cache_seq = lo;
+    hist->cache_gen = range->r.gen;
+}
+
+/* Returns the entries from +start+ to +start+count+ in a new array, in one
+ * pass, with a frozen string for every entry. The strings of the entries
+ * that didn't change since they were last read are reused. */
+static VALUE
+hist_entries(VALUE self, int start, int count)
+{
+    struct history *hist = rb_check_typeddata(self, &history_type);
+    struct history_range range;
+
+    range.hist = hist;
+    range.lo = hist->cache_seq;
+    range.hi = NIL_P(hist->cache) ? range.lo :
+               range.lo + RARRAY_LEN(hist->cache);
+    range.lines = linenoiseEditorHistoryRange(get_history(self), start, count,
+                                              hist->cache_gen, range.lo,
+                                              range.hi, &range.r);
+    if (range.lines == NULL)
+        rb_memerror();
+    if (range.r.gen != hist->cache_gen)
+        range.hi = range.lo;
+    rb_ensure(hist_build_range, (VALUE)&range, hist_free_range, (VALUE)&range);
+    hist_update_cache(&range);
+    return range.entries;
+}
+
+/* Returns the cached string of the entry numbered +seq+ if the cache is
+ * still valid for generation +gen+ of the history, or Qnil. */
+static VALUE
+hist_cached(struct history *hist, unsigned long gen, unsigned long seq)
+{
+    if (NIL_P(hist->cache) || gen != hist->cache_gen ||
+        seq < hist->cache_seq ||
+        seq - hist->cache_seq >= (unsigned long)RARRAY_LEN(hist->cache))
+        return Qnil;
+    return RARRAY_AREF(hist->cache, seq - hist->cache_seq);
+}
+
+struct history_search {
+    struct history *hist;
+    int limit;
+    int reverse;
+    int indices;
+    VALUE regexp;
+    linenoiseHistoryMatches m;
+    linenoiseHistoryRange r;
+    char *lines;
+    const char **starts;    /* Start of every entry in lines, or NULL. */
+    VALUE result;
+};
+
+static VALUE
+hist_search_result(struct history_search *search, int index, VALUE str,
+                   const char *line)
+{
+    if (search->indices)
+        return INT2NUM(index);
+    if (NIL_P(str))
+        str = rb_obj_freeze(rb_locale_str_new_cstr(line));
+    return str;
+}
+
+static VALUE
+hist_search_literal(VALUE ptr)
+{
+    struct history_search *search = (struct history_search *)ptr;
+    const char *line = search->m.lines;
+    int i;
+
+    search->result = rb_ary_new_capa(search->m.count);
+    for (i = 0; i < search->m.count; i++) {
+        int index = search->m.indexes[i];
+        VALUE str = hist_cached(search->hist, search->m.gen,
+                                search->m.base + index);
+
+        rb_ary_push(search->result,
+                    hist_search_result(search, index, str, line));
+        line += strlen(line) + 1;
+    }
+    return search->result;
+}
+
+/* Matches every entry against the regexp. The entries that are not cached
+ * are matched through a single string instead of a string each. */
+static VALUE
+hist_search_regexp(VALUE ptr)
+{
+    struct history_search *search = (struct history_search *)ptr;
+    struct history *hist = search->hist;
+    VALUE buf = rb_str_buf_new(0);
+    const char *line = search->lines;
+    int i;
+
+    rb_enc_associate(buf, rb_locale_encoding());
+    search->result = rb_ary_new();
+    search->starts = malloc(sizeof(char *) * (search->r.count + 1));
+    if (search->starts == NULL)
+        rb_memerror();
+    for (i = 0; i < search->r.count; i++) {
+        search->starts[i] = NULL;
+        if (NIL_P(hist_cached(hist, search->r.gen, search->r.seq + i))) {
+            search->starts[i] = line;
+            line += strlen(line) + 1;
+        }
+    }
+    for (i = 0; i < search->r.count; i++) {
+        int j = search->reverse ? search->r.count - 1 - i : i;
+        VALUE str = hist_cached(hist, search->r.gen, search->r.seq + j);
+
+        if (search->limit > 0 && RARRAY_LEN(search->result) == search->limit)
+            break;
+        if (NIL_P(str)) {
+            rb_str_set_len(buf, 0);
+            rb_str_cat_cstr(buf, search->starts[j]);
+            if (rb_reg_search(search->regexp, buf, 0, 0) < 0)
+                continue;
+        } else if (rb_reg_search(search->regexp, str, 0, 0) < 0) {
+            continue;
+        }
+        rb_ary_push(search->result,
+                    hist_search_result(search, j, str, search->starts[j]));
+    }
+    return search->result;
+}
+
+static VALUE
+hist_search_free(VALUE ptr)
+{
+    struct history_search *search = (struct history_search *)ptr;
+
+    linenoiseHistoryMatchesFree(&search->m);
+    free(search->lines);
+    free(search->starts);
+    return Qnil;
+}
+
+/* Returns true if the regexp matches its source as is. */
+static int
+regexp_is_literal(VALUE re)
+{
+    const char *p = RREGEXP_SRC_PTR(re);
+    long i, len = RREGEXP_SRC_LEN(re);
+
+    if (rb_reg_options(re) & (ONIG_OPTION_IGNORECASE | ONIG_OPTION_EXTEND))
+        return 0;
+    for (i = 0; i < len; i++) {
+        if (strchr("\\^$.|?*+()[]{}#", p[i]) || p[i] == '\0')
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * call-seq:
+ *   Linenoise::HISTORY.search(pattern, limit: nil, reverse: false,
+ *                             indices: false) -> array
+ *
+ * Returns the entries containing +pattern+, a string, or matching it, a
+ * regexp, oldest first. Unlike +grep+, only the entries found are turned
+ * into (frozen) strings. Strings, and regexps without any special
+ * character, are searched in C with SIMD instructions when available.
+ *
+ * +limit+:: stop after this number of entries
+ * +reverse+:: search newest entries first
+ * +indices+:: return the indices of the entries instead
+ *
+ *   Linenoise::HISTORY.search('git', limit: 10, reverse: true)
+ *   Linenoise::HISTORY.search(/^rm -rf/, indices: true)
+ */
+static VALUE
+hist_search(int argc, VALUE *argv, VALUE self)
+{
+    struct history_search search;
+    VALUE pattern, opts, values[3];
+    ID keywords[3];
+
+    rb_scan_args(argc, argv, "1:", &pattern, &opts);
+    keywords[0] = id_limit;
+    keywords[1] = id_reverse;
+    keywords[2] = id_indices;
+    rb_get_kwargs(opts, keywords, 0, 3, values);
+
+    memset(&search, 0, sizeof(search));
+    search.hist = rb_check_typeddata(self, &history_type);
+    search.limit = values[0] == Qundef || NIL_P(values[0]) ? 0 :
+                   NUM2INT(values[0]);
+    search.reverse = values[1] != Qundef && RTEST(values[1]);
+    search.indices = values[2] != Qundef && RTEST(values[2]);
+    search.result = Qnil;
+    if (search.limit < 0)
+        rb_raise(rb_eArgError, "negative limit");
+
+    if (RB_TYPE_P(pattern, T_REGEXP) && regexp_is_literal(pattern))
+        pattern = rb_str_new(RREGEXP_SRC_PTR(pattern),
+                             RREGEXP_SRC_LEN(pattern));
+    if (RB_TYPE_P(pattern, T_REGEXP)) {
+        struct history *hist = search.hist;
+        unsigned long lo = hist->cache_seq;
+        unsigned long hi = NIL_P(hist->cache) ? lo :
+                           lo + RARRAY_LEN(hist->cache);
+
+        search.regexp = pattern;
+        search.lines = linenoiseEditorHistoryRange(get_history(self), 0,
+                                                   INT_MAX, hist->cache_gen,
+                                                   lo, hi, &search.r);
+        if (search.lines == NULL)
+            rb_memerror();
+        rb_ensure(hist_search_regexp, (VALUE)&search,
+                  hist_search_free, (VALUE)&search);
+    } else {
+        StringValue(pattern);
+        if (linenoiseEditorHistorySearch(get_history(self),
+                                         RSTRING_PTR(pattern),
+                                         RSTRING_LEN(pattern), search.limit,
+                                         search.reverse, &search.m) == -1)
+            rb_memerror();
+        rb_ensure(hist_search_literal, (VALUE)&search,
+                  hist_search_free, (VALUE)&search);
+    }
+    RB_GC_GUARD(pattern);
+    return search.result;
+}
+
+/*
+ * call-seq:
+ *   Linenoise::HISTORY.to_a -> array
+ *
+ * Returns the entries, oldest first. The strings are frozen, and the same
+ * objects are returned again as long as the entries don't change.
+ */
+static VALUE
+hist_to_a(VALUE self)
+{
+    return hist_entries(self, 0, INT_MAX);
+}
+
+/*
+ * Iterates over a copy of the history, so the block sees the entries as
+ * they were when the iteration started, even if the history is changed
+ * meanwhile.
+ */
+static VALUE
+hist_each(VALUE self)
+{
+    VALUE entries;
+    long i;
+
+    RETURN_ENUMERATOR(self, 0, 0);
+
+    entries = hist_to_a(self);
+    for (i = 0; i < RARRAY_LEN(entries); i++)
+        rb_yield(RARRAY_AREF(entries, i));
+    return self;
+}
+
+/*
+ * call-seq:
+ *   Linenoise::HISTORY.reverse_each { |line| ... } -> history
+ *
+ * Iterates over a copy of the history like #each, newest entry first.
+ */
+static VALUE
+hist_reverse_each(VALUE self)
 {
-    return INT2NUM(linenoiseHistorySize());
+    VALUE entries;
+    long i;
+
+    RETURN_ENUMERATOR(self, 0, 0);
+
+    entries = hist_to_a(self);
+    for (i = RARRAY_LEN(entries) - 1; i >= 0; i--)
+        rb_yield(RARRAY_AREF(entries, i));
+    return self;
 }
 
+/*
+ * call-seq:
+ *   Linenoise::HISTORY.last -> string or nil
+ *   Linenoise::HISTORY.last(n) -> array
+ *
+ * Returns the newest entry, or the +n+ newest ones, oldest first.
+ */
 static VALUE
-hist_each(VALUE self)
+hist_last(int argc, VALUE *argv, VALUE self)
 {
-    char *line;
-    int i;
-
-    RETURN_ENUMERATOR(self, 0, 0);
+    VALUE n, entries;
+    int count;
 
-    for (i = 0; i < linenoiseHistorySize(); i++) {
-        line = linenoiseHistoryGet(i);
-        if (line == NULL)
-            break;
-        rb_yield(rb_locale_str_new_cstr(line));
+    rb_scan_args(argc, argv, "01", &n);
+    if (NIL_P(n)) {
+        entries = hist_entries(self, -1, 1);
+        return RARRAY_LEN(entries) ? RARRAY_AREF(entries, 0) : Qnil;
     }
-    return self;
+    count = NUM2INT(n);
+    if (count < 0)
+        rb_raise(rb_eArgError, "negative array size");
+    return count ? hist_entries(self, -count, count) : rb_ary_new();
 }
 
+/*
+ * call-seq:
+ *   Linenoise::HISTORY[index] -> string
+ *   Linenoise::HISTORY[start, length] -> array or nil
+ *   Linenoise::HISTORY[range] -> array or nil
+ *
+ * Returns the entry at +index+, raising IndexError if there is none, or the
+ * entries of a slice, like Array#[]. The entries of a slice are frozen
+ * strings, see #to_a.
+ */
 static VALUE
-hist_get(VALUE self, VALUE index)
+hist_get(int argc, VALUE *argv, VALUE self)
 {
+    linenoiseEditor *le = get_history(self);
     char *line = NULL;
+    VALUE index, length, str;
+    long beg, len, size;
     int i;
 
+    rb_scan_args(argc, argv, "11", &index, &length);
+    if (argc == 2 || !FIXNUM_P(index)) {
+        size = linenoiseEditorHistorySize(le);
+        if (argc == 2) {
+            beg = NUM2LONG(index);
+            len = NUM2LONG(length);
+            if (beg < 0)
+                beg += size;
+            if (beg < 0 || beg > size || len < 0)
+                return Qnil;
+        } else {
+            switch (rb_range_beg_len(index, &beg, &len, size, 0)) {
+              case Qfalse:
+                goto single;
+              case Qnil:
+                return Qnil;
+            }
+        }
+        if (len > INT_MAX)
+            len = INT_MAX;
+        return hist_entries(self, (int)beg, (int)len);
+    }
+
+  single:
     i = NUM2INT(index);
     if (i < 0) {
-        i += linenoiseHistorySize();
+        i += linenoiseEditorHistorySize(le);
     }
     if (i >= 0) {
-        line = linenoiseHistoryGet(i);
+        line = linenoiseEditorHistoryDup(le, i);
     }
     if (line == NULL) {
         rb_raise(rb_eIndexError, "invalid index");
     }
-    return rb_locale_str_new_cstr(line);
+    str = rb_locale_str_new_cstr(line);
+    free(line);
+    return str;
 }
 
 static VALUE
 hist_set(VALUE self, VALUE index, VALUE str)
 {
+    linenoiseEditor *le = get_history(self);
     char *old_line = NULL;
     int i;
 
     i = NUM2INT(index);
     StringValueCStr(str);
     if (i < 0) {
-        i += linenoiseHistorySize();
+        i += linenoiseEditorHistorySize(le);
     }
     if (i >= 0) {
-        old_line = linenoiseHistoryReplaceLine(i, RSTRING_PTR(str));
+        old_line = linenoiseEditorHistoryReplaceLine(le, i, RSTRING_PTR(str));
     }
     if (old_line == NULL) {
         rb_raise(rb_eIndexError, "invalid index");
     }
+    free(old_line);
+    return str;
+}
+
+/*
+ * call-seq:
+ *   Linenoise::HISTORY.suggest(prefix) -> string or nil
+ *
+ * Returns the most recent history entry that starts with +prefix+ and is
+ * longer than it. This is the line {Linenoise.autosuggest} would show.
+ */
+static VALUE
+hist_suggest(VALUE self, VALUE prefix)
+{
+    char *line = linenoiseEditorHistorySuggest(get_history(self),
+                                               StringValueCStr(prefix));
+    VALUE str;
+
+    if (line == NULL)
+        return Qnil;
+    str = rb_locale_str_new_cstr(line);
+    free(line);
     return str;
 }
 
@@ -514,71 +2120,612 @@ hist_set(VALUE self, VALUE index, VALUE str)
 static VALUE
 hist_clear(VALUE self)
 {
-    linenoiseHistoryClear();
+    struct history *hist = rb_check_typeddata(self, &history_type);
+
+    hist->cache = Qnil;
+    linenoiseEditorHistoryClear(get_history(self));
+    return self;
+}
+
+static VALUE
+editor_alloc(VALUE klass)
+{
+    struct editor *ed;
+    VALUE self = TypedData_Make_Struct(klass, struct editor, &editor_type, ed);
+
+    ed->input = ed->output = Qnil;
+    ed->history = ed->completion_proc = ed->hint_proc = Qnil;
+    ed->multiline = ed->autosuggest = ed->completion_menu = Qnil;
+    ed->hint_color = ed->hint_bold = Qnil;
+    ed->highlight = ed->highlight_proc = Qnil;
+    ed->recorder = ed->columns = ed->escape_timeout = ed->bindings = Qnil;
+    ed->screen = NULL;
+    ed->le = linenoiseEditorNew();
+    if (ed->le == NULL)
+        rb_memerror();
+    linenoiseEditorSetData(ed->le, ed);
+    linenoiseEditorSetFreeHintsCallback(ed->le, linenoise_free_hint_function);
+    return self;
+}
+
+/* Renders the output of an editor into its Linenoise::Screen. */
+static ssize_t
+screen_write(linenoiseEditor *le, const void *buf, size_t len)
+{
+    struct editor *ed = linenoiseEditorGetData(le);
+
+    linenoiseScreenWrite(ed->screen, buf, len);
+    return len;
+}
+
+/* Returns the file descriptor of an IO, or the Integer itself. */
+static int
+io_fileno(VALUE io)
+{
+    if (FIXNUM_P(io))
+        return FIX2INT(io);
+    return NUM2INT(rb_funcall(io, id_fileno, 0));
+}
+
+/*
+ * call-seq:
+ *   Linenoise::Editor.new -> editor
+ *   Linenoise::Editor.new(input: io, output: io, raw_input: false) -> editor
+ *
+ * Creates an editor with an empty history and the same defaults as the
+ * {Linenoise} module: multiline mode on, no procs, default hint font.
+ *
+ * By default the editor reads from standard input and writes to standard
+ * output. +input+ and +output+ can be any IO objects (or file descriptors),
+ * for example the two ends of a PTY, which is switched to raw mode while a
+ * line is edited. The editor never closes them, and bypasses the buffers of
+ * +input+, so don't mix reads of your own with the editor's.
+ *
+ * +raw_input+ tells the editor that +input+ is not a terminal but sends every
+ * key as it is typed, like a socket talking to a telnet client in character
+ * mode. Enter may be sent as CR LF or CR NUL. Without it, lines from such
+ * input are read as plain text.
+ *
+ * +output+ may also be a {Linenoise::Screen}, whose size is used as the size
+ * of the terminal.
+ *
+ *   master, slave = PTY.open
+ *   editor = Linenoise::Editor.new(input: slave, output: slave)
+ *
+ *   client = server.accept
+ *   editor = Linenoise::Editor.new(input: client, output: client,
+ *                                  raw_input: true)
+ */
+static VALUE
+editor_initialize(int argc, VALUE *argv, VALUE self)
+{
+    struct editor *ed = get_editor(self);
+    struct history *hist;
+    ID keywords[3];
+    VALUE opts, values[3];
+
+    rb_scan_args(argc, argv, "0:", &opts);
+    keywords[0] = id_input;
+    keywords[1] = id_output;
+    keywords[2] = id_raw_input;
+    rb_get_kwargs(opts, keywords, 0, 3, values);
+    ed->input = values[0] == Qundef ? Qnil : values[0];
+    ed->output = values[1] == Qundef ? Qnil : values[1];
+    if (rb_typeddata_is_kind_of(ed->output, &screen_type)) {
+        int rows, cols;
+
+        ed->screen = get_screen(ed->output);
+        linenoiseScreenSize(ed->screen, &rows, &cols);
+        linenoiseEditorSetWriteCallback(ed->le, screen_write);
+        linenoiseEditorSetColumns(ed->le, cols);
+        linenoiseEditorSetRows(ed->le, rows);
+    }
+    linenoiseEditorSetFds(ed->le,
+                          NIL_P(ed->input) ? 0 : io_fileno(ed->input),
+                          ed->screen ? -1 :
+                          NIL_P(ed->output) ? 1 : io_fileno(ed->output));
+    linenoiseEditorSetRawInput(ed->le, values[2] != Qundef && RTEST(values[2]));
+
+    ed->history = TypedData_Make_Struct(cHistory, struct history,
+                                        &history_type, hist);
+    hist->editor = self;
+    hist->cache = Qnil;
+
+    linenoise_set_multiline(self, Qtrue);
+    linenoise_set_autosuggest(self, Qfalse);
+    linenoise_set_completion_menu(self, Qfalse);
+    linenoise_set_hint_color(self, Qnil);
+    linenoise_set_hint_boldness(self, Qfalse);
+    linenoise_set_highlight(self, Qfalse);
+    linenoise_set_escape_timeout(self, DBL2NUM(0.05));
+    ed->bindings = rb_hash_new();
+    return self;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.history -> history
+ *   editor.history -> history
+ *
+ * Returns the history of the editor. It responds to the same methods as
+ * {Linenoise::HISTORY}.
+ *
+ * In the main Ractor Linenoise.history is {Linenoise::HISTORY}. Other
+ * Ractors can't access that constant, and get the history of their own
+ * default editor instead.
+ */
+static VALUE
+editor_history(VALUE self)
+{
+    return get_editor(self)->history;
+}
+
+/*
+ * call-seq:
+ *   editor.input -> io or nil
+ *
+ * Returns the input given to {Linenoise::Editor.new}, or nil for standard
+ * input.
+ */
+static VALUE
+editor_input(VALUE self)
+{
+    return get_editor(self)->input;
+}
+
+/*
+ * call-seq:
+ *   editor.output -> io or nil
+ *
+ * Returns the output given to {Linenoise::Editor.new}, or nil for standard
+ * output.
+ */
+static VALUE
+editor_output(VALUE self)
+{
+    return get_editor(self)->output;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.recorder = io or nil -> io or nil
+ *   editor.recorder = io or nil -> io or nil
+ *
+ * Records the lines edited from now on to +io+, or stops recording when
+ * +nil+. Everything read from and written to the terminal while a line is
+ * edited is written to +io+ in a compact binary log, with its timing, so
+ * that the session can be replayed later with {Linenoise::Replay}, to
+ * reproduce a bug or to profile the editor. The log is written to the file
+ * descriptor of +io+ directly, which is never closed by the editor.
+ *
+ *   Linenoise.recorder = File.open('session.lnrec', 'wb')
+ */
+static VALUE
+linenoise_set_recorder(VALUE self, VALUE io)
+{
+    struct editor *ed = get_editor(self);
+
+    if (ed->busy)
+        rb_raise(rb_eRuntimeError, "editor is already reading a line");
+    if (NIL_P(io)) {
+        linenoiseEditorRecord(ed->le, -1);
+    } else {
+        if (RB_TYPE_P(io, T_FILE))
+            rb_io_flush(io);
+        if (linenoiseEditorRecord(ed->le, io_fileno(io)) == -1)
+            rb_sys_fail("linenoiseEditorRecord");
+    }
+    return ed->recorder = io;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.recorder -> io or nil
+ *   editor.recorder -> io or nil
+ *
+ * Returns the IO lines are recorded to, see {Linenoise.recorder=}.
+ */
+static VALUE
+linenoise_get_recorder(VALUE self)
+{
+    return get_editor(self)->recorder;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.columns = integer or nil -> integer or nil
+ *   editor.columns = integer or nil -> integer or nil
+ *
+ * Specifies the width of the terminal, in columns. By default, or when
+ * +nil+, the width is asked to the terminal every time a line is read, or
+ * is the width of the {Linenoise::Screen} written to. Set it when the output
+ * is not a terminal, a socket for instance.
+ *
+ *   editor = Linenoise::Editor.new(input: socket, output: socket,
+ *                                  raw_input: true)
+ *   editor.columns = 80
+ */
+static VALUE
+linenoise_set_columns(VALUE self, VALUE cols)
+{
+    struct editor *ed = get_editor(self);
+    int n = NIL_P(cols) ? 0 : NUM2INT(cols);
+
+    if (n < 0)
+        rb_raise(rb_eArgError, "negative number of columns");
+    if (n == 0 && ed->screen) {
+        int rows, screen_cols;
+
+        linenoiseScreenSize(ed->screen, &rows, &screen_cols);
+        linenoiseEditorSetColumns(ed->le, screen_cols);
+    } else {
+        linenoiseEditorSetColumns(ed->le, n);
+    }
+    return ed->columns = n ? cols : Qnil;
+}
+
+/*
+ * call-seq:
+ *   Linenoise.columns -> integer or nil
+ *   editor.columns -> integer or nil
+ *
+ * Returns the width set with {Linenoise.columns=}, or +nil+.
+ */
+static VALUE
+linenoise_get_columns(VALUE self)
+{
+    return get_editor(self)->columns;
+}
+
+static VALUE
+screen_alloc(VALUE klass)
+{
+    return TypedData_Wrap_Struct(klass, &screen_type, NULL);
+}
+
+/*
+ * call-seq:
+ *   Linenoise::Screen.new(rows: 24, columns: 80) -> screen
+ *
+ * Creates a blank screen with the cursor at the top left corner.
+ */
+static VALUE
+screen_initialize(int argc, VALUE *argv, VALUE self)
+{
+    ID keywords[2];
+    VALUE opts, values[2];
+    int rows, cols;
+
+    rb_scan_args(argc, argv, "0:", &opts);
+    keywords[0] = id_rows;
+    keywords[1] = id_columns;
+    rb_get_kwargs(opts, keywords, 0, 2, values);
+    rows = values[0] == Qundef ? 24 : NUM2INT(values[0]);
+    cols = values[1] == Qundef ? 80 : NUM2INT(values[1]);
+    if (rows < 1 || cols < 1)
+        rb_raise(rb_eArgError, "a screen has at least one row and column");
+    if (DATA_PTR(self))
+        rb_raise(rb_eRuntimeError, "screen already initialized");
+    DATA_PTR(self) = linenoiseScreenNew(rows, cols);
+    if (DATA_PTR(self) == NULL)
+        rb_memerror();
+    return self;
+}
+
+/*
+ * call-seq:
+ *   screen.write(string) -> integer
+ *
+ * Interprets +string+ as the output of a program, and returns its size in
+ * bytes. Every write is a frame in the {#stats}.
+ */
+static VALUE
+screen_write_string(VALUE self, VALUE str)
+{
+    linenoiseScreen *screen = get_screen(self);
+
+    StringValue(str);
+    linenoiseScreenWrite(screen, RSTRING_PTR(str), RSTRING_LEN(str));
+    return LONG2NUM(RSTRING_LEN(str));
+}
+
+/*
+ * call-seq:
+ *   screen.rows -> integer
+ */
+static VALUE
+screen_rows(VALUE self)
+{
+    int rows, cols;
+
+    linenoiseScreenSize(get_screen(self), &rows, &cols);
+    return INT2NUM(rows);
+}
+
+/*
+ * call-seq:
+ *   screen.columns -> integer
+ */
+static VALUE
+screen_columns(VALUE self)
+{
+    int rows, cols;
+
+    linenoiseScreenSize(get_screen(self), &rows, &cols);
+    return INT2NUM(cols);
+}
+
+/*
+ * call-seq:
+ *   screen.cursor -> [row, column]
+ *
+ * Returns the position of the cursor, starting from 0.
+ */
+static VALUE
+screen_cursor(VALUE self)
+{
+    int row, col;
+
+    linenoiseScreenCursor(get_screen(self), &row, &col);
+    return rb_assoc_new(INT2NUM(row), INT2NUM(col));
+}
+
+/*
+ * call-seq:
+ *   screen.lines -> array
+ *
+ * Returns the text of every row, without trailing blanks.
+ */
+static VALUE
+screen_lines(VALUE self)
+{
+    linenoiseScreen *screen = get_screen(self);
+    int rows, cols, row;
+    VALUE lines;
+
+    linenoiseScreenSize(screen, &rows, &cols);
+    lines = rb_ary_new_capa(rows);
+    for (row = 0; row < rows; row++) {
+        char *line = linenoiseScreenLine(screen, row);
+
+        if (line == NULL)
+            rb_memerror();
+        rb_ary_push(lines, rb_utf8_str_new_cstr(line));
+        free(line);
+    }
+    return lines;
+}
+
+/*
+ * call-seq:
+ *   screen.to_s -> string
+ *
+ * Returns the text of the screen, without the blank rows at the bottom.
+ */
+static VALUE
+screen_to_s(VALUE self)
+{
+    VALUE lines = screen_lines(self);
+
+    while (RARRAY_LEN(lines) > 0 &&
+           RSTRING_LEN(RARRAY_AREF(lines, RARRAY_LEN(lines) - 1)) == 0)
+        rb_ary_pop(lines);
+    return rb_ary_join(lines, rb_str_new_cstr("\n"));
+}
+
+/*
+ * call-seq:
+ *   screen.attributes(row, column) -> hash
+ *
+ * Returns the attributes of a cell: its +color+ (one of the hint colors,
+ * such as {Linenoise::RED}, a bright one from 90 to 97, or nil), and
+ * whether it is +bold+ and in +reverse+ video.
+ *
+ *   screen.attributes(0, 9) #=> {color: 35, bold: false, reverse: false}
+ */
+static VALUE
+screen_attributes(VALUE self, VALUE row, VALUE col)
+{
+    int color, flags;
+    VALUE hash;
+
+    flags = linenoiseScreenAttributes(get_screen(self), NUM2INT(row),
+                                      NUM2INT(col), &color);
+    if (flags == -1)
+        rb_raise(rb_eIndexError, "cell out of the screen");
+    hash = rb_hash_new();
+    rb_hash_aset(hash, ID2SYM(rb_intern("color")),
+                 color ? INT2NUM(color) : Qnil);
+    rb_hash_aset(hash, ID2SYM(rb_intern("bold")),
+                 flags & LINENOISE_SCREEN_BOLD ? Qtrue : Qfalse);
+    rb_hash_aset(hash, ID2SYM(rb_intern("reverse")),
+                 flags & LINENOISE_SCREEN_REVERSE ? Qtrue : Qfalse);
+    return hash;
+}
+
+/*
+ * call-seq:
+ *   screen.stats -> hash
+ *
+ * Returns the cost of rendering what was written to the screen. Every write
+ * is a frame; an editor writes a frame every time it refreshes the line.
+ *
+ * +frames+:: writes to the screen
+ * +bytes+:: bytes written
+ * +cells+:: cells whose content or attributes changed, scrolling aside
+ * +last_bytes+, +last_cells+:: the same for the last frame
+ * +scrolls+:: rows scrolled off the top of the screen
+ * +bells+:: bells rung
+ */
+static VALUE
+screen_stats(VALUE self)
+{
+    linenoiseScreenStats stats;
+    VALUE hash = rb_hash_new();
+
+    linenoiseScreenGetStats(get_screen(self), &stats);
+    rb_hash_aset(hash, ID2SYM(rb_intern("frames")), ULL2NUM(stats.frames));
+    rb_hash_aset(hash, ID2SYM(rb_intern("bytes")), ULL2NUM(stats.bytes));
+    rb_hash_aset(hash, ID2SYM(rb_intern("cells")), ULL2NUM(stats.cells));
+    rb_hash_aset(hash, ID2SYM(rb_intern("last_bytes")),
+                 ULL2NUM(stats.last_bytes));
+    rb_hash_aset(hash, ID2SYM(rb_intern("last_cells")),
+                 ULL2NUM(stats.last_cells));
+    rb_hash_aset(hash, ID2SYM(rb_intern("scrolls")), ULL2NUM(stats.scrolls));
+    rb_hash_aset(hash, ID2SYM(rb_intern("bells")), ULL2NUM(stats.bells));
+    return hash;
+}
+
+/*
+ * call-seq:
+ *   screen.reset_stats -> self
+ */
+static VALUE
+screen_reset_stats(VALUE self)
+{
+    linenoiseScreenResetStats(get_screen(self));
+    return self;
+}
+
+/*
+ * call-seq:
+ *   screen.reset -> self
+ *
+ * Blanks the screen and moves the cursor to the top left corner. The
+ * {#stats} are kept.
+ */
+static VALUE
+screen_reset(VALUE self)
+{
+    linenoiseScreenReset(get_screen(self));
     return self;
 }
 
+/* Defines +func+ both as a singleton method of Linenoise, acting on the
+ * default editor, and as a method of Linenoise::Editor. */
+static void
+define_editor_method(const char *name, VALUE (*func)(ANYARGS), int argc)
+{
+    rb_define_singleton_method(mLinenoise, name, func, argc);
+    rb_define_method(cEditor, name, func, argc);
+}
+
 void
 Init_linenoise(void)
 {
-    VALUE history;
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+    rb_ext_ractor_safe(true);
+#endif
 
     id_call = rb_intern("call");
-    id_multiline = rb_intern("multiline");
-    id_hint_bold = rb_intern("hint_bold");
-    id_hint_color = rb_intern("hint_color");
-
-    completion_proc = rb_intern(COMPLETION_PROC);
-    hint_proc = rb_intern(HINT_PROC);
+    id_fileno = rb_intern("fileno");
+    id_input = rb_intern("input");
+    id_output = rb_intern("output");
+    id_raw_input = rb_intern("raw_input");
+    id_rows = rb_intern("rows");
+    id_columns = rb_intern("columns");
+    id_limit = rb_intern("limit");
+    id_reverse = rb_intern("reverse");
+    id_indices = rb_intern("indices");
+    id_history = rb_intern("history");
 
     mLinenoise = rb_define_module("Linenoise");
     /* Version string of Linenoise. */
-    rb_define_const(mLinenoise, "VERSION", rb_str_new_cstr("1.0"));
+    rb_define_const(mLinenoise, "VERSION", rb_obj_freeze(rb_str_new_cstr("1.0")));
+
+    cEditor = rb_define_class_under(mLinenoise, "Editor", rb_cObject);
+    rb_define_alloc_func(cEditor, editor_alloc);
+    rb_define_method(cEditor, "initialize", editor_initialize, -1);
+    rb_define_method(cEditor, "input", editor_input, 0);
+    rb_define_method(cEditor, "output", editor_output, 0);
+
     rb_define_module_function(mLinenoise, "linenoise",
                               linenoise_linenoise, 1);
     rb_define_alias(rb_singleton_class(mLinenoise), "readline", "linenoise");
-    rb_define_singleton_method(mLinenoise, "completion_proc=",
-                               linenoise_set_completion_proc, 1);
-    rb_define_singleton_method(mLinenoise, "completion_proc",
-                               linenoise_get_completion_proc, 0);
-    rb_define_singleton_method(mLinenoise, "multiline=",
-                               linenoise_set_multiline, 1);
-    rb_define_singleton_method(mLinenoise, "multiline?",
-                               linenoise_get_multiline, 0);
-    rb_define_singleton_method(mLinenoise, "hint_proc=",
-                               linenoise_set_hint_proc, 1);
-    rb_define_singleton_method(mLinenoise, "hint_proc",
-                               linenoise_get_hint_proc, 0);
-    rb_define_singleton_method(mLinenoise, "hint_color=",
-                               linenoise_set_hint_color, 1);
-    rb_define_singleton_method(mLinenoise, "hint_color",
-                               linenoise_get_hint_color, 0);
-    rb_define_singleton_method(mLinenoise, "hint_bold=",
-                               linenoise_set_hint_boldness, 1);
-    rb_define_singleton_method(mLinenoise, "hint_bold?",
-                               linenoise_get_hint_boldness, 0);
-    rb_define_singleton_method(mLinenoise, "clear_screen",
-                               linenoise_clear_screen, 0);
-
-    history = rb_obj_alloc(rb_cObject);
-    rb_extend_object(history, rb_mEnumerable);
-    rb_define_singleton_method(history, "max_size=", hist_set_max_len, 1);
-    rb_define_singleton_method(history, "<<", hist_push, 1);
-    rb_define_singleton_method(history, "push", hist_push_method, -1);
-    rb_define_singleton_method(history, "save", hist_save, 1);
-    rb_define_singleton_method(history, "load", hist_load, 1);
-    rb_define_singleton_method(history, "size", hist_length, 0);
-    rb_define_singleton_method(history, "clear", hist_clear, 0);
-    rb_define_singleton_method(history, "each", hist_each, 0);
-    rb_define_singleton_method(history, "[]", hist_get, 1);
-    rb_define_singleton_method(history, "[]=", hist_set, 2);
+    rb_define_method(cEditor, "linenoise", linenoise_linenoise, 1);
+    rb_define_alias(cEditor, "readline", "linenoise");
+    define_editor_method("completion_proc=", linenoise_set_completion_proc, 1);
+    define_editor_method("completion_proc", linenoise_get_completion_proc, 0);
+    define_editor_method("completion_menu=", linenoise_set_completion_menu, 1);
+    define_editor_method("completion_menu?", linenoise_get_completion_menu, 0);
+    define_editor_method("multiline=", linenoise_set_multiline, 1);
+    define_editor_method("multiline?", linenoise_get_multiline, 0);
+    define_editor_method("autosuggest=", linenoise_set_autosuggest, 1);
+    define_editor_method("autosuggest?", linenoise_get_autosuggest, 0);
+    define_editor_method("hint_proc=", linenoise_set_hint_proc, 1);
+    define_editor_method("hint_proc", linenoise_get_hint_proc, 0);
+    define_editor_method("hint_color=", linenoise_set_hint_color, 1);
+    define_editor_method("hint_color", linenoise_get_hint_color, 0);
+    define_editor_method("hint_bold=", linenoise_set_hint_boldness, 1);
+    define_editor_method("hint_bold?", linenoise_get_hint_boldness, 0);
+    define_editor_method("highlight=", linenoise_set_highlight, 1);
+    define_editor_method("highlight?", linenoise_get_highlight, 0);
+    define_editor_method("highlight_proc=", linenoise_set_highlight_proc, 1);
+    define_editor_method("highlight_proc", linenoise_get_highlight_proc, 0);
+    define_editor_method("clear_screen", linenoise_clear_screen, 0);
+    define_editor_method("history", editor_history, 0);
+    define_editor_method("stats_enabled=", linenoise_set_stats_enabled, 1);
+    define_editor_method("stats_enabled?", linenoise_get_stats_enabled, 0);
+    define_editor_method("stats", linenoise_stats, 0);
+    define_editor_method("reset_stats", linenoise_reset_stats, 0);
+    define_editor_method("recorder=", linenoise_set_recorder, 1);
+    define_editor_method("recorder", linenoise_get_recorder, 0);
+    define_editor_method("columns=", linenoise_set_columns, 1);
+    define_editor_method("columns", linenoise_get_columns, 0);
+    define_editor_method("escape_timeout=", linenoise_set_escape_timeout, 1);
+    define_editor_method("escape_timeout", linenoise_get_escape_timeout, 0);
+    define_editor_method("bind", linenoise_bind, 2);
+    define_editor_method("session", linenoise_session, 0);
+    define_editor_method("each_line", linenoise_each_line, -1);
+    rb_define_singleton_method(mLinenoise, "display_width",
+                               linenoise_display_width, 1);
+
+    cHistory = rb_define_class_under(mLinenoise, "History", rb_cObject);
+    rb_undef_alloc_func(cHistory);
+    rb_include_module(cHistory, rb_mEnumerable);
+    rb_define_method(cHistory, "max_size=", hist_set_max_len, 1);
+    rb_define_method(cHistory, "<<", hist_push, 1);
+    rb_define_method(cHistory, "push", hist_push_method, -1);
+    rb_define_method(cHistory, "save", hist_save, 1);
+    rb_define_method(cHistory, "load", hist_load, 1);
+    rb_define_method(cHistory, "size", hist_length, 0);
+    rb_define_method(cHistory, "clear", hist_clear, 0);
+    rb_define_method(cHistory, "each", hist_each, 0);
+    rb_define_method(cHistory, "reverse_each", hist_reverse_each, 0);
+    rb_define_method(cHistory, "to_a", hist_to_a, 0);
+    rb_define_method(cHistory, "last", hist_last, -1);
+    rb_define_method(cHistory, "[]", hist_get, -1);
+    rb_define_method(cHistory, "[]=", hist_set, 2);
+    rb_define_method(cHistory, "suggest", hist_suggest, 1);
+    rb_define_method(cHistory, "search", hist_search, -1);
+
+    cScreen = rb_define_class_under(mLinenoise, "Screen", rb_cObject);
+    rb_define_alloc_func(cScreen, screen_alloc);
+    rb_define_method(cScreen, "initialize", screen_initialize, -1);
+    rb_define_method(cScreen, "write", screen_write_string, 1);
+    rb_define_method(cScreen, "rows", screen_rows, 0);
+    rb_define_method(cScreen, "columns", screen_columns, 0);
+    rb_define_method(cScreen, "cursor", screen_cursor, 0);
+    rb_define_method(cScreen, "lines", screen_lines, 0);
+    rb_define_method(cScreen, "to_s", screen_to_s, 0);
+    rb_define_method(cScreen, "attributes", screen_attributes, 2);
+    rb_define_method(cScreen, "stats", screen_stats, 0);
+    rb_define_method(cScreen, "reset_stats", screen_reset_stats, 0);
+    rb_define_method(cScreen, "reset", screen_reset, 0);
+
+#ifdef HAVE_RB_EXT_RACTOR_SAFE
+    default_editor_key = rb_ractor_local_storage_value_newkey();
+#else
+    rb_gc_register_address(&default_editor);
+    default_editor = rb_class_new_instance(0, NULL, cEditor);
+#endif
 
     /*
      * The history buffer. It extends Enumerable module, so it behaves just like
      * an array. For example, gets the fifth content that the user input by
      * HISTORY[4].
      */
-    rb_define_const(mLinenoise, "HISTORY", history);
+    rb_define_const(mLinenoise, "HISTORY", get_editor(mLinenoise)->history);
 
     /* Hint color helpers */
     rb_define_const(mLinenoise, "DEFAULT", Qnil);
@@ -589,8 +2736,4 @@ Init_linenoise(void)
     rb_define_const(mLinenoise, "MAGENTA", INT2NUM(magenta));
     rb_define_const(mLinenoise, "CYAN", INT2NUM(cyan));
     rb_define_const(mLinenoise, "WHITE", INT2NUM(white));
-
-    rb_funcall(mLinenoise, rb_intern("multiline="), 1, Qtrue);
-    rb_funcall(mLinenoise, rb_intern("hint_color="), 1, Qnil);
-    rb_funcall(mLinenoise, rb_intern("hint_bold="), 1, Qfalse);
 }
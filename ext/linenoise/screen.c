@@ -0,0 +1,520 @@
+/* screen.c -- in-memory terminal for linenoise.
+ *
+ * A screen is a grid of cells and a cursor that interprets the output of
+ * the editor the way a terminal would: text, control characters and the
+ * CSI sequences emitted by the refresh functions (cursor movement, erase
+ * in line and in display, insertion and deletion of characters, colors).
+ * It makes the rendering testable, and measurable, without a
+ * pseudo-terminal.
+ *
+ * Like xterm, printing in the last column leaves the cursor there until the
+ * next character, which is printed at the start of the next row. A line
+ * feed on the last row scrolls the screen up. A grapheme cluster (combining
+ * marks, emoji sequences, flags) takes a single cell, or two for the double
+ * width ones, the right one being a "tail". Invalid UTF-8 shows as U+FFFD.
+ *
+ * Every function takes the lock of the screen, so that a thread can look at
+ * the screen while another one writes to it.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "screen.h"
+#include "utf8.h"
+
+#define SCREEN_CELL_BYTES 32
+#define SCREEN_MAX_PARAMS 16
+#define CELL_WIDE_TAIL 4    /* Right half of a double width cluster. */
+
+typedef struct screenCell {
+    char text[SCREEN_CELL_BYTES]; /* Cluster, NUL terminated, "" if blank. */
+    unsigned char color;          /* 30 to 37, or 0 for the default. */
+    unsigned char flags;          /* LINENOISE_SCREEN_* or CELL_WIDE_TAIL. */
+} screenCell;
+
+enum screenState {
+    STATE_GROUND,
+    STATE_ESCAPE,
+    STATE_CSI
+};
+
+struct linenoiseScreen {
+    pthread_mutex_t lock;
+    int rows, cols;
+    screenCell *cells;
+    int row, col;           /* Cursor. */
+    int wrap_pending;       /* The last column was printed, see above. */
+    int last_row, last_col; /* Cell of the last cluster printed, or -1. */
+    unsigned char color;    /* Attributes of the text printed. */
+    unsigned char flags;
+
+    /* Parser state, sequences may be split across writes. */
+    enum screenState state;
+    int params[SCREEN_MAX_PARAMS];
+    int nparams;
+    int private_seq;        /* CSI ? ... sequence, ignored. */
+    char utf8[4];           /* Incomplete UTF-8 sequence. */
+    size_t utf8_len, utf8_need;
+
+    linenoiseScreenStats stats;
+};
+
+static const char replacement[] = "\xef\xbf\xbd"; /* U+FFFD */
+
+static screenCell *cellAt(linenoiseScreen *s, int row, int col) {
+    return &s->cells[row*s->cols+col];
+}
+
+/* Set a cell, counting it in the stats if it actually changes. */
+static void setCell(linenoiseScreen *s, int row, int col, const char *text,
+                    size_t len, unsigned char color, unsigned char flags)
+{
+    screenCell cell, *old = cellAt(s,row,col);
+
+    memset(&cell,0,sizeof(cell));
+    memcpy(cell.text,text,len);
+    cell.color = color;
+    cell.flags = flags;
+    if (memcmp(old,&cell,sizeof(cell)) != 0) {
+        *old = cell;
+        s->stats.last_cells++;
+    }
+}
+
+static void blankCells(linenoiseScreen *s, int row, int from, int to) {
+    int col;
+
+    for (col = from; col < to; col++) setCell(s,row,col,"",0,0,0);
+}
+
+/* Overwriting half of a double width cluster blanks the other half. */
+static void splitWide(linenoiseScreen *s, int row, int col) {
+    if (cellAt(s,row,col)->flags & CELL_WIDE_TAIL) {
+        if (col > 0) blankCells(s,row,col-1,col);
+    } else if (col+1 < s->cols &&
+               cellAt(s,row,col+1)->flags & CELL_WIDE_TAIL)
+    {
+        blankCells(s,row,col+1,col+2);
+    }
+}
+
+/* Any cursor movement ends the pending wrap, and the next code point can't
+ * be part of the cluster printed before. */
+static void moveCursor(linenoiseScreen *s, int row, int col) {
+    if (row < 0) row = 0;
+    if (row >= s->rows) row = s->rows-1;
+    if (col < 0) col = 0;
+    if (col >= s->cols) col = s->cols-1;
+    s->row = row;
+    s->col = col;
+    s->wrap_pending = 0;
+    s->last_row = -1;
+}
+
+static void lineFeed(linenoiseScreen *s) {
+    if (s->row < s->rows-1) {
+        s->row++;
+        return;
+    }
+    memmove(s->cells,s->cells+s->cols,
+            sizeof(screenCell)*(size_t)s->cols*(s->rows-1));
+    memset(cellAt(s,s->rows-1,0),0,sizeof(screenCell)*s->cols);
+    s->stats.scrolls++;
+    if (s->last_row >= 0) s->last_row--;
+}
+
+/* Move the cursor right after printing 'width' columns. */
+static void advance(linenoiseScreen *s, int width) {
+    s->col += width;
+    if (s->col >= s->cols) {
+        s->col = s->cols-1;
+        s->wrap_pending = 1;
+    }
+}
+
+/* Append the code point to the last cluster printed if it extends it, as
+ * a combining mark does. Return 1 if appended. */
+static int extendCluster(linenoiseScreen *s, const char *text, size_t len) {
+    char buf[SCREEN_CELL_BYTES];
+    screenCell *cell;
+    size_t clen, oldw, neww;
+
+    if (s->last_row < 0 || (unsigned char)text[0] < 0x80) return 0;
+    cell = cellAt(s,s->last_row,s->last_col);
+    clen = strlen(cell->text);
+    if (clen == 0 || clen+len >= SCREEN_CELL_BYTES) return 0;
+    memcpy(buf,cell->text,clen);
+    memcpy(buf+clen,text,len);
+    if (linenoiseUtf8NextLen(buf,0,clen+len) != clen+len) return 0;
+
+    oldw = linenoiseUtf8Width(cell->text,clen);
+    neww = linenoiseUtf8Width(buf,clen+len);
+    memcpy(cell->text,buf,clen+len);
+    s->stats.last_cells++;
+    /* A variation selector or a second regional indicator may make the
+     * cluster double width. */
+    if (neww == 2 && oldw == 1 && !s->wrap_pending &&
+        s->row == s->last_row && s->col == s->last_col+1)
+    {
+        splitWide(s,s->row,s->col);
+        setCell(s,s->row,s->col,"",0,cell->color,
+                cell->flags|CELL_WIDE_TAIL);
+        advance(s,1);
+    }
+    return 1;
+}
+
+static void printCluster(linenoiseScreen *s, const char *text, size_t len) {
+    int width;
+
+    if (extendCluster(s,text,len)) return;
+    width = linenoiseUtf8Width(text,len);
+    if (width == 0) return; /* Nothing to attach it to. */
+    if (width > s->cols) width = 1;
+    if (s->wrap_pending || s->col+width > s->cols) {
+        s->col = 0;
+        s->wrap_pending = 0;
+        lineFeed(s);
+    }
+    splitWide(s,s->row,s->col);
+    setCell(s,s->row,s->col,text,len,s->color,s->flags);
+    if (width == 2) {
+        splitWide(s,s->row,s->col+1);
+        setCell(s,s->row,s->col+1,"",0,s->color,s->flags|CELL_WIDE_TAIL);
+    }
+    s->last_row = s->row;
+    s->last_col = s->col;
+    advance(s,width);
+}
+
+static void control(linenoiseScreen *s, unsigned char c) {
+    switch(c) {
+    case '\r':
+        moveCursor(s,s->row,0);
+        break;
+    case '\n':
+        s->wrap_pending = 0;
+        s->last_row = -1;
+        lineFeed(s);
+        break;
+    case '\b':
+        moveCursor(s,s->row,s->col-1);
+        break;
+    case '\t':
+        moveCursor(s,s->row,(s->col/8+1)*8);
+        break;
+    case 7:
+        s->stats.bells++;
+        break;
+    }
+}
+
+static int param(linenoiseScreen *s, int j, int def) {
+    return j < s->nparams && s->params[j] ? s->params[j] : def;
+}
+
+static void selectGraphicRendition(linenoiseScreen *s) {
+    int j;
+
+    for (j = 0; j < s->nparams; j++) {
+        int p = s->params[j];
+
+        if (p == 0) {
+            s->color = 0;
+            s->flags = 0;
+        } else if (p == 1) {
+            s->flags |= LINENOISE_SCREEN_BOLD;
+        } else if (p == 7) {
+            s->flags |= LINENOISE_SCREEN_REVERSE;
+        } else if (p == 22) {
+            s->flags &= ~LINENOISE_SCREEN_BOLD;
+        } else if (p == 27) {
+            s->flags &= ~LINENOISE_SCREEN_REVERSE;
+        } else if ((p >= 30 && p <= 37) || (p >= 90 && p <= 97)) {
+            s->color = p;
+        } else if (p == 39) {
+            s->color = 0;
+        }
+    }
+}
+
+/* Copy the cell at 'from' to 'to', on the same row. */
+static void copyCell(linenoiseScreen *s, int row, int to, int from) {
+    screenCell *cell = cellAt(s,row,from);
+
+    setCell(s,row,to,cell->text,strlen(cell->text),cell->color,cell->flags);
+}
+
+/* Insert 'n' blank cells at the cursor, the cells pushed past the right
+ * margin being lost, or delete 'n' cells when 'n' is negative, blank cells
+ * coming in from the right margin. The cursor doesn't move. */
+static void shiftCells(linenoiseScreen *s, int n) {
+    screenCell *last = cellAt(s,s->row,s->cols-1);
+    int row = s->row, col;
+
+    splitWide(s,row,s->col);
+    if (n > 0) {
+        if (n > s->cols-s->col) n = s->cols-s->col;
+        for (col = s->cols-1; col >= s->col+n; col--)
+            copyCell(s,row,col,col-n);
+        blankCells(s,row,s->col,s->col+n);
+        /* The tail of a double width cluster may have been pushed out. */
+        if (!(last->flags & CELL_WIDE_TAIL) &&
+            linenoiseUtf8Width(last->text,strlen(last->text)) == 2)
+            blankCells(s,row,s->cols-1,s->cols);
+    } else {
+        n = -n;
+        if (n > s->cols-s->col) n = s->cols-s->col;
+        if (s->col+n < s->cols) splitWide(s,row,s->col+n);
+        for (col = s->col; col+n < s->cols; col++)
+            copyCell(s,row,col,col+n);
+        blankCells(s,row,s->cols-n,s->cols);
+    }
+    s->wrap_pending = 0;
+    s->last_row = -1;
+}
+
+static void dispatchCSI(linenoiseScreen *s, char final) {
+    int row;
+
+    if (s->private_seq) return;
+    switch(final) {
+    case 'A': moveCursor(s,s->row-param(s,0,1),s->col); break;
+    case 'B': moveCursor(s,s->row+param(s,0,1),s->col); break;
+    case 'C': moveCursor(s,s->row,s->col+param(s,0,1)); break;
+    case 'D': moveCursor(s,s->row,s->col-param(s,0,1)); break;
+    case 'H':
+    case 'f':
+        moveCursor(s,param(s,0,1)-1,param(s,1,1)-1);
+        break;
+    case 'K':
+        switch(param(s,0,0)) {
+        case 0: blankCells(s,s->row,s->col,s->cols); break;
+        case 1: blankCells(s,s->row,0,s->col+1); break;
+        case 2: blankCells(s,s->row,0,s->cols); break;
+        }
+        s->wrap_pending = 0;
+        break;
+    case 'J':
+        switch(param(s,0,0)) {
+        case 0:
+            blankCells(s,s->row,s->col,s->cols);
+            for (row = s->row+1; row < s->rows; row++)
+                blankCells(s,row,0,s->cols);
+            break;
+        case 1:
+            for (row = 0; row < s->row; row++) blankCells(s,row,0,s->cols);
+            blankCells(s,s->row,0,s->col+1);
+            break;
+        case 2:
+            for (row = 0; row < s->rows; row++) blankCells(s,row,0,s->cols);
+            break;
+        }
+        s->wrap_pending = 0;
+        break;
+    case '@': shiftCells(s,param(s,0,1)); break;
+    case 'P': shiftCells(s,-param(s,0,1)); break;
+    case 'm':
+        selectGraphicRendition(s);
+        break;
+    }
+}
+
+/* Print the incomplete UTF-8 sequence as a replacement character. */
+static void flushInvalid(linenoiseScreen *s) {
+    if (s->utf8_need == 0) return;
+    s->utf8_need = s->utf8_len = 0;
+    printCluster(s,replacement,sizeof(replacement)-1);
+}
+
+static void feed(linenoiseScreen *s, unsigned char c) {
+    switch(s->state) {
+    case STATE_GROUND:
+        if (s->utf8_need) {
+            if ((c & 0xC0) == 0x80) {
+                s->utf8[s->utf8_len++] = c;
+                if (s->utf8_len == s->utf8_need) {
+                    s->utf8_need = 0;
+                    printCluster(s,s->utf8,s->utf8_len);
+                }
+                return;
+            }
+            flushInvalid(s);
+        }
+        if (c == 27) {
+            s->state = STATE_ESCAPE;
+        } else if (c < 0x20 || c == 0x7f) {
+            control(s,c);
+        } else if (c < 0x80) {
+            printCluster(s,(char*)&c,1);
+        } else if (linenoiseUtf8SeqLen(c) == 1) {
+            printCluster(s,replacement,sizeof(replacement)-1);
+        } else {
+            s->utf8[0] = c;
+            s->utf8_len = 1;
+            s->utf8_need = linenoiseUtf8SeqLen(c);
+        }
+        break;
+    case STATE_ESCAPE:
+        if (c == '[') {
+            s->state = STATE_CSI;
+            s->params[0] = 0;
+            s->nparams = 1;
+            s->private_seq = 0;
+        } else {
+            s->state = STATE_GROUND; /* Other escapes are ignored. */
+        }
+        break;
+    case STATE_CSI:
+        if (c >= '0' && c <= '9') {
+            int *p = &s->params[s->nparams-1];
+            if (*p < 10000) *p = *p*10+(c-'0');
+        } else if (c == ';') {
+            if (s->nparams < SCREEN_MAX_PARAMS) s->params[s->nparams++] = 0;
+        } else if (c >= 0x3C && c <= 0x3F) {
+            s->private_seq = 1;
+        } else if (c >= 0x40 && c <= 0x7E) {
+            dispatchCSI(s,c);
+            s->state = STATE_GROUND;
+        } else if (c < 0x20 || c > 0x7E) {
+            s->state = STATE_GROUND; /* Malformed, drop it. */
+        }
+        break;
+    }
+}
+
+/* Create a screen of 'rows' by 'cols' cells, both at least 1. */
+linenoiseScreen *linenoiseScreenNew(int rows, int cols) {
+    linenoiseScreen *s;
+
+    if (rows < 1 || cols < 1) return NULL;
+    s = calloc(1,sizeof(*s));
+    if (s == NULL) return NULL;
+    s->cells = calloc((size_t)rows*cols,sizeof(screenCell));
+    if (s->cells == NULL) {
+        free(s);
+        return NULL;
+    }
+    s->rows = rows;
+    s->cols = cols;
+    s->last_row = -1;
+    pthread_mutex_init(&s->lock,NULL);
+    return s;
+}
+
+void linenoiseScreenFree(linenoiseScreen *s) {
+    if (s == NULL) return;
+    pthread_mutex_destroy(&s->lock);
+    free(s->cells);
+    free(s);
+}
+
+size_t linenoiseScreenMemsize(const linenoiseScreen *s) {
+    return sizeof(*s)+sizeof(screenCell)*(size_t)s->rows*s->cols;
+}
+
+/* Interpret 'len' bytes of output, counted as a frame in the stats. */
+void linenoiseScreenWrite(linenoiseScreen *s, const char *buf, size_t len) {
+    size_t j;
+
+    pthread_mutex_lock(&s->lock);
+    s->stats.last_cells = 0;
+    for (j = 0; j < len; j++) feed(s,buf[j]);
+    s->stats.frames++;
+    s->stats.bytes += len;
+    s->stats.last_bytes = len;
+    s->stats.cells += s->stats.last_cells;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* Blank the screen and move the cursor home, as a terminal reset does.
+ * The stats are kept. */
+void linenoiseScreenReset(linenoiseScreen *s) {
+    pthread_mutex_lock(&s->lock);
+    memset(s->cells,0,sizeof(screenCell)*(size_t)s->rows*s->cols);
+    s->row = s->col = s->wrap_pending = 0;
+    s->last_row = -1;
+    s->color = s->flags = 0;
+    s->state = STATE_GROUND;
+    s->utf8_len = s->utf8_need = 0;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void linenoiseScreenSize(linenoiseScreen *s, int *rows, int *cols) {
+    *rows = s->rows;
+    *cols = s->cols;
+}
+
+/* The cursor stays in the last column while a wrap is pending. */
+void linenoiseScreenCursor(linenoiseScreen *s, int *row, int *col) {
+    pthread_mutex_lock(&s->lock);
+    *row = s->row;
+    *col = s->col;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* Return the text of a row, without the trailing blanks, in a string to be
+ * released with free(). Returns NULL if the row is out of range or out of
+ * memory. */
+char *linenoiseScreenLine(linenoiseScreen *s, int row) {
+    char *line, *p;
+    int col;
+    size_t len = 0;
+
+    if (row < 0 || row >= s->rows) return NULL;
+    pthread_mutex_lock(&s->lock);
+    for (col = 0; col < s->cols; col++) {
+        size_t clen = strlen(cellAt(s,row,col)->text);
+        len += clen ? clen : 1;
+    }
+    p = line = malloc(len+1);
+    if (line == NULL) {
+        pthread_mutex_unlock(&s->lock);
+        return NULL;
+    }
+    for (col = 0; col < s->cols; col++) {
+        screenCell *cell = cellAt(s,row,col);
+        size_t clen = strlen(cell->text);
+
+        if (cell->flags & CELL_WIDE_TAIL) continue;
+        if (clen == 0) {
+            *p++ = ' ';
+        } else {
+            memcpy(p,cell->text,clen);
+            p += clen;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    while (p > line && p[-1] == ' ') p--;
+    *p = '\0';
+    return line;
+}
+
+/* Return the LINENOISE_SCREEN_* attributes of a cell and set '*color' to
+ * its color, 30 to 37 or 90 to 97, or 0 for the default one. Returns -1 if
+ * the cell is out of range. */
+int linenoiseScreenAttributes(linenoiseScreen *s, int row, int col,
+                              int *color)
+{
+    int flags;
+
+    if (row < 0 || row >= s->rows || col < 0 || col >= s->cols) return -1;
+    pthread_mutex_lock(&s->lock);
+    *color = cellAt(s,row,col)->color;
+    flags = cellAt(s,row,col)->flags & ~CELL_WIDE_TAIL;
+    pthread_mutex_unlock(&s->lock);
+    return flags;
+}
+
+void linenoiseScreenGetStats(linenoiseScreen *s, linenoiseScreenStats *stats) {
+    pthread_mutex_lock(&s->lock);
+    *stats = s->stats;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void linenoiseScreenResetStats(linenoiseScreen *s) {
+    pthread_mutex_lock(&s->lock);
+    memset(&s->stats,0,sizeof(s->stats));
+    pthread_mutex_unlock(&s->lock);
+}
@@ -0,0 +1,48 @@
+/* screen.h -- in-memory terminal for linenoise.
+ *
+ * See screen.c for more information.
+ */
+
+#ifndef __LINENOISE_SCREEN_H
+#define __LINENOISE_SCREEN_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Attributes of a cell, see linenoiseScreenAttributes(). */
+#define LINENOISE_SCREEN_BOLD 1
+#define LINENOISE_SCREEN_REVERSE 2
+
+/* Every write to the screen is a frame. */
+typedef struct linenoiseScreenStats {
+  unsigned long long frames;
+  unsigned long long bytes;
+  unsigned long long cells;       /* Cells changed, scrolling aside. */
+  unsigned long long last_bytes;  /* Bytes of the last frame. */
+  unsigned long long last_cells;  /* Cells changed by the last frame. */
+  unsigned long long scrolls;     /* Rows scrolled off the top. */
+  unsigned long long bells;
+} linenoiseScreenStats;
+
+typedef struct linenoiseScreen linenoiseScreen;
+
+linenoiseScreen *linenoiseScreenNew(int rows, int cols);
+void linenoiseScreenFree(linenoiseScreen *s);
+size_t linenoiseScreenMemsize(const linenoiseScreen *s);
+void linenoiseScreenWrite(linenoiseScreen *s, const char *buf, size_t len);
+void linenoiseScreenReset(linenoiseScreen *s);
+void linenoiseScreenSize(linenoiseScreen *s, int *rows, int *cols);
+void linenoiseScreenCursor(linenoiseScreen *s, int *row, int *col);
+char *linenoiseScreenLine(linenoiseScreen *s, int row);
+int linenoiseScreenAttributes(linenoiseScreen *s, int row, int col, int *color);
+void linenoiseScreenGetStats(linenoiseScreen *s, linenoiseScreenStats *stats);
+void linenoiseScreenResetStats(linenoiseScreen *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LINENOISE_SCREEN_H */
@@ -0,0 +1,27 @@
+/* utf8.h -- UTF-8 grapheme clusters and display width for linenoise.
+ *
+ * See utf8.c for more information.
+ */
+
+#ifndef __LINENOISE_UTF8_H
+#define __LINENOISE_UTF8_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int linenoiseIsAscii(const char *buf, size_t len);
+size_t linenoiseUtf8SeqLen(char lead);
+size_t linenoiseUtf8Width(const char *buf, size_t len);
+size_t linenoiseUtf8NextLen(const char *buf, size_t pos, size_t len);
+size_t linenoiseUtf8PrevLen(const char *buf, size_t pos);
+size_t linenoiseUtf8Fit(const char *buf, size_t len, size_t cols,
+                        size_t *width);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LINENOISE_UTF8_H */
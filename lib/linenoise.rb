@@ -1,2 +1,6 @@
 require 'linenoise/linenoise'
 require 'linenoise/version'
+
+module Linenoise
+  autoload :Replay, 'linenoise/replay'
+end
@@ -0,0 +1,204 @@
+require 'socket'
+require 'stringio'
+
+module Linenoise
+  # Replays the lines recorded with {Linenoise.recorder=}. Every line is
+  # edited again by a new editor, fed with the recorded input through a
+  # socket, and what the editor writes is collected so that it can be
+  # compared with the recorded output. A replay doesn't need a terminal,
+  # so it can run in a test, or under a profiler.
+  #
+  # The recording keeps the width of the terminal and the editing modes,
+  # other settings (history, procs) are set up by the block given to
+  # {#run}.
+  #
+  #   replay = Linenoise::Replay.new(File.binread('session.lnrec'))
+  #   replay.run { |editor| editor.completion_proc = COMPLETION }.each do |r|
+  #     warn "#{r.recorded.prompt}#{r.line} differs" unless r.identical?
+  #   end
+  class Replay
+    # First bytes of a log.
+    MAGIC = "LNREC1\n".b.freeze
+
+    # Raised when a log can't be parsed.
+    class FormatError < StandardError; end
+
+    # A recorded line. Events are <tt>[type, time, bytes]</tt> arrays, where
+    # type is +:input+ or +:output+ and time is in seconds since the line
+    # started. The line is +nil+ if the editor didn't return any.
+    Line = Struct.new(:prompt, :columns, :modes, :events, :line) do
+      def multiline?
+        modes & 1 != 0
+      end
+
+      def completion_menu?
+        modes & 2 != 0
+      end
+
+      def autosuggest?
+        modes & 4 != 0
+      end
+
+      # All the bytes read by the editor.
+      def input
+        bytes(:input)
+      end
+
+      # All the bytes written by the editor.
+      def output
+        bytes(:output)
+      end
+
+      private
+
+      def bytes(type)
+        events.each_with_object(''.b) do |event, buf|
+          buf << event[2] if event[0] == type
+        end
+      end
+    end
+
+    # The outcome of replaying a recorded line: the line returned by the
+    # editor and the bytes it wrote.
+    Result = Struct.new(:recorded, :line, :output) do
+      # True if the editor returned the same line and wrote the same bytes
+      # as when the line was recorded.
+      def identical?
+        line&.b == recorded.line && output == recorded.output
+      end
+
+      # A {Linenoise::Screen} as wide as the recorded terminal, showing the
+      # output of the replay.
+      def screen(rows: 24)
+        Screen.new(rows: rows, columns: recorded.columns).tap do |screen|
+          screen.write(output)
+        end
+      end
+    end
+
+    # The recorded lines.
+    attr_reader :lines
+
+    # +log+ is the content of a file written by {Linenoise.recorder=}.
+    def initialize(log)
+      @lines = parse(StringIO.new(log.b))
+    end
+
+    # Replays all the lines and returns their Result. The input is sent as
+    # fast as possible, or with its recorded timing when +realtime+ is true.
+    # The editor is yielded before every line is edited.
+    def run(realtime: false, &block)
+      lines.map { |line| replay(line, realtime, &block) }
+    end
+
+    private
+
+    def parse(io)
+      lines = []
+      current = nil
+      time = 0
+
+      raise FormatError, 'not a linenoise session log' unless magic?(io)
+
+      until io.eof?
+        type = io.getc
+        next if type == 'L' && magic?(io, 1)
+
+        time += read_varint(io) / 1e6
+        data = read_bytes(io, read_varint(io))
+        case type
+        when 'S'
+          payload = StringIO.new(data)
+          current = Line.new(nil, read_varint(payload), read_varint(payload),
+                             [])
+          current.prompt = payload.read
+          time = 0
+        when 'I', 'O'
+          current&.events&.push([type == 'I' ? :input : :output, time, data])
+        when 'E'
+          next unless current
+
+          current.line = data[1..-1] if data.start_with?("\0")
+          lines << current
+          current = nil
+        else
+          raise FormatError, "unknown record type #{type.inspect}"
+        end
+      end
+      lines << current if current
+      lines
+    end
+
+    # Checks that the magic follows, its first 'offset' bytes being read.
+    def magic?(io, offset = 0)
+      return true if io.read(MAGIC.bytesize - offset) == MAGIC[offset..-1]
+
+      raise FormatError, 'corrupted session log' if offset > 0
+
+      false
+    end
+
+    def read_varint(io)
+      value = shift = 0
+      loop do
+        byte = io.readbyte
+        value |= (byte & 0x7f) << shift
+        return value if byte < 0x80
+
+        shift += 7
+      end
+    rescue EOFError
+      raise FormatError, 'truncated session log'
+    end
+
+    def read_bytes(io, size)
+      data = io.read(size) || ''.b
+      raise FormatError, 'truncated session log' if data.bytesize < size
+
+      data
+    end
+
+    def replay(line, realtime)
+      keyboard, input = UNIXSocket.pair
+      output, terminal = UNIXSocket.pair
+      terminal.binmode
+      editor = Editor.new(input: input, output: output, raw_input: true)
+      editor.columns = line.columns
+      editor.multiline = line.multiline?
+      editor.completion_menu = line.completion_menu?
+      editor.autosuggest = line.autosuggest?
+      yield editor if block_given?
+
+      screen = Thread.new { terminal.read }
+      screen.report_on_exception = false
+      reader = Thread.new { editor.linenoise(line.prompt) }
+      send_input(keyboard, line, realtime)
+      result = reader.value
+      output.close
+      Result.new(line, result, screen.value)
+    ensure
+      [keyboard, input, output, terminal].compact.each do |io|
+        io.close unless io.closed?
+      end
+    end
+
+    # Sends the input, then the end of file, in case the log was truncated.
+    def send_input(keyboard, line, realtime)
+      start = now
+      line.events.each do |type, time, bytes|
+        next unless type == :input
+
+        if realtime
+          delay = start + time - now
+          sleep(delay) if delay > 0
+        end
+        keyboard.write(bytes)
+      end
+      keyboard.close_write
+    end
+
+    def now
+      Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    end
+  end
+end
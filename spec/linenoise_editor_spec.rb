@@ -0,0 +1,429 @@
+require 'io/console'
+require 'io/nonblock'
+require 'pty'
+require 'socket'
+require 'tempfile'
+
+RSpec.describe Linenoise::Editor do
+  after { Linenoise::HISTORY.clear }
+
+  it "has the same defaults as the module" do
+    expect(subject).to be_multiline
+    expect(subject.autosuggest?).to eq(false)
+    expect(subject.completion_menu?).to eq(false)
+    expect(subject.hint_color).to be_nil
+    expect(subject.hint_bold?).to eq(false)
+    expect(subject.highlight?).to eq(false)
+    expect(subject.escape_timeout).to eq(0.05)
+  end
+
+  describe "#history" do
+    it "is independent from other editors" do
+      other = described_class.new
+
+      subject.history << "1"
+      other.history.push("2", "3")
+      Linenoise::HISTORY << "4"
+
+      expect(subject.history.to_a).to eq(["1"])
+      expect(other.history.to_a).to eq(["2", "3"])
+      expect(Linenoise::HISTORY.to_a).to eq(["4"])
+    end
+
+    it "has its own max size" do
+      subject.history.max_size = 1
+      subject.history.push("1", "2")
+      Linenoise::HISTORY.push("1", "2")
+
+      expect(subject.history.to_a).to eq(["2"])
+      expect(Linenoise::HISTORY.size).to eq(2)
+    end
+
+    it "suggests from its own entries" do
+      subject.history << "git status"
+      Linenoise::HISTORY << "git log"
+
+      expect(subject.history.suggest("git")).to eq("git status")
+      expect(Linenoise::HISTORY.suggest("git")).to eq("git log")
+    end
+  end
+
+  describe "settings" do
+    it "don't leak into the module" do
+      completion = proc { |input| [input] }
+
+      subject.completion_proc = completion
+      subject.multiline = false
+      subject.hint_color = Linenoise::RED
+
+      expect(subject.completion_proc).to eq(completion)
+      expect(subject).not_to be_multiline
+      expect(subject.hint_color).to eq(Linenoise::RED)
+      expect(Linenoise.completion_proc).not_to eq(completion)
+      expect(Linenoise).to be_multiline
+      expect(Linenoise.hint_color).to be_nil
+    end
+
+    it "raises error when a proc doesn't implement #call" do
+      expect { subject.hint_proc = 1 }
+        .to raise_error(ArgumentError, "argument must respond to `call'")
+    end
+  end
+
+  describe "#stats" do
+    it "are disabled by default" do
+      subject.history << "1"
+
+      expect(subject).not_to be_stats_enabled
+      expect(subject.stats[:history_add][:count]).to eq(0)
+    end
+
+    it "count history changes" do
+      subject.stats_enabled = true
+      subject.history.max_size = 2
+      subject.history.push("1", "2", "3")
+
+      expect(subject.stats[:history_add][:count]).to eq(3)
+      expect(subject.stats[:history_add][:sum]).to be_a(Float)
+      expect(subject.stats[:history_evictions]).to eq(1)
+    end
+
+    it "count the input and output of an edited line" do
+      client, server = UNIXSocket.pair
+      editor = described_class.new(input: server, output: server,
+                                   raw_input: true)
+      editor.stats_enabled = true
+
+      client.write("\e[1;1R\e[1;80R" "ab\r")
+      editor.linenoise('> ')
+
+      stats = editor.stats
+      expect(stats[:bytes_read]).to eq(16)
+      expect(stats[:bytes_written]).to be_positive
+      expect(stats[:refresh_bytes][:count]).to be_positive
+      expect(stats[:key_latency][:count]).to be_positive
+      expect(stats[:key_bytes][:sum]).to be_positive
+    end
+
+    it "can be reset" do
+      subject.stats_enabled = true
+      subject.history << "1"
+      subject.reset_stats
+
+      expect(subject.stats[:history_add][:count]).to eq(0)
+    end
+  end
+
+  describe "#linenoise" do
+    let(:null) { File.open(File::NULL, 'w') }
+
+    after { null.close }
+
+    it "reads plain lines from a pipe" do
+      input, writer = IO.pipe
+      writer.write("hello\nworld\n")
+      writer.close
+      editor = described_class.new(input: input, output: null)
+
+      expect(editor.linenoise('> ')).to eq("hello")
+      expect(editor.linenoise('> ')).to eq("world")
+      expect(editor.linenoise('> ')).to be_nil
+    end
+
+    it "edits lines from a raw input socket" do
+      client, server = UNIXSocket.pair
+      editor = described_class.new(input: server, output: server,
+                                   raw_input: true)
+
+      # Answer the two cursor position queries used to find the width.
+      client.write("\e[1;1R\e[1;80R" "ab\x7fc\r")
+      expect(editor.linenoise('> ')).to eq("ac")
+      expect(editor.input).to eq(server)
+    end
+
+    it "takes CR LF and CR NUL from a raw input socket for one Enter" do
+      client, server = UNIXSocket.pair
+      editor = described_class.new(input: server, output: null,
+                                   raw_input: true)
+      editor.columns = 80
+
+      client.write("abc\r\ndef\r\nghi\r\0jkl\r")
+      expect(editor.linenoise('> ')).to eq("abc")
+      expect(editor.linenoise('> ')).to eq("def")
+      expect(editor.linenoise('> ')).to eq("ghi")
+      expect(editor.linenoise('> ')).to eq("jkl")
+    end
+
+    it "edits in the middle of the line" do
+      client, server = UNIXSocket.pair
+      editor = described_class.new(input: server, output: null,
+                                   raw_input: true)
+      editor.columns = 80
+
+      client.write("acd\e[D\e[Db\e[Fe\r")
+      expect(editor.linenoise('> ')).to eq("abcde")
+      client.write("abc\x02\x02\x14\x04\r")
+      expect(editor.linenoise('> ')).to eq("ba")
+      client.write("one two three\x01" + "\x06" * 7 + "\x17\x0bthree\r")
+      expect(editor.linenoise('> ')).to eq("one three")
+    end
+
+    it "joins lines with ctrl-k at the end of a line" do
+      client, server = UNIXSocket.pair
+      editor = described_class.new(input: server, output: null,
+                                   raw_input: true)
+      editor.columns = 80
+
+      client.write("one\ntwo\x10\x05\x0b\x01\x0b\r")
+      expect(editor.linenoise('> ')).to eq("")
+      client.write("one\ntwo\x10\x05\x0b\r")
+      expect(editor.linenoise('> ')).to eq("onetwo")
+    end
+
+    it "drops the escape sequences of keys it doesn't know" do
+      client, server = UNIXSocket.pair
+      editor = described_class.new(input: server, output: null,
+                                   raw_input: true)
+      editor.columns = 80
+
+      client.write("ab\e[1;5Qc\e[3;2~\e[15~\eOP\e[Dd\e[3~\r")
+      expect(editor.linenoise('> ')).to eq("abd")
+    end
+
+    it "drops the whole character typed with Alt" do
+      client, server = UNIXSocket.pair
+      editor = described_class.new(input: server, output: null,
+                                   raw_input: true)
+      editor.columns = 80
+
+      client.write("a\e\xC3\xA9b\e\xE2\x82c\xC3\xA9\r")
+      line = editor.linenoise('> ').b
+      expect(line).to eq("abcé".b)
+      expect(line.force_encoding('UTF-8').valid_encoding?).to eq(true)
+    end
+
+    it "moves and kills by words, and yanks" do
+      client, server = UNIXSocket.pair
+      editor = described_class.new(input: server, output: null,
+                                   raw_input: true)
+      editor.columns = 80
+
+      client.write("one two-three\eb\e[1;5D\ed\x05 \x19\r")
+      expect(editor.linenoise('> ')).to eq("one -three two")
+      client.write("one two\x01\e[1;3C\e\x7f\x05\x19\r")
+      expect(editor.linenoise('> ')).to eq(" twoone")
+    end
+
+    it "runs the actions bound to keys" do
+      client, server = UNIXSocket.pair
+      editor = described_class.new(input: server, output: null,
+                                   raw_input: true)
+      editor.columns = 80
+      editor.history << "git status" << "ls" << "git log"
+
+      expect(editor.bind("\C-b", :backward_word)).to eq(:backward_word)
+      editor.bind("\C-a", nil)
+      editor.bind("\e[15~", :history_search_backward)
+      client.write("ab cd\x02x\x01\r")
+      expect(editor.linenoise('> ')).to eq("ab xcd")
+      client.write("git\e[15~\e[15~\e[6~\x05 x\r")
+      expect(editor.linenoise('> ')).to eq("git log x")
+
+      expect { editor.bind("ab", :yank) }.to raise_error(ArgumentError)
+      expect { editor.bind("\C-a", :nope) }.to raise_error(ArgumentError)
+    end
+
+    it "calls the procs bound to keys" do
+      client, server = UNIXSocket.pair
+      editor = described_class.new(input: server, output: null,
+                                   raw_input: true)
+      editor.columns = 80
+      calls = []
+      editor.bind("\C-x", lambda { |line, cursor|
+        calls << [line, cursor]
+        [line.upcase, cursor - 1]
+      })
+      editor.bind("\eq", ->(_line, _cursor) { :accept_line })
+
+      client.write("abc\e[D\C-xd\eqignored\r")
+      expect(editor.linenoise('> ')).to eq("AdBC")
+      expect(calls).to eq([["abc", 2]])
+    end
+
+    it "takes an escape followed by nothing for the Escape key" do
+      client, server = UNIXSocket.pair
+      editor = described_class.new(input: server, output: null,
+                                   raw_input: true)
+      editor.columns = 80
+      editor.escape_timeout = 0.01
+      reader = Thread.new { editor.linenoise('> ') }
+
+      client.write("a\e")
+      sleep 0.05
+      client.write("b\r")
+      expect(reader.join(5)&.value).to eq("ab")
+    end
+
+    it "writes all of its output to a congested non-blocking output" do
+      outputs = [false, true].map do |congested|
+        client, server = UNIXSocket.pair
+        output, terminal = UNIXSocket.pair
+        output.nonblock = congested
+        editor = described_class.new(input: server, output: output,
+                                     raw_input: true)
+        editor.columns = 80
+        editor.multiline = false
+        editor.highlight = true # Every key refreshes the whole line.
+        screen = Thread.new do
+          sleep 0.1 if congested
+          terminal.read
+        end
+
+        client.write("y" * 3000 + "\r")
+        expect(editor.linenoise('> ')).to eq("y" * 3000)
+        output.close
+        screen.value
+      end
+
+      expect(outputs[1].bytesize).to be > 100_000
+      expect(outputs[1]).to eq(outputs[0])
+    end
+
+    it "reads lines longer than 4096 bytes" do
+      client, server = UNIXSocket.pair
+      editor = described_class.new(input: server, output: null,
+                                   raw_input: true)
+      editor.columns = 80
+      line = "x" * 5000 + "é" * 5000
+      writer = Thread.new { client.write(line + "\x01y\r") }
+
+      expect(editor.linenoise('> ').b).to eq(("y" + line).b)
+      writer.join
+    end
+
+    it "keeps the lines typed ahead within a session" do
+      master, slave = PTY.open
+      editor = described_class.new(input: slave, output: slave)
+      editor.columns = 80
+      terminal = Thread.new { master.read rescue nil }
+
+      lines = editor.session do
+        expect(slave.echo?).to eq(false)
+        master.write("one\rtwo\r")
+        [editor.linenoise('> '), editor.linenoise('> ')]
+      end
+
+      expect(lines).to eq(["one", "two"])
+      expect(slave.echo?).to eq(true)
+    ensure
+      slave&.close
+      terminal&.join
+      master&.close
+    end
+
+    it "yields the lines read by each_line and adds them to the history" do
+      client, input = UNIXSocket.pair
+      editor = described_class.new(input: input, output: null, raw_input: true)
+      editor.columns = 80
+      client.write("one\r\rtwo\r\x04")
+      client.close_write
+
+      lines = []
+      expect(editor.each_line('> ', history: true) { |l| lines << l })
+        .to eq(editor)
+      expect(lines).to eq(["one", "", "two"])
+      expect(editor.history.to_a).to eq(["one", "two"])
+    ensure
+      client&.close
+      input&.close
+    end
+
+    it "streams the lines of a pipe with each_line" do
+      reader, writer = IO.pipe
+      editor = described_class.new(input: reader, output: null)
+      writer.write((1..1000).map { |i| "line #{i}\n" }.join)
+      writer.close
+      editor.stats_enabled = true
+
+      lines = editor.each_line('> ')
+      expect(lines).to be_a(Enumerator)
+      expect(lines.to_a).to eq((1..1000).map { |i| "line #{i}" })
+      expect(editor.history.to_a).to eq([])
+      expect(editor.stats[:reads]).to be < 100
+    ensure
+      reader&.close
+    end
+
+    it "leaves the rest of the input to the program after each_line" do
+      reader, writer = IO.pipe
+      editor = described_class.new(input: reader, output: null)
+      writer.write("one\ntwo\nthree\n")
+      writer.close
+
+      expect(editor.session { editor.linenoise('> ') }).to eq("one")
+      expect(reader.gets).to eq("two\n")
+
+      Tempfile.create('linenoise') do |file|
+        file.write("one\ntwo\nthree\n")
+        file.rewind
+        editor = described_class.new(input: file, output: null)
+
+        expect(editor.each_line('> ').first).to eq("one")
+        expect(file.read).to eq("two\nthree\n")
+      end
+    ensure
+      reader&.close
+    end
+
+    context "when used from several threads" do
+      let(:sockets) { UNIXSocket.pair }
+      let(:client) { sockets[0] }
+      let(:editor) do
+        described_class.new(input: sockets[1], output: null, raw_input: true)
+      end
+
+      def wait_for_sleep(thread)
+        Thread.pass until thread.status == 'sleep' || !thread.alive?
+      end
+
+      it "lets other threads use the history meanwhile" do
+        editor.history << "old"
+        reader = Thread.new { editor.linenoise('> ') }
+        wait_for_sleep(reader)
+
+        editor.history.push("1", "2")
+        expect(editor.history.to_a).to eq(["old", "1", "2"])
+
+        client.write("\e[1;1R\e[1;80R" "\e[A\r")
+        expect(reader.value).to eq("2")
+      end
+
+      it "can be killed while waiting for input" do
+        reader = Thread.new { editor.linenoise('> ') }
+        wait_for_sleep(reader)
+
+        reader.kill
+        expect(reader.join(5)).to eq(reader)
+
+        client.write("\e[1;1R\e[1;80R" "ok\r")
+        expect(editor.linenoise('> ')).to eq("ok")
+      end
+
+      it "raises the exception of a proc once the line is cancelled" do
+        editor.completion_proc = proc { raise "boom" }
+        client.write("\e[1;1R\e[1;80R" "h\t")
+
+        expect { editor.linenoise('> ') }.to raise_error(RuntimeError, "boom")
+      end
+
+      it "raises error when the editor is already reading" do
+        reader = Thread.new { editor.linenoise('> ') }
+        wait_for_sleep(reader)
+
+        expect { editor.linenoise('> ') }
+          .to raise_error(RuntimeError, "editor is already reading a line")
+        reader.kill.join
+      end
+    end
+  end
+end
@@ -41,6 +41,27 @@ RSpec.describe Linenoise::HISTORY do
       subject.load(filename)
       expect(subject.size).to eq(2)
     end
+
+    it "loads back the lines saved with newlines, backslashes or no limit" do
+      lines = ["select 1\nfrom t", "x" * 5000, "a\\nb\\", "crlf\r\n"]
+      subject.max_size = 10
+      subject.push(*lines)
+      subject.save(filename)
+      subject.clear
+
+      subject.load(filename)
+      expect(subject.to_a).to eq(lines)
+      expect(File.readlines(filename).first).to eq("#linenoise-history v2\n")
+    end
+
+    it "loads the files saved without escaping as they are" do
+      lines = ['puts "a\\nb"', '/\\\\d+/', 'x' * 5000]
+      File.write(filename, lines.map { |line| "#{line}\n" }.join)
+      subject.max_size = 10
+
+      subject.load(filename)
+      expect(subject.to_a).to eq(lines)
+    end
   end
 
   describe "#[]=" do
@@ -68,4 +89,169 @@ RSpec.describe Linenoise::HISTORY do
       expect(subject.each.to_a.join).to eq('123')
     end
   end
+
+  describe "#to_a" do
+    before do
+      subject.max_size = 100
+      subject.push('1', '2', '3')
+    end
+
+    it "returns frozen strings, the same ones while entries don't change" do
+      lines = subject.to_a
+
+      expect(lines).to eq(['1', '2', '3'])
+      expect(lines).to all(be_frozen)
+      subject << '4'
+      expect(subject.to_a[0, 3].map(&:object_id)).to eq(lines.map(&:object_id))
+    end
+
+    it "returns new strings for replaced entries" do
+      lines = subject.to_a
+      subject[1] = 'two'
+
+      expect(subject.to_a).to eq(['1', 'two', '3'])
+      expect(subject.to_a[1]).not_to equal(lines[1])
+    end
+
+    it "forgets evicted entries" do
+      subject.to_a
+      subject.max_size = 2
+
+      expect(subject.to_a).to eq(['2', '3'])
+    end
+  end
+
+  describe "#[]" do
+    before do
+      subject.max_size = 100
+      subject.push('1', '2', '3', '4')
+    end
+
+    it "slices like an array" do
+      expect(subject[1, 2]).to eq(['2', '3'])
+      expect(subject[-2, 5]).to eq(['3', '4'])
+      expect(subject[1..-2]).to eq(['2', '3'])
+      expect(subject[4, 1]).to eq([])
+      expect(subject[5, 1]).to be_nil
+      expect(subject[10..11]).to be_nil
+    end
+
+    it "reuses the strings of the slices read before" do
+      first = subject[0, 2]
+      last = subject[2..-1]
+
+      expect(subject.to_a).to eq(first + last)
+      expect(subject.to_a.map(&:object_id))
+        .to eq((first + last).map(&:object_id))
+    end
+  end
+
+  describe "#last" do
+    before do
+      subject.max_size = 100
+      subject.push('1', '2', '3')
+    end
+
+    it "returns the newest entries" do
+      expect(subject.last).to eq('3')
+      expect(subject.last(2)).to eq(['2', '3'])
+      expect(subject.last(10)).to eq(['1', '2', '3'])
+      expect(subject.last(0)).to eq([])
+    end
+
+    it "returns nil when the history is empty" do
+      subject.clear
+      expect(subject.last).to be_nil
+    end
+  end
+
+  describe "#reverse_each" do
+    before { subject.push('1', '2', '3') }
+
+    it "iterates over history lines, newest first" do
+      expect(subject.reverse_each.to_a).to eq(['3', '2', '1'])
+    end
+  end
+
+  describe "#suggest" do
+    before do
+      subject.max_size = 100
+      subject.push('git status', 'git log', 'ls', 'git log --stat')
+    end
+
+    it "returns the most recent entry starting with the prefix" do
+      expect(subject.suggest('git')).to eq('git log --stat')
+      expect(subject.suggest('git s')).to eq('git status')
+    end
+
+    it "ignores entries equal to the prefix" do
+      expect(subject.suggest('ls')).to be_nil
+    end
+
+    it "forgets evicted entries" do
+      subject.max_size = 3
+      expect(subject.suggest('git s')).to be_nil
+
+      subject.push('ls -la', 'pwd', 'cd')
+      expect(subject.suggest('git')).to be_nil
+      expect(subject.suggest('l')).to eq('ls -la')
+    end
+
+    it "follows replaced entries" do
+      subject[0] = 'git stash'
+      expect(subject.suggest('git st')).to eq('git stash')
+    end
+
+    it "follows the entries added to a full history one at a time" do
+      subject.max_size = 4
+      %w[make cd git\ add ls git\ push].each do |line|
+        subject << line
+        expected = subject.include?('make') ? 'make' : nil
+        expect(subject.suggest('m')).to eq(expected)
+      end
+      subject[1] = 'git commit'
+
+      expect(subject.to_a).to eq(['cd', 'git commit', 'ls', 'git push'])
+      expect(subject.suggest('git')).to eq('git push')
+      expect(subject.suggest('git c')).to eq('git commit')
+      expect(subject.suggest('git a')).to be_nil
+    end
+  end
+
+  describe "#search" do
+    before do
+      subject.max_size = 100
+      subject.push('git status', 'ls', 'git log', 'make test', 'git diff')
+    end
+
+    it "returns the entries containing a string, oldest first" do
+      expect(subject.search('git')).to eq(['git status', 'git log', 'git diff'])
+      expect(subject.search('zzz')).to eq([])
+    end
+
+    it "returns the entries matching a regexp" do
+      expect(subject.search(/^git (s|d)/)).to eq(['git status', 'git diff'])
+      expect(subject.search(/LS/i)).to eq(['ls'])
+      expect(subject.search(/make/)).to eq(['make test'])
+    end
+
+    it "stops after limit entries, newest first when reverse" do
+      expect(subject.search('git', limit: 2)).to eq(['git status', 'git log'])
+      expect(subject.search('git', limit: 2, reverse: true))
+        .to eq(['git diff', 'git log'])
+      expect(subject.search(/t$/, limit: 1, reverse: true)).to eq(['make test'])
+    end
+
+    it "returns indices" do
+      expect(subject.search('git', indices: true)).to eq([0, 2, 4])
+      expect(subject.search(/s$/, indices: true)).to eq([0, 1])
+    end
+
+    it "returns frozen strings and follows replaced entries" do
+      subject.to_a
+      subject[2] = 'git stash'
+      expect(subject.search('git st')).to eq(['git status', 'git stash'])
+      expect(subject.search(/stash/)).to all(be_frozen)
+    end
+  end
 end
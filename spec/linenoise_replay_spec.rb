@@ -0,0 +1,60 @@
+require 'socket'
+require 'tempfile'
+
+RSpec.describe Linenoise::Replay do
+  let(:log) { Tempfile.new('linenoise-replay') }
+  let(:completion) { proc { |input| ["#{input}ello"] } }
+
+  after { log.close! }
+
+  # Edits a line for every string of keys, recording them.
+  def record(*lines)
+    client, server = UNIXSocket.pair
+    editor = Linenoise::Editor.new(input: server, output: server,
+                                   raw_input: true)
+    editor.columns = 20
+    editor.multiline = false
+    editor.completion_proc = completion
+    editor.recorder = log
+    lines.each do |keys|
+      client.write(keys)
+      editor.linenoise('> ')
+    end
+    editor.recorder = nil
+    described_class.new(File.binread(log.path))
+  end
+
+  it "parses the recorded lines" do
+    replay = record("ab\x7fc\r", "\x03")
+
+    expect(replay.lines.size).to eq(2)
+    expect(replay.lines[0].prompt).to eq("> ")
+    expect(replay.lines[0].columns).to eq(20)
+    expect(replay.lines[0]).not_to be_multiline
+    expect(replay.lines[0].input).to eq("ab\x7fc\r")
+    expect(replay.lines[0].output).to start_with("> ")
+    expect(replay.lines[0].line).to eq("ac")
+    expect(replay.lines[1].line).to be_nil
+  end
+
+  it "replays the lines identically" do
+    results = record("ab\x7fc\r", "\x03").run
+
+    expect(results.map(&:line)).to eq(["ac", nil])
+    expect(results).to all(be_identical)
+  end
+
+  it "sets up the editor with the given block" do
+    replay = record("h\t\r")
+
+    expect(replay.run.first).not_to be_identical
+    result = replay.run { |editor| editor.completion_proc = completion }.first
+    expect(result.line).to eq("hello")
+    expect(result).to be_identical
+  end
+
+  it "raises error when the log is not a session log" do
+    expect { described_class.new("hello") }
+      .to raise_error(described_class::FormatError)
+  end
+end
@@ -0,0 +1,226 @@
+require 'socket'
+
+RSpec.describe Linenoise::Screen do
+  subject { described_class.new(rows: 3, columns: 10) }
+
+  it "is blank at first" do
+    expect(subject.lines).to eq(["", "", ""])
+    expect(subject.cursor).to eq([0, 0])
+    expect(subject.to_s).to eq("")
+  end
+
+  it "moves the cursor and erases lines" do
+    subject.write("hello\r\nworld\e[1;2H\e[0K")
+
+    expect(subject.lines).to eq(["h", "world", ""])
+    expect(subject.cursor).to eq([0, 1])
+  end
+
+  it "wraps to the next row when printing past the last column" do
+    subject.write("0123456789")
+    expect(subject.cursor).to eq([0, 9])
+
+    subject.write("ab")
+    expect(subject.lines).to eq(["0123456789", "ab", ""])
+  end
+
+  it "scrolls up on a line feed in the last row" do
+    subject.write("a\r\nb\r\nc\r\nd")
+
+    expect(subject.to_s).to eq("b\nc\nd")
+    expect(subject.stats[:scrolls]).to eq(1)
+  end
+
+  it "puts clusters in one cell and wide ones in two" do
+    subject.write("漢字é!")
+
+    expect(subject.lines[0]).to eq("漢字é!")
+    expect(subject.cursor).to eq([0, 6])
+  end
+
+  it "keeps the attributes of the cells" do
+    subject.write("\e[1;35;49mhi\e[0m\e[7mx")
+
+    expect(subject.attributes(0, 0))
+      .to eq(color: Linenoise::MAGENTA, bold: true, reverse: false)
+    expect(subject.attributes(0, 2))
+      .to eq(color: nil, bold: false, reverse: true)
+    expect { subject.attributes(3, 0) }.to raise_error(IndexError)
+  end
+
+  it "inserts and deletes characters in the row of the cursor" do
+    subject.write("abcdef\r\e[2C\e[@X\e[2P")
+
+    expect(subject.lines[0]).to eq("abXef")
+    expect(subject.cursor).to eq([0, 3])
+  end
+
+  it "counts the cells changed by every frame" do
+    subject.write("abc")
+    subject.write("\rabd")
+
+    expect(subject.stats).to include(frames: 2, bytes: 7, cells: 4,
+                                     last_bytes: 4, last_cells: 1)
+  end
+
+  context "when it is the output of an editor" do
+    subject { described_class.new(rows: 5, columns: 20) }
+
+    let(:sockets) { UNIXSocket.pair }
+    let(:client) { sockets[0] }
+    let(:editor) do
+      Linenoise::Editor.new(input: sockets[1], output: subject,
+                            raw_input: true)
+    end
+
+    it "shows the edited line" do
+      editor.multiline = false
+      client.write("x" * 30 + "\r")
+
+      expect(editor.linenoise('> ')).to eq("x" * 30)
+      expect(subject.lines[0]).to eq("> " + "x" * 12)
+      expect(subject.cursor).to eq([1, 0])
+    end
+
+    it "scrolls long lines by half the screen" do
+      editor.multiline = false
+      reader = Thread.new { editor.linenoise('> ') }
+      client.write(("a".."z").to_a.join)
+      Thread.pass until subject.cursor == [0, 19]
+
+      expect(subject.lines[0]).to eq("> jklmnopqrstuvwxyz")
+      client.write("\e[D" * 8)
+      Thread.pass until subject.cursor == [0, 11]
+
+      expect(subject.lines[0]).to eq("> jklmnopqrstuvwxyz")
+      client.write("\e[D" * 9)
+      Thread.pass until subject.lines[0] == "> abcdefghijklmnopq"
+
+      expect(subject.cursor).to eq([0, 11])
+      client.write("\r")
+      expect(reader.value).to eq(("a".."z").to_a.join)
+    end
+
+    it "writes the output of the keys typed ahead in a single frame" do
+      client.write("hello\e[D\e[Dx\r")
+
+      expect(editor.linenoise('> ')).to eq("helxlo")
+      expect(subject.lines[0]).to eq("> helxlo")
+      expect(subject.stats[:frames]).to eq(1)
+    end
+
+    it "shows the text on both sides of the cursor" do
+      editor.multiline = false
+      client.write("abcdef\e[D\e[D\e[DX\r")
+      editor.linenoise('> ')
+
+      expect(subject.lines[0]).to eq("> abcXdef")
+    end
+
+    it "edits the middle of the line with a few bytes" do
+      editor.multiline = false
+      reader = Thread.new { editor.linenoise('prompt> ') }
+      client.write("hello wor" + "\e[D" * 3)
+      Thread.pass until subject.cursor == [0, 14]
+      client.write("X")
+      Thread.pass until subject.lines[0] == "prompt> hello Xwor"
+
+      expect(subject.stats[:last_bytes]).to eq(4)
+      client.write("\x7f")
+      Thread.pass until subject.lines[0] == "prompt> hello wor"
+
+      expect(subject.stats[:last_bytes]).to eq(4)
+      client.write("\x01")
+      Thread.pass until subject.cursor == [0, 8]
+      client.write("\x0b")
+      Thread.pass until subject.lines[0] == "prompt>"
+
+      expect(subject.stats[:last_bytes]).to be < 10
+      client.write("\r")
+      reader.join
+    end
+
+    it "wraps long lines in multiline mode" do
+      client.write("x" * 30 + "\r")
+      editor.linenoise('> ')
+
+      expect(subject.lines[0, 2]).to eq(["> " + "x" * 18, "x" * 12])
+    end
+
+    it "shows lines with newlines on their own rows" do
+      client.write("select *\nfrom t\e\rwhere 1\r")
+
+      expect(editor.linenoise('> ')).to eq("select *\nfrom t\nwhere 1")
+      expect(subject.lines[0, 3]).to eq(["> select *", "from t", "where 1"])
+    end
+
+    it "moves between lines with up and down" do
+      client.write("ab\ncd\e[Ax\e[By\r")
+
+      expect(editor.linenoise('> ')).to eq("xab\ncdy")
+    end
+
+    it "only draws the rows visible on the screen" do
+      reader = Thread.new { editor.linenoise('> ') }
+      client.write((1..10).map { |i| "line #{i}" }.join("\n"))
+      Thread.pass until subject.lines[4] == "line 10"
+
+      expect(subject.lines).to eq(["line 6", "line 7", "line 8", "line 9",
+                                   "line 10"])
+      client.write("\e[A" * 6)
+      Thread.pass until subject.lines[0] == "line 4"
+      client.write("\e[A")
+      Thread.pass until subject.lines[0] == "line 3"
+
+      expect(subject.cursor).to eq([0, 6])
+      expect(subject.stats[:last_bytes]).to be < 100
+      client.write("\r")
+      reader.join
+    end
+
+    it "highlights keywords, numbers, strings and comments" do
+      editor.highlight = true
+      client.write("selec 1 'a' # c" + "\e[D" * 10 + "t\r")
+      editor.linenoise('> ')
+
+      expect(subject.lines[0]).to eq("> select 1 'a' # c")
+      expect(subject.attributes(0, 2)).to include(color: Linenoise::BLUE,
+                                                  bold: true)
+      expect(subject.attributes(0, 7)).to include(color: Linenoise::BLUE)
+      expect(subject.attributes(0, 8)[:color]).to be_nil
+      expect(subject.attributes(0, 9)[:color]).to eq(Linenoise::MAGENTA)
+      expect(subject.attributes(0, 11)[:color]).to eq(Linenoise::GREEN)
+      expect(subject.attributes(0, 17)[:color]).to eq(90)
+    end
+
+    it "gives the highlight proc only the lines changed" do
+      calls = []
+      editor.highlight_proc = proc do |text|
+        calls << text
+        [[0, 1, Linenoise::RED, true]]
+      end
+      client.write("ab\ncd\e[Ax\r")
+
+      expect(editor.linenoise('> ')).to eq("xab\ncd")
+      expect(calls).to include("cd")
+      expect(calls.last).to eq("xab")
+      expect(subject.attributes(0, 2)).to include(color: Linenoise::RED,
+                                                  bold: true)
+      expect(subject.attributes(0, 3)[:color]).to be_nil
+      expect(subject.attributes(1, 0)[:color]).to eq(Linenoise::RED)
+    end
+
+    it "shows hints in their color" do
+      editor.hint_proc = proc { |buf| " status" if buf == "git" }
+      editor.hint_color = Linenoise::CYAN
+      reader = Thread.new { editor.linenoise('> ') }
+      client.write("git")
+      Thread.pass until subject.lines[0] == "> git status"
+
+      expect(subject.attributes(0, 6)[:color]).to eq(Linenoise::CYAN)
+      client.write("\r")
+      expect(reader.value).to eq("git")
+      expect(subject.lines[0]).to eq("> git")
+    end
+  end
+end
@@ -61,4 +61,105 @@ RSpec.describe Linenoise do
       expect(Linenoise).not_to be_multiline
     end
   end
+
+  describe "#autosuggest?" do
+    after { Linenoise.autosuggest = false }
+
+    it "is `false` by default" do
+      expect(Linenoise).not_to be_autosuggest
+    end
+
+    it "can be set to `true`" do
+      Linenoise.autosuggest = true
+      expect(Linenoise).to be_autosuggest
+    end
+  end
+
+  describe "#highlight?" do
+    after { Linenoise.highlight = false }
+
+    it "is `false` by default" do
+      expect(Linenoise).not_to be_highlight
+    end
+
+    it "can be set to `true`" do
+      Linenoise.highlight = true
+      expect(Linenoise).to be_highlight
+    end
+  end
+
+  describe "#completion_menu?" do
+    after { Linenoise.completion_menu = false }
+
+    it "is `false` by default" do
+      expect(Linenoise).not_to be_completion_menu
+    end
+
+    it "can be set to `true`" do
+      Linenoise.completion_menu = true
+      expect(Linenoise).to be_completion_menu
+    end
+  end
+
+  describe "#display_width" do
+    it "counts one column per ASCII character" do
+      expect(Linenoise.display_width('hello')).to eq(5)
+    end
+
+    it "counts two columns per wide character" do
+      expect(Linenoise.display_width('日本語')).to eq(6)
+    end
+
+    it "doesn't count combining marks" do
+      expect(Linenoise.display_width("e\u0301")).to eq(1)
+    end
+
+    it "counts emoji sequences as a single wide character" do
+      expect(Linenoise.display_width("\u{1F44D}\u{1F3FD}")).to eq(2)
+      expect(Linenoise.display_width("\u{1F468}\u200D\u{1F469}\u200D\u{1F467}"))
+        .to eq(2)
+      expect(Linenoise.display_width("\u{1F1FA}\u{1F1E6}")).to eq(2)
+    end
+  end
+
+  describe "#history" do
+    it "is the default editor's history" do
+      expect(Linenoise.history).to equal(Linenoise::HISTORY)
+    end
+  end
+
+  context "when used from a Ractor" do
+    before do
+      skip "Ractors are not supported" unless defined?(Ractor)
+      @experimental = Warning[:experimental]
+      Warning[:experimental] = false
+    end
+
+    after { Warning[:experimental] = @experimental if defined?(Ractor) }
+
+    it "has a default editor per Ractor" do
+      ractor = Ractor.new do
+        Linenoise.history << "1"
+        Linenoise.hint_color = Linenoise::RED
+        [Linenoise.history.to_a, Linenoise.hint_color, Linenoise::VERSION]
+      end
+
+      expect(ractor.take).to eq([["1"], Linenoise::RED, Linenoise::VERSION])
+      expect(Linenoise::HISTORY.size).to eq(0)
+      expect(Linenoise.hint_color).to be_nil
+    end
+
+    it "reads lines with editors in parallel" do
+      ractors = Array.new(2) do |i|
+        Ractor.new(i) do |n|
+          input, writer = IO.pipe
+          writer.write("line #{n}\n")
+          writer.close
+          Linenoise::Editor.new(input: input).linenoise('> ')
+        end
+      end
+
+      expect(ractors.map(&:take)).to eq(["line 0", "line 1"])
+    end
+  end
 end